@@ -724,9 +724,12 @@ if (GetFwVersion() >= 0x0105)
                        0,
                        macros.buffer, sizeof(macros.buffer),
                        1000);
-  if (rc >= 1)
+  if (rc >= 1)                          /* skip the report ID                */
+    {
+    rc--;
     for (int i = 0; i < rc && i < buflen; i++)
-      buffer[i] = macros.buffer[i];
+      buffer[i] = macros.macro_data[i];
+    }
   }
 // if that did not return a sufficiently large buffer, try old method
 if (rc < 1)
@@ -65,6 +65,23 @@ enum blusb_error {
 };
 #endif
 
+/*****************************************************************************/
+/* BlUsbDevCaps : snapshot of the connected device's capabilities            */
+/*****************************************************************************/
+
+// Taken once per connection, so that views don't need to talk to the device
+struct BlUsbDevCaps
+  {
+  bool bOpen;
+  int fwVersion;
+  int maxLayers;
+  int matrixRows, matrixCols;           /* -1 if unknown                     */
+
+  BlUsbDevCaps()
+    : bOpen(false), fwVersion(0), maxLayers(0), matrixRows(-1), matrixCols(-1)
+    { }
+  };
+
 /*****************************************************************************/
 /* BlUsbDev : BlUSB device communication class declaration                   */
 /*****************************************************************************/
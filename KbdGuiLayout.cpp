@@ -683,10 +683,265 @@ static GuiKey IsoM122[] =
     { 7, 1, KP_DOT,     7, 14, 1.00f, 1.00f, ".", "." },
   };
 
+/*===========================================================================*/
+/* KbdOverlayText class members                                              */
+/*===========================================================================*/
+
+/*****************************************************************************/
+/* ToText : convert to sparse text format                                    */
+/*****************************************************************************/
+
+wxString KbdOverlayText::ToText() const
+{
+wxString s;
+for (int pos = 0; pos < MAXROWS * MAXCOLS; pos++)
+  if (keys[pos] != KB_NONE)
+    {
+    if (s.size())
+      s += wxT(", ");
+    s += wxString::Format(wxT("%d/%d=%X"),
+                          pos / MAXCOLS, pos % MAXCOLS, keys[pos]);
+    }
+return s;
+}
+
+/*****************************************************************************/
+/* FromText : read from sparse text format                                   */
+/*****************************************************************************/
+
+bool KbdOverlayText::FromText(wxString const &s)
+{
+Clear();
+size_t i = 0;
+for (;;)
+  {
+  while (i < s.size() && isspace(s[i]))
+    i++;
+  if (i >= s.size())
+    break;
+  long val[3] = { 0, 0, 0 };            /* row / col / key                   */
+  static const wxChar delim[3] = { wxT('/'), wxT('='), wxT(',') };
+  for (int part = 0; part < 3; part++)
+    {
+    while (i < s.size() && isspace(s[i]))
+      i++;
+    size_t start = i;
+    while (i < s.size() && (part < 2 ? isdigit(s[i]) : isxdigit(s[i])))
+      i++;
+    if (start == i ||
+        !s.substr(start, i - start).ToCLong(&val[part], part < 2 ? 10 : 16))
+      return false;
+    while (i < s.size() && isspace(s[i]))
+      i++;
+    if (i < s.size() && s[i] == delim[part])
+      i++;
+    else if (part < 2)
+      return false;
+    else if (i < s.size())              /* garbage after the key             */
+      return false;
+    }
+  if (val[0] >= rows || val[1] >= cols || val[2] > 0xffff)
+    return false;
+  SetKey(val[0], val[1], (MatrixKey)val[2]);
+  }
+return true;
+}
+
 /*===========================================================================*/
 /* KbdLayout class members                                                   */
 /*===========================================================================*/
 
+/*****************************************************************************/
+/* MacrosToText : write macros in text format                                */
+/*****************************************************************************/
+
+wxString KbdLayout::MacrosToText() const
+{
+wxString s;
+for (int mac = 0; mac < macros; mac++)
+  {
+  wxUint8 const *pmac = macrodata + mac * LEN_MACRO;
+  if (KbdMacro(pmac).IsEmpty())         /* only write the used ones          */
+    continue;
+  if (s.size())
+    s += wxT(", ");
+  s += wxString::Format(wxT("%d="), mac + 1);
+  for (int i = 0; i < LEN_MACRO; i++)
+    s += wxString::Format(i ? wxT(" %02X") : wxT("%02X"), pmac[i]);
+  }
+return s;
+}
+
+/*****************************************************************************/
+/* MacrosFromText : read macros from text format                             */
+/*****************************************************************************/
+
+bool KbdLayout::MacrosFromText(wxString const &s)
+{
+wxUint8 newdata[NUM_MACROKEYS * LEN_MACRO];
+memset(newdata, KB_UNUSED, sizeof(newdata));
+size_t i = 0;
+for (;;)
+  {
+  while (i < s.size() && isspace(s[i]))
+    i++;
+  if (i >= s.size())
+    break;
+  long num = 0;                         /* 1-based macro number              */
+  size_t start = i;
+  while (i < s.size() && isdigit(s[i]))
+    i++;
+  if (start == i ||
+      !s.substr(start, i - start).ToCLong(&num) ||
+      num < 1 || num > NUM_MACROKEYS)
+    return false;
+  while (i < s.size() && isspace(s[i]))
+    i++;
+  if (i >= s.size() || s[i] != wxT('='))
+    return false;
+  i++;
+  wxUint8 *pmac = newdata + (num - 1) * LEN_MACRO;
+  for (int b = 0; b < LEN_MACRO; b++)
+    {
+    long val = 0;
+    while (i < s.size() && isspace(s[i]))
+      i++;
+    start = i;
+    while (i < s.size() && isxdigit(s[i]))
+      i++;
+    if (start == i ||
+        !s.substr(start, i - start).ToCLong(&val, 16) ||
+        val > 0xff)
+      return false;
+    pmac[b] = (wxUint8)val;
+    }
+  while (i < s.size() && isspace(s[i]))
+    i++;
+  if (i < s.size() && s[i] == wxT(','))
+    i++;
+  else if (i < s.size())                /* garbage after the macro           */
+    return false;
+  }
+return ImportMacros(newdata, sizeof(newdata));
+}
+
+/*****************************************************************************/
+/* Character classes for the text layout parser                              */
+/*****************************************************************************/
+
+enum
+  {
+  ccDigit = 0x01,                       /* 0-9                               */
+  ccHex   = 0x02,                       /* A-F, a-f                          */
+  ccSep   = 0x04,                       /* value separator (',' or '\0')     */
+  ccBlank = 0x08,                       /* blank within a line               */
+  ccSpace = 0x10,                       /* any white space                   */
+  ccEol   = 0x20,                       /* line end                          */
+  };
+
+static wxUint8 charClass[256];          /* character -> class bits           */
+static wxUint8 charValue[256];          /* hex digit -> value                */
+
+static struct CharClassSetup
+  {
+  CharClassSetup()
+    {
+    int i;
+    for (i = '0'; i <= '9'; i++)
+      {
+      charClass[i] = ccDigit;
+      charValue[i] = (wxUint8)(i - '0');
+      }
+    for (i = 0; i < 6; i++)
+      {
+      charClass['A' + i] = charClass['a' + i] = ccHex;
+      charValue['A' + i] = charValue['a' + i] = (wxUint8)(10 + i);
+      }
+    charClass[(int)','] = charClass[0] = ccSep;
+    charClass[(int)' '] = ccBlank | ccSpace;
+    charClass[(int)'\t'] = charClass[(int)'\v'] = charClass[(int)'\f'] = ccSpace;
+    charClass[(int)'\r'] = charClass[(int)'\n'] = ccSpace | ccEol;
+    }
+  } charClassSetup;
+
+/*****************************************************************************/
+/* ParseTextLine : parse one line of Joern's text format                     */
+/*****************************************************************************/
+
+// Appends the layer's keys to mb and returns the number of key positions
+// found in the line (0 if the line is empty), or -1 if it's malformed.
+// Once all key positions are there, the rest of the line is not looked at,
+// like in the line-by-line parser that was used before.
+// Decimal and hexadecimal values are accumulated in parallel, so the line
+// only needs to be scanned once; which one is used is decided at the end.
+
+static int ParseTextLine
+    (
+    const wxUint8 *p,
+    const wxUint8 *eol,
+    int tgtkeys,
+    wxMemoryBuffer &mb
+    )
+{
+wxUint16 vdec[MAXROWS * MAXCOLS], vhex[MAXROWS * MAXCOLS];
+int nvals = 0, curpos = 0;
+wxUint16 dec = 0, hex = 0;
+bool inValue = false, hasDec = false, hasHex = false;
+
+for (; ; p++)
+  {
+  // the line end is handled like the terminating '\0' of a string
+  int cls = (p < eol) ? charClass[*p] : ccSep;
+  if (cls & (ccDigit | ccHex))
+    {
+    if (!inValue)
+      dec = hex = 0;
+    inValue = true;
+    dec = dec * 10 + charValue[*p];
+    hex = hex * 16 + charValue[*p];
+    if (cls & ccDigit)
+      hasDec = true;
+    else
+      hasHex = true;
+    }
+  else if (cls & ccSep)
+    {
+    if (inValue)
+      {
+      vdec[nvals] = dec;
+      vhex[nvals++] = hex;
+      inValue = false;
+      }
+    curpos++;
+    }
+  else if (!(cls & ccBlank))
+    return -1;
+  if (p >= eol || curpos >= tgtkeys)    /* the rest of the line is ignored   */
+    break;
+  }
+if (!hasDec && !hasHex)
+  return -1;
+
+// While having hex chars in the line is NOT enough to determine the
+// format with absolute certainty, it SHOULD be enough. A layout which
+// only contains hex values that can also be read as decimal is highly
+// unlikely.
+const wxUint16 *vals = hasHex ? vhex : vdec;
+for (int i = 0; i < nvals; i++)
+  {
+  // assure little-endian internal buffer format
+  mb.AppendByte(vals[i] & 0xff);
+  mb.AppendByte(vals[i] >> 8);
+  }
+if (curpos)                             /* if the line has contents,         */
+  for (int i = curpos; i < tgtkeys; i++)  /* assure the layer is complete    */
+    {
+    mb.AppendByte('\0');
+    mb.AppendByte('\0');
+    }
+return curpos;
+}
+
 /*****************************************************************************/
 /* ReadFile : load contents from a file                                      */
 /*****************************************************************************/
@@ -700,138 +955,117 @@ if (!f.Open(filename))
 int tgtrows = NUMROWS, tgtcols = NUMCOLS;
 int tgtkeys = tgtrows * tgtcols;
 int layers = 0;
+wxUint8 macbuf[NUM_MACROKEYS * LEN_MACRO];
+int macsize = 0;                        /* no macros in file                 */
 
-wxMemoryBuffer mb;
-wxUint8 c;                              /* get first character for filetype  */
-size_t frc;
-if ((frc = f.Read(&c, sizeof(c))) != sizeof(c))
+wxFileOffset flen = f.Length();         /* read the file in one go           */
+if (flen <= 0 || flen > 0x100000)       /* layouts are a few KB at most      */
   return false;
+wxMemoryBuffer mbFile;
+mbFile.SetBufSize((size_t)flen);
+if (f.Read(mbFile.GetData(), (size_t)flen) != (ssize_t)flen)
+  return false;
+mbFile.SetDataLen((size_t)flen);
+const wxUint8 *data = (const wxUint8 *)mbFile.GetData();
+const wxUint8 *end = data + flen;
+
+wxMemoryBuffer mb;                      /* text layout in binary format      */
+const wxUint8 *layout;                  /* layer count + layers              */
+ssize_t ks;                             /* size of the layers in bytes       */
+int transformat;
+wxUint8 c = data[0];                    /* get first character for filetype  */
 if (c > 0 && c <= NUMLAYERS_MAX)        /* binary?                           */
   {                                     /* same format as dev write          */
-  layers = c;
-  mb.SetBufSize(8192);
-  wxUint8 *buf = (wxUint8 *)mb.GetData();
-  *buf++ = c;
-  *buf++ = '\0';
-  ssize_t rb = f.Read(buf, mb.GetBufSize() - sizeof(wxUint16));
-  mb.SetDataLen(sizeof(wxUint16) + rb);
+  layers = c;                           /* ... so it can be used in place    */
+  layout = data;
+  ks = flen - sizeof(wxUint8);
+  transformat = 1;
   }
-else if (isspace(c) || isdigit(c))
+else if ((charClass[c] & (ccSpace | ccDigit)) || c == '+')
   {                                     /* Joern's text format?              */
+  mb.SetBufSize(sizeof(wxUint16) +
+                NUMLAYERS_MAX * tgtkeys * sizeof(wxUint16));
   mb.AppendByte('\0');                  /* put empty layer count             */
   mb.AppendByte('\0');
-  while (frc == sizeof(c))              /* iterate through the lines         */
+  const wxUint8 *p = data;
+  while (p < end)                       /* iterate through the lines         */
     {
-    while (isspace(c))                  /* catch leading blanks              */
+    while (p < end && (charClass[*p] & ccSpace))
+      p++;                              /* skip leading blanks, empty lines  */
+    if (p >= end)
+      break;
+    const wxUint8 *eol = p;
+    while (eol < end && !(charClass[*eol] & ccEol))
+      eol++;
+
+    if (*p == 'M')                      /* macro set?                        */
       {
-      c = '\0';
-      if ((frc = f.Read(&c, sizeof(c))) != sizeof(c))
-        {
-        if (!frc)
-          break;
+      KbdLayout ml;
+      if (!ml.MacrosFromText(wxString((const char *)p + 1, eol - p - 1)))
         return false;
-        }
-      }
-    wxMemoryBuffer mbLine;              /* read complete line into buffer    */
-    while (c != '\r' && c != '\n' && frc == sizeof(c))
-      {
-      mbLine.AppendByte((char)c);
-      c = '\0';
-      frc = f.Read(&c, sizeof(c));
+      macsize = sizeof(macbuf);
+      ml.ExportMacros(macbuf, macsize);
       }
-    mbLine.AppendByte('\0');
-    wxUint16 cc = -1;
-    const char *pcs = mbLine;
-    int curpos = 0;
-
-    // first, try to determine the format (dec or hex)
-    bool hasHex = false, hasDec = false, bCorrFmt = true;
-    for (size_t i = 0; bCorrFmt && i < mbLine.GetDataLen(); i++)
+    else if (layers >= NUMLAYERS_MAX)   /* ignore layers beyond maximum      */
+      ;
+    else if (*p == '+')                 /* sparse overlay layer?             */
       {
-      const char c = pcs[i];
-      if (isdigit(c))
-        hasDec = true;
-      else if (isxdigit(c))
-        hasHex = true;
-      else if (c != ' ' && c != ',' && c != '\0')
-        bCorrFmt = false;
-      }
-    if (!hasDec && !hasHex)
-      bCorrFmt = false;
-    if (!bCorrFmt)
-      return false;
-    // Now we know whether there's hex or dec chars in there.
-    // While this is NOT enough to determine the file type with
-    // absolute certainty, it SHOULD be enough. A layout which only
-    // contains hex values that can also be read as decimal is
-    // highly unlikely.
-    const int mult = hasHex ? 16 : 10;
-    for (size_t i = 0; i < mbLine.GetDataLen(); i++)
-      {
-      if (isdigit(pcs[i]))
-        {
-        if (cc == (wxUint16)-1)
-          cc = 0;
-        cc = cc * mult + (pcs[i] - '0');
-        }
-      else if (isxdigit(pcs[i]))
-        {
-        // this is A-F | a-f, as 0-9 has already been processed above
-        if (cc == (wxUint16)-1)
-          cc = 0;
-        char c = pcs[i];
-        if (c >= 'a' && c <= 'f')
-          c -= ('a' - 'A');
-        cc = cc * mult + (c - ('A' - 10));
-        }
-      else if (pcs[i] == ',' || pcs[i] == '\0')
-        {
-        if (cc != (wxUint16)-1)
+      KbdOverlayText ot(tgtrows, tgtcols);
+      if (!ot.FromText(wxString((const char *)p + 1, eol - p - 1)))
+        return false;
+      for (int r = 0; r < tgtrows; r++)
+        for (int col = 0; col < tgtcols; col++)
           {
-          // assure little-endian internal buffer format
-          mb.AppendByte(cc & 0xff);
-          mb.AppendByte(cc >> 8);
-          cc = (wxUint16)-1;
+          wxUint16 k = (wxUint16)ot.GetKey(r, col);
+          mb.AppendByte(k & 0xff);
+          mb.AppendByte(k >> 8);
           }
-        curpos++;
-        if (curpos >= tgtkeys)
-          break;
-        }
-      else if (!isspace(pcs[i]))
-        return false;
+      layers++;
       }
-    if (curpos)                         /* if the line has contents,         */
-      {                                 /* assure the layer is complete      */
-      for (; curpos < tgtkeys; curpos++)
-        {
-        mb.AppendByte('\0');
-        mb.AppendByte('\0');
-        }
-      if (++layers >= NUMLAYERS_MAX)    /* stop if we got enough             */
-        break;
-      }
-
-    while (c == '\r' || c == '\n')      /* prefetch 1st char of next line    */
+    else
       {
-      c = '\0';
-      if ((frc = f.Read(&c, sizeof(c))) != sizeof(c))
-        {
-        if (!frc)
-          break;
+      int rc = ParseTextLine(p, eol, tgtkeys, mb);
+      if (rc < 0)
         return false;
-        }
+      if (rc)
+        layers++;
       }
+    p = eol;
     }
   *(char *)mb.GetData() = (char)layers; /* store # layers                    */
+  layout = (const wxUint8 *)mb.GetData();
+  ks = mb.GetDataLen() - sizeof(wxUint16);
+  transformat = 0;
   }
 else
   return false;
                                         /* calculate layout                  */
-ssize_t ks = mb.GetDataLen() - sizeof(wxUint16);
 if (!layers)                            /* get size of 1 layer               */
   return false;
+if (!macsize)                           /* binary with trailing macro set?   */
+  {                                     /* "MAC", count, packed macros       */
+  static const int knownCols[] = { 20, 16 };
+  for (int i = 0; i < _countof(knownCols); i++)
+    {
+    ssize_t lsz = (ssize_t)layers * tgtrows * knownCols[i] * sizeof(wxUint16);
+    if (ks < lsz + 4)
+      continue;
+    wxUint8 const *pm = layout + lsz +
+                        (transformat ? sizeof(wxUint8) : sizeof(wxUint16));
+    if (!memcmp(pm, "MAC", 3) &&
+        pm[3] <= NUM_MACROKEYS &&
+        ks == lsz + 4 + pm[3] * LEN_MACRO)
+      {
+      macsize = pm[3] * LEN_MACRO;
+      memcpy(macbuf, pm + 4, macsize);
+      ks = lsz;
+      break;
+      }
+    }
+  }
 ssize_t layersize = ks / (ssize_t)layers;
-if (ks % layersize)                     /* rb must be a multiple of that!    */
+if (layersize <= 0 ||                   /* rb must be a multiple of that!    */
+    ks % layersize)
   return false;
 // Okay ... we got 2 possible layouts at the moment: 16x8 and 20x8.
 // So, to get the target columns, we have to divide the layersize through
@@ -845,7 +1079,9 @@ ssize_t sz = (ssize_t)layers * tgtrows * tgtcols;
 if (ks != sz * sizeof(wxUint16))
   return false;
 
-return Import((wxUint8 *)mb.GetData(), mb.GetDataLen(), tgtrows, tgtcols);
+// sizes have been verified above, so no need to pass the buffer size
+return Import((wxUint8 *)layout, -1, tgtrows, tgtcols,
+              macsize ? macbuf : NULL, macsize, transformat);
 }
 
 /*****************************************************************************/
@@ -857,7 +1093,9 @@ bool KbdLayout::WriteFile
     wxString const &filename,
     bool bNative,
     int tgtrows,
-    int tgtcols
+    int tgtcols,
+    bool bSparse,
+    bool bHex
     )
 {
 wxFile f;
@@ -873,24 +1111,36 @@ if (bNative)                            /* write compact binary              */
     return false;
   if (f.Write(mb.GetData(), lbufsz) != (size_t)lbufsz)
     return false;
+  if (macros)                           /* append macro set if there is one  */
+    {
+    wxUint8 mh[4] = { 'M', 'A', 'C', (wxUint8)macros };
+    if (f.Write(mh, sizeof(mh)) != sizeof(mh) ||
+        f.Write(macrodata, macros * LEN_MACRO) != (size_t)(macros * LEN_MACRO))
+      return false;
+    }
   }
 else                                    /* write in Joern's text format      */
   {
   for (int l = 0; l < GetLayers(); l++)
     {
     wxString s;
+    if (bSparse && l > 0)               /* upper layers as sparse overlays   */
+      {
+      KbdOverlayText ot(tgtrows, tgtcols);
+      for (int r = 0; r < tgtrows; r++)
+        for (int c = 0; c < tgtcols; c++)
+          ot.SetKey(r, c, GetKey(l, r, c));
+      s = wxT("+ ") + ot.ToText();
+      }
+    else
     for (int r = 0; r < tgtrows; r++)
       for (int c = 0; c < tgtcols; c++)
         {
         if (s.size())
           s += wxT(", ");
-#if 1
-        // Joern switched from decimal to hexadecimal format in V1.5.
-        // As I don't want to include a special switch here, just go with that.
-        s += wxString::Format("%X", GetKey(l, r, c));
-#else
-        s += wxString::Format("%d", GetKey(l, r, c));
-#endif
+        // Joern switched from decimal to hexadecimal format in V1.5;
+        // decimal is only needed for files used with older firmware.
+        s += wxString::Format(bHex ? "%X" : "%d", GetKey(l, r, c));
         }
     s += (l < GetLayers() - 1) ? wxT("\n\n") : wxT("\n");
     const char *ps = (const char *)s;
@@ -898,6 +1148,14 @@ else                                    /* write in Joern's text format      */
     if (f.Write(ps, ls) != ls)
       return false;
     }
+  if (macros)                           /* append macro set if there is one  */
+    {
+    wxString s = wxT("\nM ") + MacrosToText() + wxT("\n");
+    const char *ps = (const char *)s;
+    size_t ls = s.size();
+    if (f.Write(ps, ls) != ls)
+      return false;
+    }
   }
 
 bool bOK = f.Close();
@@ -906,6 +1164,190 @@ if (bOK)
 return bOK;
 }
 
+// The bulk edits work on the layers' key arrays directly, in one pass
+// over each affected layer.
+
+/*****************************************************************************/
+/* MapKeys : replace a key code by another one                               */
+/*****************************************************************************/
+
+int KbdLayout::MapKeys
+    (
+    wxUint32 layerMask,
+    MatrixKey from,
+    MatrixKey to,
+    KbdLayoutEdit *edit
+    )
+{
+layerMask = ClipLayerMask(layerMask);
+int nKeys = rows * cols, nChanged = 0;
+if (from == to || !nKeys)
+  return 0;
+for (int l = 0; l < layers; l++)
+  {
+  if (!(layerMask & (1 << l)))
+    continue;
+  MatrixKey *keys = &layer[l].GetKeys();
+  for (int i = 0; i < nKeys; i++)
+    if (keys[i] == from)
+      {
+      if (edit)
+        edit->Add(l, i / cols, i % cols, from, to);
+      keys[i] = to;
+      nChanged++;
+      }
+  }
+if (nChanged)
+  SetModified();
+return nChanged;
+}
+
+/*****************************************************************************/
+/* SwapKeys : swap the keys on two matrix positions                          */
+/*****************************************************************************/
+
+int KbdLayout::SwapKeys
+    (
+    wxUint32 layerMask,
+    int row1,
+    int col1,
+    int row2,
+    int col2,
+    KbdLayoutEdit *edit
+    )
+{
+layerMask = ClipLayerMask(layerMask);
+if (row1 < 0 || row1 >= rows || col1 < 0 || col1 >= cols ||
+    row2 < 0 || row2 >= rows || col2 < 0 || col2 >= cols)
+  return 0;
+int pos1 = row1 * cols + col1, pos2 = row2 * cols + col2;
+int nChanged = 0;
+for (int l = 0; l < layers; l++)
+  {
+  if (!(layerMask & (1 << l)))
+    continue;
+  MatrixKey *keys = &layer[l].GetKeys();
+  MatrixKey k1 = keys[pos1], k2 = keys[pos2];
+  if (k1 == k2)
+    continue;
+  if (edit)
+    {
+    edit->Add(l, row1, col1, k1, k2);
+    edit->Add(l, row2, col2, k2, k1);
+    }
+  keys[pos1] = k2;
+  keys[pos2] = k1;
+  nChanged += 2;
+  }
+if (nChanged)
+  SetModified();
+return nChanged;
+}
+
+/*****************************************************************************/
+/* FillKeys : set all keys in a matrix region to a key code                  */
+/*****************************************************************************/
+
+int KbdLayout::FillKeys
+    (
+    wxUint32 layerMask,
+    int row,
+    int col,
+    int nRows,
+    int nCols,
+    MatrixKey value,
+    KbdLayoutEdit *edit
+    )
+{
+layerMask = ClipLayerMask(layerMask);
+if (!ClipRegion(row, col, nRows, nCols))
+  return 0;
+int nChanged = 0;
+for (int l = 0; l < layers; l++)
+  {
+  if (!(layerMask & (1 << l)))
+    continue;
+  MatrixKey *keys = &layer[l].GetKeys();
+  for (int r = row; r < row + nRows; r++)
+    {
+    MatrixKey *k = keys + r * cols;
+    for (int c = col; c < col + nCols; c++)
+      if (k[c] != value)
+        {
+        if (edit)
+          edit->Add(l, r, c, k[c], value);
+        k[c] = value;
+        nChanged++;
+        }
+    }
+  }
+if (nChanged)
+  SetModified();
+return nChanged;
+}
+
+/*****************************************************************************/
+/* CopyKeys : copy a matrix region from one layer to others                  */
+/*****************************************************************************/
+
+int KbdLayout::CopyKeys
+    (
+    int srcLayer,
+    wxUint32 layerMask,
+    int row,
+    int col,
+    int nRows,
+    int nCols,
+    KbdLayoutEdit *edit
+    )
+{
+if (srcLayer < 0 || srcLayer >= layers)
+  return 0;
+layerMask = ClipLayerMask(layerMask) & ~(1 << srcLayer);
+if (!ClipRegion(row, col, nRows, nCols))
+  return 0;
+MatrixKey const *src = &layer[srcLayer].GetKeys();
+int nChanged = 0;
+for (int l = 0; l < layers; l++)
+  {
+  if (!(layerMask & (1 << l)))
+    continue;
+  MatrixKey *keys = &layer[l].GetKeys();
+  for (int r = row; r < row + nRows; r++)
+    {
+    MatrixKey const *s = src + r * cols;
+    MatrixKey *k = keys + r * cols;
+    for (int c = col; c < col + nCols; c++)
+      if (k[c] != s[c])
+        {
+        if (edit)
+          edit->Add(l, r, c, k[c], s[c]);
+        k[c] = s[c];
+        nChanged++;
+        }
+    }
+  }
+if (nChanged)
+  SetModified();
+return nChanged;
+}
+
+/*****************************************************************************/
+/* ApplyEdit : redo or undo a recorded edit                                  */
+/*****************************************************************************/
+
+void KbdLayout::ApplyEdit(KbdLayoutEdit const &edit, bool bUndo)
+{
+size_t n = edit.GetCount();
+for (size_t i = 0; i < n; i++)
+  {
+  // undo goes backwards, in case a position has been changed twice
+  KbdLayoutEdit::Change const &ch = edit.GetChange(bUndo ? n - 1 - i : i);
+  if (ch.layer < layers)
+    SetKey(ch.layer, ch.row, ch.col, bUndo ? ch.oldKey : ch.newKey);
+  }
+}
+
 /*===========================================================================*/
 /* KbdGui class members                                                      */
 /*===========================================================================*/
@@ -1007,12 +1449,15 @@ else
 }
 
 /*****************************************************************************/
-/* GetHID : convert OS-defined Virtual Key into HID                          */
+/* Key translation tables                                                    */
 /*****************************************************************************/
 
-int KbdGui::GetHID(int vkey)
-{
-static int vkhids[][2] =
+// {code, HID} pairs for the various key code spaces.
+// These are expanded into direct-indexed tables once at program start,
+// so a key translation is a simple bounds-checked array access.
+
+// wxWidgets key code -> HID
+static const int vkhids[][2] =
   {
     { WXK_BACK,             KB_BKSPC },
     { WXK_TAB,              KB_TAB },
@@ -1210,62 +1655,9 @@ static int vkhids[][2] =
     { WXK_RMENU,            KB_RALT },
 
   };
-static int vktbl[WXK_NUMCODES] = { -1 };
-if (vktbl[0] == -1)                     /* initialize VKey table only once   */
-  {
-  int i;
-  for (i = 0; i < _countof(vktbl); i++)
-    vktbl[i] = KB_NONE;
-  for (i = 0; i < _countof(vkhids); i++)
-    vktbl[vkhids[i][0]] = vkhids[i][1];
-  }
 
-int hid = vktbl[vkey];
-#if defined(wxHAS_RAW_KEY_CODES) && defined(__WXMSW__)
-switch (hid)
-  {
-  case WXK_SHIFT :
-  case WXK_CONTROL :
-  case WXK_ALT :
-    {
-    bool left = false, right = false;
-    int skcleft, skcright;
-#ifdef __WXMSW__
-    static struct
-      {
-      int vkleft, vkright;
-      int skcleft, skcright;
-      } defs[3] =
-      {
-        { VK_LSHIFT,   VK_RSHIFT,    WXK_LSHIFT,   WXK_RSHIFT },
-        { VK_LCONTROL, VK_RCONTROL,  WXK_LCONTROL, WXK_RCONTROL },
-        { VK_LMENU,    VK_RMENU,     WXK_LMENU,    WXK_RMENU },
-      };
-    int specidx = (hid == WXK_SHIFT) ? 0 :
-                  (hid == WXK_CONTROL) ? 1 :
-                  2;
-    skcleft = defs[specidx].skcleft;
-    skcright = defs[specidx].skcright;
-    left = GetKeyState(defs[specidx].vkleft) < 0;
-    right = GetKeyState(defs[specidx].vkright) < 0;
-#endif
-    if (left ^ right)                   /* if one of them is set,            */
-      hid = left ? skcleft : skcright;  /* use special code instead          */
-    }
-    break;
-  }
-#endif
-
-return hid;
-}
-
-/*****************************************************************************/
-/* GetHIDFromScancode : retrieve HID from scan code (if possible)            */
-/*****************************************************************************/
-
-int KbdGui::GetHIDFromScancode(int scancode)
-{
-static int schids[][2] =
+// (Windows) scan code -> HID
+static const int schids[][2] =
   {
     { 0x000, KB_NONE },
 #if defined(wxHAS_RAW_KEY_CODES) && defined(__WXMSW__)
@@ -1464,21 +1856,299 @@ static int schids[][2] =
 #endif
   };
 
-static int sctbl[512] = { -1 };
-if (sctbl[0] == -1)                     /* initialize scan code table once   */
+// raw (X11 / GTK) key code -> HID
+static const int kchids[][2] =
+  {
+    { 0x000, KB_NONE },
+#if defined(wxHAS_RAW_KEY_CODES) && defined(__WXGTK__)
+    // X11 / GTK hardware key codes; these are the Linux evdev
+    // key codes (see linux/input-event-codes.h) + 8
+    { 0x009, KB_ESC },                  // KEY_ESC
+    { 0x00A, KB_1 },
+    { 0x00B, KB_2 },
+    { 0x00C, KB_3 },
+    { 0x00D, KB_4 },
+    { 0x00E, KB_5 },
+    { 0x00F, KB_6 },
+    { 0x010, KB_7 },
+    { 0x011, KB_8 },
+    { 0x012, KB_9 },
+    { 0x013, KB_0 },
+    { 0x014, KB_MINUS },
+    { 0x015, KB_EQUAL },
+    { 0x016, KB_BKSPC },
+    { 0x017, KB_TAB },
+    { 0x018, KB_Q },
+    { 0x019, KB_W },
+    { 0x01A, KB_E },
+    { 0x01B, KB_R },
+    { 0x01C, KB_T },
+    { 0x01D, KB_Y },
+    { 0x01E, KB_U },
+    { 0x01F, KB_I },
+    { 0x020, KB_O },
+    { 0x021, KB_P },
+    { 0x022, KB_LBRCE },
+    { 0x023, KB_RBRCE },
+    { 0x024, KB_ENTER },
+    { 0x025, KB_LCTRL },
+    { 0x026, KB_A },
+    { 0x027, KB_S },
+    { 0x028, KB_D },
+    { 0x029, KB_F },
+    { 0x02A, KB_G },
+    { 0x02B, KB_H },
+    { 0x02C, KB_J },
+    { 0x02D, KB_K },
+    { 0x02E, KB_L },
+    { 0x02F, KB_SMCLN },
+    { 0x030, KB_QUOTE },
+    { 0x031, KB_TILDE },
+    { 0x032, KB_LSHFT },
+    { 0x033, KB_BSLSH },
+    { 0x034, KB_Z },
+    { 0x035, KB_X },
+    { 0x036, KB_C },
+    { 0x037, KB_V },
+    { 0x038, KB_B },
+    { 0x039, KB_N },
+    { 0x03A, KB_M },
+    { 0x03B, KB_COMMA },
+    { 0x03C, KB_DOT },
+    { 0x03D, KB_SLASH },
+    { 0x03E, KB_RSHFT },
+    { 0x03F, KP_ASTRX },
+    { 0x040, KB_LALT },
+    { 0x041, KB_SPACE },
+    { 0x042, KB_CAPLK },
+    { 0x043, KB_F1 },
+    { 0x044, KB_F2 },
+    { 0x045, KB_F3 },
+    { 0x046, KB_F4 },
+    { 0x047, KB_F5 },
+    { 0x048, KB_F6 },
+    { 0x049, KB_F7 },
+    { 0x04A, KB_F8 },
+    { 0x04B, KB_F9 },
+    { 0x04C, KB_F10 },
+    { 0x04D, KB_NUMLK },
+    { 0x04E, KB_SCRLK },
+    { 0x04F, KP_7 },
+    { 0x050, KP_8 },
+    { 0x051, KP_9 },
+    { 0x052, KP_MINUS },
+    { 0x053, KP_4 },
+    { 0x054, KP_5 },
+    { 0x055, KP_6 },
+    { 0x056, KP_PLUS },
+    { 0x057, KP_1 },
+    { 0x058, KP_2 },
+    { 0x059, KP_3 },
+    { 0x05A, KP_0 },
+    { 0x05B, KP_DOT },
+    { 0x05D, KB_LANG5 },                // KEY_ZENKAKUHANKAKU
+    { 0x05E, KB_PIPE },                 // KEY_102ND
+    { 0x05F, KB_F11 },
+    { 0x060, KB_F12 },
+    { 0x061, KB_INTERNATIONAL1 },       // KEY_RO
+    { 0x062, KB_LANG3 },                // KEY_KATAKANA
+    { 0x063, KB_LANG4 },                // KEY_HIRAGANA
+    { 0x064, KB_INTERNATIONAL4 },       // KEY_HENKAN
+    { 0x065, KB_INTERNATIONAL2 },       // KEY_KATAKANAHIRAGANA
+    { 0x066, KB_INTERNATIONAL5 },       // KEY_MUHENKAN
+    { 0x067, KP_COMMA },                // KEY_KPJPCOMMA
+    { 0x068, KP_ENTER },
+    { 0x069, KB_RCTRL },
+    { 0x06A, KP_SLASH },
+    { 0x06B, KB_PSCRN },                // KEY_SYSRQ
+    { 0x06C, KB_RALT },
+    { 0x06E, KB_HOME },
+    { 0x06F, KB_UP },
+    { 0x070, KB_PGUP },
+    { 0x071, KB_LEFT },
+    { 0x072, KB_RIGHT },
+    { 0x073, KB_END },
+    { 0x074, KB_DOWN },
+    { 0x075, KB_PGDN },
+    { 0x076, KB_INS },
+    { 0x077, KB_DEL },
+    { 0x07C, KB_POWER },
+    { 0x07D, KP_EQUAL },
+    { 0x07F, KB_PAUSE },
+    { 0x081, KP_COMMA },
+    { 0x082, KB_LANG1 },                // KEY_HANGEUL
+    { 0x083, KB_LANG2 },                // KEY_HANJA
+    { 0x084, KB_INTERNATIONAL3 },       // KEY_YEN
+    { 0x085, KB_LGUI },
+    { 0x086, KB_RGUI },
+    { 0x087, KB_APP },                  // KEY_COMPOSE
+    { 0x0BF, KB_F13 },
+    { 0x0C0, KB_F14 },
+    { 0x0C1, KB_F15 },
+    { 0x0C2, KB_F16 },
+    { 0x0C3, KB_F17 },
+    { 0x0C4, KB_F18 },
+    { 0x0C5, KB_F19 },
+    { 0x0C6, KB_F20 },
+    { 0x0C7, KB_F21 },
+    { 0x0C8, KB_F22 },
+    { 0x0C9, KB_F23 },
+    { 0x0CA, KB_F24 },
+#if 1
+// would need an extended HID usage table
+    { 0x079, MEDIA_MUTE },
+    { 0x07A, MEDIA_VOLDOWN },
+    { 0x07B, MEDIA_VOLUP },
+    { 0x094, MEDIA_CALC },
+    { 0x096, MEDIA_BROWSER },           // KEY_WWW
+    { 0x0A3, MEDIA_EMAIL },
+    { 0x0A6, MEDIA_BACK },
+    { 0x0A7, MEDIA_FORWARD },
+    { 0x0AB, MEDIA_NEXT },
+    { 0x0AC, MEDIA_PLAY },              // KEY_PLAYPAUSE
+    { 0x0AD, MEDIA_PREVIOUS },
+    { 0x0AE, MEDIA_STOP },
+    { 0x0B4, MEDIA_HOME },
+    { 0x0B5, MEDIA_REFRESH },
+    { 0x0E1, MEDIA_SEARCH },
+#endif
+#endif
+  };
+
+static int vktbl[WXK_NUMCODES];         /* wxWidgets key code -> HID         */
+static int sctbl[0x400];                /* scan code -> HID                  */
+static int kctbl[0x100];                /* raw key code -> HID               */
+
+static struct KeyTableSetup             /* builds the direct-indexed tables  */
+  {
+  static void Fill(int *tbl, int tblsize, const int (*pairs)[2], int npairs)
+    {
+    int i;
+    for (i = 0; i < tblsize; i++)
+      tbl[i] = KB_NONE;
+    for (i = 0; i < npairs; i++)
+      {
+      wxASSERT(pairs[i][0] >= 0 && pairs[i][0] < tblsize);
+      if (pairs[i][0] >= 0 && pairs[i][0] < tblsize)
+        tbl[pairs[i][0]] = pairs[i][1];
+      }
+    }
+#ifdef _DEBUG
+  // the linear search through the pairs that the tables replace; if a
+  // code is defined more than once, the last definition is used
+  static int FindPair(const int (*pairs)[2], int npairs, int code)
+    {
+    int hid = KB_NONE;
+    for (int i = 0; i < npairs; i++)
+      if (pairs[i][0] == code)
+        hid = pairs[i][1];
+    return hid;
+    }
+  // make sure that a table gives the same result for every possible code
+  static void Verify(const int *tbl, int tblsize,
+                     const int (*pairs)[2], int npairs)
+    {
+    for (int code = 0; code < tblsize; code++)
+      wxASSERT_MSG(tbl[code] == FindPair(pairs, npairs, code),
+                   wxString::Format(wxT("key table mismatch for code 0x%X"),
+                                    code));
+    }
+#endif
+  KeyTableSetup()
+    {
+    Fill(vktbl, _countof(vktbl), vkhids, _countof(vkhids));
+    Fill(sctbl, _countof(sctbl), schids, _countof(schids));
+    Fill(kctbl, _countof(kctbl), kchids, _countof(kchids));
+#ifdef _DEBUG
+    Verify(vktbl, _countof(vktbl), vkhids, _countof(vkhids));
+    Verify(sctbl, _countof(sctbl), schids, _countof(schids));
+    Verify(kctbl, _countof(kctbl), kchids, _countof(kchids));
+#endif
+    }
+  } keyTableSetup;
+
+/*****************************************************************************/
+/* GetHID : convert OS-defined Virtual Key into HID                          */
+/*****************************************************************************/
+
+int KbdGui::GetHID(int vkey)
+{
+int hid = (vkey >= 0 && vkey < _countof(vktbl)) ? vktbl[vkey] : KB_NONE;
+#if defined(wxHAS_RAW_KEY_CODES) && defined(__WXMSW__)
+switch (hid)
   {
-  int i;
-  for (i = 0; i < _countof(sctbl); i++)
-    sctbl[i] = KB_NONE;
-  for (i = 0; i < _countof(schids); i++)
+  case WXK_SHIFT :
+  case WXK_CONTROL :
+  case WXK_ALT :
     {
-    if (schids[i][0] < _countof(sctbl))
-      sctbl[schids[i][0]] = schids[i][1];
+    bool left = false, right = false;
+    int skcleft, skcright;
+#ifdef __WXMSW__
+    static struct
+      {
+      int vkleft, vkright;
+      int skcleft, skcright;
+      } defs[3] =
+      {
+        { VK_LSHIFT,   VK_RSHIFT,    WXK_LSHIFT,   WXK_RSHIFT },
+        { VK_LCONTROL, VK_RCONTROL,  WXK_LCONTROL, WXK_RCONTROL },
+        { VK_LMENU,    VK_RMENU,     WXK_LMENU,    WXK_RMENU },
+      };
+    int specidx = (hid == WXK_SHIFT) ? 0 :
+                  (hid == WXK_CONTROL) ? 1 :
+                  2;
+    skcleft = defs[specidx].skcleft;
+    skcright = defs[specidx].skcright;
+    left = GetKeyState(defs[specidx].vkleft) < 0;
+    right = GetKeyState(defs[specidx].vkright) < 0;
+#endif
+    if (left ^ right)                   /* if one of them is set,            */
+      hid = left ? skcleft : skcright;  /* use special code instead          */
     }
+    break;
   }
+#endif
+
+return hid;
+}
+
+/*****************************************************************************/
+/* GetHID : convert key event into HID                                       */
+/*****************************************************************************/
+
+int KbdGui::GetHID(wxKeyEvent &ev)
+{
+int hid = KB_NONE;
+#if defined(wxHAS_RAW_KEY_CODES) && defined(__WXGTK__)
+// on GTK, the raw key flags contain the hardware key code, which allows
+// to distinguish left/right modifiers and keypad keys
+hid = GetHIDFromKeycode((int)ev.GetRawKeyFlags());
+#endif
+if (hid == KB_NONE)
+  hid = GetHID(ev.GetKeyCode());
+return hid;
+}
+
+/*****************************************************************************/
+/* GetHIDFromScancode : retrieve HID from scan code (if possible)            */
+/*****************************************************************************/
+
+int KbdGui::GetHIDFromScancode(int scancode)
+{
+if (scancode < 0 || scancode >= _countof(sctbl))
+  return KB_NONE;
+return sctbl[scancode];
+}
+
+/*****************************************************************************/
+/* GetHIDFromKeycode : retrieve HID from raw key code (if possible)          */
+/*****************************************************************************/
 
-int kc = sctbl[scancode];
-return kc;
+int KbdGui::GetHIDFromKeycode(int keycode)
+{
+if (keycode < 0 || keycode >= _countof(kctbl))
+  return KB_NONE;
+return kctbl[keycode];
 }
 
 /******************************************************************************
@@ -1559,17 +2229,128 @@ for (size_t i = 0; i < s.size(); i++)
 return o;
 }
 
-static wxString UnescToken(wxString const &s)
+/*****************************************************************************/
+/* TextToken : a token in the GUI layout file                                */
+/*****************************************************************************/
+
+// The layout file is parsed from one buffer; tokens are just [p, e) ranges
+// in there, so splitting a line into tokens doesn't allocate anything.
+
+struct TextToken
+  {
+  const wxChar *p, *e;                  /* token start / end                 */
+
+  size_t size() const { return e - p; }
+  bool empty() const { return p == e; }
+  TextToken Mid(size_t pos, size_t n = (size_t)-1) const
+    {
+    TextToken t = { p + pos, (n < size() - pos) ? p + pos + n : e };
+    return t;
+    }
+  };
+
+static inline bool IsBlankChar(wxChar c)
 {
-wxString o;
+return c == wxT(' ') || (c >= wxT('\t') && c <= wxT('\r'));
+}
 
-for (size_t i = 0; i < s.size(); i++)
+/*****************************************************************************/
+/* MakeToken : create a token from a range, removing surrounding blanks      */
+/*****************************************************************************/
+
+static TextToken MakeToken(const wxChar *p, const wxChar *e)
+{
+while (p < e && IsBlankChar(*p))
+  p++;
+while (e > p && IsBlankChar(e[-1]))
+  e--;
+TextToken t = { p, e };
+return t;
+}
+
+/*****************************************************************************/
+/* IsAbbrevOf : case-insensitive check whether a token abbreviates a word    */
+/*****************************************************************************/
+
+static bool IsAbbrevOf(TextToken const &t, const wxChar *word)
+{
+const wxChar *p = t.p;
+for (; p < t.e && *word; p++, word++)
+  if (wxTolower(*p) != wxTolower(*word))
+    return false;
+return p == t.e;
+}
+
+/*****************************************************************************/
+/* StripHexPrefix : remove a leading "0x" and return the number base         */
+/*****************************************************************************/
+
+static int StripHexPrefix(TextToken &t)
+{
+if (t.size() >= 2 && t.p[0] == wxT('0') && t.p[1] == wxT('x'))
   {
-  wxChar c = s[i];
+  t.p += 2;
+  return 16;
+  }
+return 10;
+}
+
+/*****************************************************************************/
+/* TokenToLong : convert a token to a number                                 */
+/*****************************************************************************/
+
+static bool TokenToLong(TextToken const &t, long *val, int base = 10)
+{
+// short [-]digits sequences can't overflow and are converted directly;
+// anything else is left to wxString, so the result is the same
+const wxChar *p = t.p;
+bool neg = (p < t.e && *p == wxT('-'));
+if (neg)
+  p++;
+if (p < t.e && t.e - p <= ((base == 16) ? 7 : 9))
+  {
+  int valid = (base == 16) ? (ccDigit | ccHex) : ccDigit;
+  long l = 0;
+  for (; p < t.e; p++)
+    {
+    wxUint32 c = (wxUint32)*p;
+    if (c > 0xff || !(charClass[c] & valid))
+      break;
+    l = l * base + charValue[c];
+    }
+  if (p == t.e)
+    {
+    *val = neg ? -l : l;
+    return true;
+    }
+  }
+return wxString(t.p, t.size()).ToCLong(val, base);
+}
+
+/*****************************************************************************/
+/* TokenToDouble : convert a token to a floating-point number                */
+/*****************************************************************************/
+
+static bool TokenToDouble(TextToken const &t, double *val)
+{
+return wxString(t.p, t.size()).ToCDouble(val);
+}
+
+/*****************************************************************************/
+/* UnescToken : remove escape sequences from a text token                    */
+/*****************************************************************************/
+
+static void UnescToken(TextToken const &s, wxString &o)
+{
+o.clear();
+o.reserve(s.size());
+for (const wxChar *p = s.p; p < s.e; p++)
+  {
+  wxChar c = *p;
   if (c == wxT('\\') &&
-      i != s.size() - 1)
+      p != s.e - 1)
     {
-    char c2 = s[++i];
+    char c2 = *++p;
     switch (c2)
       {
       case wxT('n') :
@@ -1588,25 +2369,37 @@ for (size_t i = 0; i < s.size(); i++)
     }
   o += c;
   }
-
-return o;
 }
 
+/*****************************************************************************/
+/* TokenizeText : split a line into tokens                                   */
+/*****************************************************************************/
+
+// The uncommented line contents are copied to out, which is advanced
+// behind them; the tokens and the uncommented line point into there.
+// Only the first maxTokens tokens are returned, but all are counted.
+
 static bool TokenizeText
     (
-    wxString &s,
-    wxArrayString &sa,
+    TextToken const &s,                 /* line to tokenize (trimmed)        */
+    wxChar *&out,                       /* output buffer position            */
+    TextToken *sa,                      /* returned tokens                   */
+    int maxTokens,
+    int &nTokens,                       /* returned token count              */
+    TextToken &sUncommented,            /* returned uncommented line         */
     bool &inBlockComment
     )
 {
-wxString sUncommented, sCur;
+wxChar *lineStart = out, *tokenStart = out;
+size_t len = s.size();
 bool inText = false;
 
+nTokens = 0;
 // walk through line, splitting at , (unless in ""s),
 // terminate at end or # or // (unless in ""s)
-for (size_t i = 0; i < s.size(); i++)
+for (size_t i = 0; i < len; i++)
   {
-  wxChar c = s[i];
+  wxChar c = s.p[i];
   switch (c)
     {
     case wxT(',') :
@@ -1614,104 +2407,142 @@ for (size_t i = 0; i < s.size(); i++)
         {
         if (!inText)
           {
-          sCur.Trim(false); sCur.Trim(true);
-          sa.push_back(sCur);
-          sCur.clear();
+          if (nTokens < maxTokens)
+            sa[nTokens] = MakeToken(tokenStart, out);
+          nTokens++;
+          tokenStart = out + 1;
           }
-        else
-          sCur += c;
-        sUncommented += c;
+        *out++ = c;
         }
       break;
     case wxT('#') :
       if (!inBlockComment)
         {
         if (!inText)
-          i = s.size();
+          i = len;
         else
-          {
-          sCur += c;
-          sUncommented += c;
-          }
+          *out++ = c;
         }
       break;
     case wxT('/') :
-      if (!inBlockComment && !inText && i < s.size() - 1 && s[i + 1] == wxT('/'))
-        i = s.size();
-      else if (!inText && i < s.size() - 1 && s[i + 1] == wxT('*'))
+      if (!inBlockComment && !inText && i < len - 1 && s.p[i + 1] == wxT('/'))
+        i = len;
+      else if (!inText && i < len - 1 && s.p[i + 1] == wxT('*'))
         inBlockComment = true;
       else if (!inBlockComment)
-        {
-        sCur += c;
-        sUncommented += c;
-        }
+        *out++ = c;
       break;
     case wxT('*') :
-      if (!inText && inBlockComment && i < s.size() - 1 && s[i + 1] == wxT('/'))
+      if (!inText && inBlockComment && i < len - 1 && s.p[i + 1] == wxT('/'))
         {
         i++;
         inBlockComment = false;
         }
       else if (!inBlockComment)
-        {
-        sCur += c;
-        sUncommented += c;
-        }
+        *out++ = c;
       break;
     case wxT('\\') :
       if (!inBlockComment)
         {
         // \ followed by anything is copied 1:1
-        if (i < s.size() - 1)
+        if (i < len - 1)
           {
-          sCur += c;
-          sUncommented += c;
-          c = s[++i];
+          *out++ = c;
+          c = s.p[++i];
           }
-        sCur += c;
-        sUncommented += c;
+        *out++ = c;
         }
       break;
     case wxT('\"') :
       if (!inBlockComment)
         {
         inText = !inText;
-        sCur += c;
-        sUncommented += c;
+        *out++ = c;
         }
       break;
     default :
       if (!inBlockComment)
-        {
-        sCur += c;
-        sUncommented += c;
-        }
+        *out++ = c;
       break;
     }
   }
 // last token
-sCur.Trim(false); sCur.Trim(true);
-sa.push_back(sCur);
-sUncommented.Trim(false);sUncommented.Trim(true);
-s = sUncommented;
+if (nTokens < maxTokens)
+  sa[nTokens] = MakeToken(tokenStart, out);
+nTokens++;
+sUncommented = MakeToken(lineStart, out);
 
 return !inText;
 }
 
 /*****************************************************************************/
-/* ReadLayoutFile : read keyboard GUI layout file                            */
+/* ReadFileData : read a complete file into a memory buffer                  */
 /*****************************************************************************/
 
-bool KbdGui::ReadLayoutFile(wxString const &filename, wxString *error)
+static bool ReadFileData(wxString const &filename, wxMemoryBuffer &mb)
 {
-wxTextFile f;
+wxFile f;
 if (!f.Open(filename))
+  return false;
+wxFileOffset flen = f.Length();
+if (flen < 0 || flen > 0x1000000)       /* 16MB should be plenty             */
+  return false;
+mb.SetBufSize((size_t)flen + 1);
+if (flen && f.Read(mb.GetData(), (size_t)flen) != (ssize_t)flen)
+  return false;
+mb.SetDataLen((size_t)flen);
+return true;
+}
+
+/*****************************************************************************/
+/* HashData : calculate FNV-1a hash over a memory area                       */
+/*****************************************************************************/
+
+static wxUint32 HashData(const void *data, size_t len)
+{
+const wxUint8 *p = (const wxUint8 *)data;
+wxUint32 hash = 2166136261U;
+for (size_t i = 0; i < len; i++)
+  hash = (hash ^ p[i]) * 16777619U;
+return hash;
+}
+
+/*****************************************************************************/
+/* ReadLayoutFile : read keyboard GUI layout file                            */
+/*****************************************************************************/
+
+bool KbdGui::ReadLayoutFile
+    (
+    wxString const &filename,
+    wxString *error,
+    wxString const &cachefile
+    )
+{
+wxMemoryBuffer mbFile;                  /* read the file in one go           */
+if (!ReadFileData(filename, mbFile))
+  {
+  if (error)
+    *error = wxT("Error opening ") + filename;
+  return false;
+  }
+wxUint32 srcSize = (wxUint32)mbFile.GetDataLen();
+if (cachefile.size() &&                 /* compiled version up to date?      */
+    ReadCacheFile(cachefile, filename, mbFile))
+  return true;
+
+wxString text((const char *)mbFile.GetData(), wxConvAuto(), srcSize);
+if (srcSize && text.empty())            /* not convertible to wxString       */
   {
   if (error)
     *error = wxT("Error opening ") + filename;
   return false;
   }
 
+// the uncommented lines are collected in a buffer that can't be larger
+// than the file, so the tokens remain valid until the file is parsed
+wxMemoryBuffer mbLines((text.size() + 1) * sizeof(wxChar));
+wxChar *out = (wxChar *)mbLines.GetData();
+
 wxString lname;                         /* layout name                       */
 bool gotname = false;
 bool inBlockComment = false;
@@ -1720,44 +2551,53 @@ wxVector<GuiKey> fileKeys;
 size_t i;
 
 int line = 0;                           /* loop through the file contents    */
-wxString sCurLine;
-for (wxString s = f.GetFirstLine(); !f.Eof(); s = f.GetNextLine())
+const wxChar *p = (const wxChar *)text.c_str();
+const wxChar *end = p + text.size();
+TextToken sCurLine = { p, p };
+while (p < end)
   {
   line++;
-  sCurLine = s;
-
-  s.Trim(false); s.Trim(true);
-  if (s.IsEmpty())
+  sCurLine.p = sCurLine.e = p;          /* lines end in \n, \r\n, or \r      */
+  while (sCurLine.e < end && *sCurLine.e != wxT('\n') && *sCurLine.e != wxT('\r'))
+    sCurLine.e++;
+  p = sCurLine.e;
+  if (p < end && *p++ == wxT('\r') && p < end && *p == wxT('\n'))
+    p++;
+
+  TextToken sLine = MakeToken(sCurLine.p, sCurLine.e);
+  if (sLine.empty())
     continue;
 
                                         /* the others are key definitions    */
   GuiKey key = { 0, 0, -1, -1, -1, 1.f, 1.f, "", "" };
-  wxArrayString sa;
-  if (!TokenizeText(s, sa, inBlockComment))
+  TextToken sa[6];                      /* only the first 6 are used         */
+  int nTokens;
+  TextToken s;                          /* uncommented line contents         */
+  if (!TokenizeText(sLine, out, sa, _countof(sa), nTokens, s, inBlockComment))
     break;                              /* stop at badly formatted lines     */
 
   if (!gotname && s.size())             /* first line is the layout name.    */
     {
-    lname = s;
+    lname = wxString(s.p, s.size());
     gotname = true;
     continue;
     }
 
-  if (s.IsEmpty())                      /* ignore empty content              */
+  if (s.empty())                        /* ignore empty content              */
     continue;
 
-  if (sa.size() < 2)                    /* at least row, matrix, text must be*/
+  if (nTokens < 2)                      /* at least row, matrix, text must be*/
     break;
 
   // parse Row: rA[-B]
-  wxString row(sa[0]);
-  if (row.size() < 2 || (row[0] != wxT('R') && row[0] != wxT('r')))
+  TextToken row(sa[0]);
+  if (row.size() < 2 || (row.p[0] != wxT('R') && row.p[0] != wxT('r')))
     break;
-  row = row.substr(1);
+  row = row.Mid(1);
   int delimpos = -1, delim2pos = -1;
   for (i = 0; i < row.size(); i++)
     {
-    wxChar c = row[i];
+    wxChar c = row.p[i];
     if (c == wxT('-'))
       {
       if (delimpos >= 0)
@@ -1772,10 +2612,10 @@ for (wxString s = f.GetFirstLine(); !f.Eof(); s = f.GetNextLine())
   long l;
   if (delimpos >= 0)
     {
-    if (delimpos < 1 || !row.substr(0, delimpos).ToCLong(&l))
+    if (delimpos < 1 || !TokenToLong(row.Mid(0, delimpos), &l))
       break;
     key.row = l;
-    if (!row.substr(delimpos + 1).ToCLong(&l))
+    if (!TokenToLong(row.Mid(delimpos + 1), &l))
       break;
     if (l < key.row ||
         l > key.row + 1)
@@ -1784,21 +2624,21 @@ for (wxString s = f.GetFirstLine(); !f.Eof(); s = f.GetNextLine())
     }
   else
     {
-    if (!row.ToCLong(&l))
+    if (!TokenToLong(row, &l))
       break;
     key.row = l;
     key.height = 1;
     }
 
   // parse [hidcode]@[matrixpos A/B]
-  wxString mtx(sa[1]);
-  if (mtx.CmpNoCase(wxT("bl")))
+  TextToken mtx(sa[1]);
+  if (mtx.size() != 2 || !IsAbbrevOf(mtx, wxT("bl")))
     {
     delimpos = -1;
     delim2pos = -1;
     for (i = 0; i < mtx.size(); i++)
       {
-      wxChar c = mtx[i];
+      wxChar c = mtx.p[i];
       if (c == wxT('@'))
         {
         if (delimpos >= 0)
@@ -1826,27 +2666,22 @@ for (wxString s = f.GetFirstLine(); !f.Eof(); s = f.GetNextLine())
       break;
     if (delimpos == 0 && mtx.size() == 1)  // only @ is not allowed
       break;
-    wxString scan;
+    TextToken scan = { mtx.p, mtx.p };
     if (delimpos < 0 && delim2pos < 0)  // no delimiter - only scan code
       {
       scan = mtx;
-      mtx.clear();
+      mtx.p = mtx.e;
       }
     else if (delimpos >= 0)
       {
-      scan = mtx.substr(0, delimpos);
-      mtx = mtx.substr(delimpos + 1);
+      scan = mtx.Mid(0, delimpos);
+      mtx = mtx.Mid(delimpos + 1);
       delim2pos -= delimpos + 1;
       }
     if (scan.size())
       {
-      int base = 10;
-      if (scan.substr(0, 2) == wxT("0x"))
-        {
-        base = 16;
-        scan = scan.substr(2);
-        }
-      if (!scan.ToCLong(&l, base) || l < -1 || l > 0xffff)
+      int base = StripHexPrefix(scan);
+      if (!TokenToLong(scan, &l, base) || l < -1 || l > 0xffff)
         break;
       key.hidcode = l;
       }
@@ -1854,24 +2689,14 @@ for (wxString s = f.GetFirstLine(); !f.Eof(); s = f.GetNextLine())
       {
       if (delim2pos < 0)
         break;
-      wxString row = mtx.substr(0, delim2pos);
-      int base = 10;
-      if (row.substr(0, 2) == wxT("0x"))
-        {
-        base = 16;
-        row = row.substr(2);
-        }
-      if (!row.ToCLong(&l, base))
+      TextToken row = mtx.Mid(0, delim2pos);
+      int base = StripHexPrefix(row);
+      if (!TokenToLong(row, &l, base))
         break;
       key.matrixrow = l;
-      wxString col = mtx.substr(delim2pos + 1);
-      base = 10;
-      if (col.substr(0, 2) == wxT("0x"))
-        {
-        base = 16;
-        col = col.substr(2);
-        }
-      if (!col.ToCLong(&l, base))
+      TextToken col = mtx.Mid(delim2pos + 1);
+      base = StripHexPrefix(col);
+      if (!TokenToLong(col, &l, base))
         break;
       key.matrixcol = l;
       if (key.matrixrow < -1 || key.matrixrow >= MAXROWS ||
@@ -1880,36 +2705,36 @@ for (wxString s = f.GetFirstLine(); !f.Eof(); s = f.GetNextLine())
       }
     }
 
-  wxString text;
-  if (sa.size() > 2)                    /* if there's a 3rd parameter,       */
+  TextToken text;
+  if (nTokens > 2)                      /* if there's a 3rd parameter,       */
     {                                   /* it must be text                   */
     text = sa[2];
     if (text.size() < 2 ||
-        text.Left(1) != wxT("\"") ||
-        text.Right(1) != wxT("\""))
+        text.p[0] != wxT('\"') ||
+        text.e[-1] != wxT('\"'))
       break;
-    key.label[0] = UnescToken(text.substr(1, text.size() - 2));
+    UnescToken(text.Mid(1, text.size() - 2), key.label[0]);
     key.label[0].Trim();
     }
 
-  if (sa.size() > 3)                    /* if there's a 4th parameter,       */
+  if (nTokens > 3)                      /* if there's a 4th parameter,       */
     {                                   /* it must be text2                  */
     text = sa[3];
     if (text.size() < 2 ||
-        text.Left(1) != wxT("\"") ||
-        text.Right(1) != wxT("\""))
+        text.p[0] != wxT('\"') ||
+        text.e[-1] != wxT('\"'))
       break;
-    key.label[1] = UnescToken(text.substr(1, text.size() - 2));
+    UnescToken(text.Mid(1, text.size() - 2), key.label[1]);
     key.label[1].Trim();
     }
 
-  if (sa.size() > 4)                    /* if there's a 5th parameter,       */
+  if (nTokens > 4)                      /* if there's a 5th parameter,       */
     {                                   /* it must be width[xheight][-width2]*/
-    wxString width(sa[4]), height, width2;
+    TextToken width(sa[4]), height, width2;
     int delimpos = -1, delim2pos = -1;
     for (i = 0; i < width.size(); i++)
       {
-      wxChar c = width[i];
+      wxChar c = width.p[i];
       if (c == wxT('-'))
         {
         if (delimpos >= 0)
@@ -1939,21 +2764,21 @@ for (wxString s = f.GetFirstLine(); !f.Eof(); s = f.GetNextLine())
     double d;
     if (delimpos > 0)
       {
-      width2 = width.substr(delimpos + 1);
-      if (!width2.ToCDouble(&d))
+      width2 = width.Mid(delimpos + 1);
+      if (!TokenToDouble(width2, &d))
         break;
       key.width2 = (float)d;
-      width = width.substr(0, delimpos);
+      width = width.Mid(0, delimpos);
       }
     if (delim2pos > 0)
       {
-      height = width.substr(delim2pos + 1);
-      if (!height.ToCDouble(&d))
+      height = width.Mid(delim2pos + 1);
+      if (!TokenToDouble(height, &d))
         break;
       key.height = (float)d;
-      width = width.substr(0, delim2pos);
+      width = width.Mid(0, delim2pos);
       }
-    if (!width.ToCDouble(&d))
+    if (!TokenToDouble(width, &d))
       break;
     key.width1 = (float)d;
     if (key.height <= 1)
@@ -1971,16 +2796,15 @@ for (wxString s = f.GetFirstLine(); !f.Eof(); s = f.GetNextLine())
       break;
     }
 
-  if (sa.size() > 5)                    /* if there's a 6th parameter,       */
+  if (nTokens > 5)                      /* if there's a 6th parameter,       */
     {                                   /* it must be alignment              */
     text = sa[5];
     if (text.size() < 1)
       break;
     float dir = 1.0;
-    wxString top(wxT("Top")), bottom(wxT("Bottom"));
-    if (!text.CmpNoCase(top.substr(0, text.size())))
+    if (IsAbbrevOf(text, wxT("Top")))
       dir = 1.f;
-    else if (!text.CmpNoCase(bottom.substr(0, text.size())))
+    else if (IsAbbrevOf(text, wxT("Bottom")))
       dir = -1.f;
     else
       break;
@@ -1990,15 +2814,17 @@ for (wxString s = f.GetFirstLine(); !f.Eof(); s = f.GetNextLine())
     }
 
   // whew. line parsed. now sort it into the file representation...
-  for (i = 0; i < fileKeys.size(); i++)
-    if (fileKeys[i].row > key.row)
+  // keys are normally given row by row, so look from the end
+  for (i = fileKeys.size(); i > 0; i--)
+    if (fileKeys[i - 1].row <= key.row)
       break;
   fileKeys.insert(fileKeys.begin() + i, key);
   }
-if (line != f.GetLineCount())
+if (p < end)                            /* stopped before the last line?     */
   {
   if (error)
-    *error = wxString::Format(wxT("Syntax error in line %d: "), line) + sCurLine;
+    *error = wxString::Format(wxT("Syntax error in line %d: "), line) +
+             wxString(sCurLine.p, sCurLine.size());
   return false;
   }
 // there must be at least one text and one key.
@@ -2012,6 +2838,8 @@ if (lname.empty() || !fileKeys.size())
 layoutName = lname;
 keys.assign(fileKeys.begin(), fileKeys.end());
 CalcLayout();
+if (cachefile.size())                   /* remember the compiled version     */
+  WriteCacheFile(cachefile, filename, mbFile);
 return true;
 }
 
@@ -2130,6 +2958,274 @@ f.AddLine(wxString::Format(wxT("# Total size: %.2f x %.2f units"), unitsH, units
 return f.Write(wxTextFileType_Unix);
 }
 
+/*****************************************************************************/
+/* Compiled GUI layout cache                                                 */
+/*****************************************************************************/
+
+/*
+A compiled layout holds the keys including the positions calculated by
+CalcLayout(), so it can be used without parsing anything. It's used for
+the layout cache files (.kbc) and embedded in profiles. It consists of
+- a KbcHeader
+- nKeys KbcKey entries
+- a string table containing the layout name and key labels in UTF-8
+All entries are 32-bit little-endian values (floats as their IEEE 754 bit
+pattern), so the files can be moved between machines; the byte order
+field catches files that were written in another byte order.
+A cache file is only valid if the source file's modification time, size
+and FNV-1a hash are the same as when it was written; these are 0 if the
+compiled layout doesn't come from a file. The hash is only calculated if
+the modification time and size match.
+*/
+
+#define KBC_MAGIC      "KBC1"
+#define KBC_BYTEORDER  0x01020304
+
+struct KbcHeader                        /* all values little-endian          */
+  {
+  char magic[4];                        /* KBC_MAGIC                         */
+  wxUint32 byteOrder;                   /* KBC_BYTEORDER                     */
+  wxUint32 srcTime[2];                  /* source modification time lo/hi    */
+  wxUint32 srcSize;                     /* source file size                  */
+  wxUint32 srcHash;                     /* source file hash                  */
+  wxUint32 nKeys;                       /* number of keys                    */
+  wxUint32 strSize;                     /* size of string table              */
+  wxUint32 nameOfs, nameLen;            /* layout name in string table       */
+  wxUint32 unitsV, unitsH;              /* float                             */
+  wxUint32 nMaxRow, nMaxCol;            /* int                               */
+  };
+
+struct KbcKey                           /* all values little-endian          */
+  {
+  wxUint32 row;                         /* int                               */
+  wxUint32 height;                      /* float                             */
+  wxUint32 hidcode;                     /* int                               */
+  wxUint32 matrixrow, matrixcol;        /* int                               */
+  wxUint32 width1, width2;              /* float                             */
+  wxUint32 startx1, starty1;            /* float                             */
+  wxUint32 startx2, starty2;            /* float                             */
+  wxUint32 labelOfs[2], labelLen[2];    /* labels in string table            */
+  };
+
+/*****************************************************************************/
+/* Little-endian value conversion                                            */
+/*****************************************************************************/
+
+static inline wxUint32 ToLE(wxUint32 v)
+{
+return wxUINT32_SWAP_ON_BE(v);
+}
+
+static inline wxUint32 FromLE(wxUint32 v)
+{
+return wxUINT32_SWAP_ON_BE(v);
+}
+
+static inline wxUint32 FloatToLE(float f)
+{
+wxUint32 v;
+memcpy(&v, &f, sizeof(v));
+return wxUINT32_SWAP_ON_BE(v);
+}
+
+static inline float FloatFromLE(wxUint32 v)
+{
+float f;
+v = wxUINT32_SWAP_ON_BE(v);
+memcpy(&f, &v, sizeof(f));
+return f;
+}
+
+/*****************************************************************************/
+/* GetTimeStamp : get a file's modification time as 2 LE 32-bit values      */
+/*****************************************************************************/
+
+static void GetTimeStamp(wxString const &filename, wxUint32 *stamp)
+{
+wxUint64 t = (wxUint64)wxFileModificationTime(filename);
+stamp[0] = ToLE((wxUint32)t);
+stamp[1] = ToLE((wxUint32)(t >> 32));
+}
+
+/*****************************************************************************/
+/* AddCacheString : add a string to the cache's string table                 */
+/*****************************************************************************/
+
+static void AddCacheString
+    (
+    wxMemoryBuffer &mb,
+    wxString const &s,
+    wxUint32 &ofs,
+    wxUint32 &len
+    )
+{
+wxScopedCharBuffer utf8(s.utf8_str());
+ofs = ToLE((wxUint32)mb.GetDataLen());
+len = ToLE((wxUint32)utf8.length());
+mb.AppendData(utf8.data(), utf8.length());
+}
+
+/*****************************************************************************/
+/* SetCompiled : set up from a compiled GUI layout                           */
+/*****************************************************************************/
+
+bool KbdGui::SetCompiled(const void *data, size_t len)
+{
+// the data are used in place; the entries are at fixed offsets
+const KbcHeader *hdr = (const KbcHeader *)data;
+if (len < sizeof(KbcHeader) ||
+    memcmp(hdr->magic, KBC_MAGIC, sizeof(hdr->magic)) ||
+    FromLE(hdr->byteOrder) != KBC_BYTEORDER)
+  return false;
+wxUint32 nKeys = FromLE(hdr->nKeys);
+wxUint32 strSize = FromLE(hdr->strSize);
+wxUint32 nameOfs = FromLE(hdr->nameOfs), nameLen = FromLE(hdr->nameLen);
+if (!nKeys ||
+    nKeys > (len - sizeof(KbcHeader)) / sizeof(KbcKey) ||
+    sizeof(KbcHeader) + nKeys * sizeof(KbcKey) + strSize != len ||
+    nameOfs > strSize ||
+    nameLen > strSize - nameOfs)
+  return false;
+const KbcKey *ck = (const KbcKey *)(hdr + 1);
+const char *strings = (const char *)(ck + nKeys);
+
+wxVector<GuiKey> compiledKeys;
+compiledKeys.reserve(nKeys);
+for (wxUint32 i = 0; i < nKeys; i++, ck++)
+  {
+  GuiKey key;
+  key.row = (wxInt32)FromLE(ck->row);
+  key.height = FloatFromLE(ck->height);
+  key.hidcode = (wxInt32)FromLE(ck->hidcode);
+  key.matrixrow = (wxInt32)FromLE(ck->matrixrow);
+  key.matrixcol = (wxInt32)FromLE(ck->matrixcol);
+  key.width1 = FloatFromLE(ck->width1);
+  key.width2 = FloatFromLE(ck->width2);
+  key.startx1 = FloatFromLE(ck->startx1);
+  key.starty1 = FloatFromLE(ck->starty1);
+  key.startx2 = FloatFromLE(ck->startx2);
+  key.starty2 = FloatFromLE(ck->starty2);
+  for (int j = 0; j < 2; j++)
+    {
+    wxUint32 ofs = FromLE(ck->labelOfs[j]), n = FromLE(ck->labelLen[j]);
+    if (ofs > strSize || n > strSize - ofs)
+      return false;
+    key.label[j] = wxString::FromUTF8(strings + ofs, n);
+    }
+  compiledKeys.push_back(key);
+  }
+
+layoutName = wxString::FromUTF8(strings + nameOfs, nameLen);
+keys.assign(compiledKeys.begin(), compiledKeys.end());
+unitsV = FloatFromLE(hdr->unitsV);
+unitsH = FloatFromLE(hdr->unitsH);
+nMaxRow = (wxInt32)FromLE(hdr->nMaxRow);
+nMaxCol = (wxInt32)FromLE(hdr->nMaxCol);
+return true;
+}
+
+/*****************************************************************************/
+/* GetCompiled : get compiled GUI layout                                     */
+/*****************************************************************************/
+
+void KbdGui::GetCompiled(wxMemoryBuffer &mb) const
+{
+KbcHeader hdr;
+memset(&hdr, 0, sizeof(hdr));           /* no source file by default         */
+memcpy(hdr.magic, KBC_MAGIC, sizeof(hdr.magic));
+hdr.byteOrder = ToLE(KBC_BYTEORDER);
+hdr.nKeys = ToLE((wxUint32)keys.size());
+hdr.unitsV = FloatToLE(unitsV);
+hdr.unitsH = FloatToLE(unitsH);
+hdr.nMaxRow = ToLE((wxUint32)nMaxRow);
+hdr.nMaxCol = ToLE((wxUint32)nMaxCol);
+
+wxMemoryBuffer mbStrings;
+AddCacheString(mbStrings, layoutName, hdr.nameOfs, hdr.nameLen);
+mb.Clear();
+mb.SetBufSize(sizeof(hdr) + keys.size() * sizeof(KbcKey));
+mb.AppendData(&hdr, sizeof(hdr));       /* string table size is set below    */
+for (size_t i = 0; i < keys.size(); i++)
+  {
+  KbcKey ck;
+  ck.row = ToLE((wxUint32)keys[i].row);
+  ck.height = FloatToLE(keys[i].height);
+  ck.hidcode = ToLE((wxUint32)keys[i].hidcode);
+  ck.matrixrow = ToLE((wxUint32)keys[i].matrixrow);
+  ck.matrixcol = ToLE((wxUint32)keys[i].matrixcol);
+  ck.width1 = FloatToLE(keys[i].width1);
+  ck.width2 = FloatToLE(keys[i].width2);
+  ck.startx1 = FloatToLE(keys[i].startx1);
+  ck.starty1 = FloatToLE(keys[i].starty1);
+  ck.startx2 = FloatToLE(keys[i].startx2);
+  ck.starty2 = FloatToLE(keys[i].starty2);
+  for (int j = 0; j < 2; j++)
+    AddCacheString(mbStrings, keys[i].label[j], ck.labelOfs[j], ck.labelLen[j]);
+  mb.AppendData(&ck, sizeof(ck));
+  }
+((KbcHeader *)mb.GetData())->strSize = ToLE((wxUint32)mbStrings.GetDataLen());
+mb.AppendData(mbStrings.GetData(), mbStrings.GetDataLen());
+}
+
+/*****************************************************************************/
+/* ReadCacheFile : read compiled GUI layout, if it matches the source        */
+/*****************************************************************************/
+
+bool KbdGui::ReadCacheFile
+    (
+    wxString const &cachefile,
+    wxString const &srcfile,
+    wxMemoryBuffer const &src
+    )
+{
+if (!wxFileExists(cachefile))
+  return false;
+wxMemoryBuffer mb;
+if (!ReadFileData(cachefile, mb) ||
+    mb.GetDataLen() < sizeof(KbcHeader))
+  return false;
+
+// the cheap checks first; the source is only hashed if they match
+const KbcHeader *hdr = (const KbcHeader *)mb.GetData();
+wxUint32 srcTime[2];
+GetTimeStamp(srcfile, srcTime);
+if (hdr->srcTime[0] != srcTime[0] || hdr->srcTime[1] != srcTime[1] ||
+    FromLE(hdr->srcSize) != (wxUint32)src.GetDataLen() ||
+    FromLE(hdr->srcHash) != HashData(src.GetData(), src.GetDataLen()))
+  return false;                         /* stale                             */
+return SetCompiled(mb.GetData(), mb.GetDataLen());
+}
+
+/*****************************************************************************/
+/* WriteCacheFile : write compiled GUI layout                                */
+/*****************************************************************************/
+
+bool KbdGui::WriteCacheFile
+    (
+    wxString const &cachefile,
+    wxString const &srcfile,
+    wxMemoryBuffer const &src
+    )
+{
+wxMemoryBuffer mb;
+GetCompiled(mb);
+KbcHeader *hdr = (KbcHeader *)mb.GetData();
+GetTimeStamp(srcfile, hdr->srcTime);
+hdr->srcSize = ToLE((wxUint32)src.GetDataLen());
+hdr->srcHash = ToLE(HashData(src.GetData(), src.GetDataLen()));
+
+wxFile f;
+if (!f.Create(cachefile, true))
+  return false;
+if (f.Write(mb.GetData(), mb.GetDataLen()) != mb.GetDataLen())
+  {
+  f.Close();
+  wxRemoveFile(cachefile);              /* don't leave broken caches behind  */
+  return false;
+  }
+return true;
+}
+
 /*****************************************************************************/
 /* CalcLayout : calculates the x positions based on the key definitions      */
 /*****************************************************************************/
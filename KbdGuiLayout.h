@@ -98,50 +98,160 @@ class KbdMatrix
       }
   };
 
+/*****************************************************************************/
+/* KbdOverlayText : text serialization of sparse overlay layers              */
+/*****************************************************************************/
+
+// Upper layers normally contain only a handful of keys != KB_NONE, so the
+// text layout format can write them as "+ row/col=key, ..." lines that only
+// list the set positions. This class converts between such a line and the
+// keys of a layer; the layers themselves are always kept as KbdMatrix.
+class KbdOverlayText
+  {
+  public:
+    KbdOverlayText(int rows = 0, int cols = 0)
+      {
+      this->rows = max(min(rows, MAXROWS), 0);
+      this->cols = max(min(cols, MAXCOLS), 0);
+      Clear();
+      }
+
+    void Clear()
+      {
+      for (int i = 0; i < MAXROWS * MAXCOLS; i++)
+        keys[i] = KB_NONE;
+      }
+    int GetRows() const { return rows; }
+    int GetCols() const { return cols; }
+    int GetKey(int row, int col) const
+      {
+      if (row < 0 || row >= rows || col < 0 || col >= cols)
+        return KB_UNUSED;
+      return keys[row * MAXCOLS + col];
+      }
+    void SetKey(int row, int col, MatrixKey value)
+      {
+      if (row >= 0 && row < rows && col >= 0 && col < cols)
+        keys[row * MAXCOLS + col] = value;
+      }
+
+    // sparse text format: "row/col=HEX, row/col=HEX, ..."
+    wxString ToText() const;
+    bool FromText(wxString const &s);
+
+  protected:
+    int rows, cols;
+    MatrixKey keys[MAXROWS * MAXCOLS];
+  };
+
 /*****************************************************************************/
 /* KbdMacro : class definition for a keyboard macro                          */
 /*****************************************************************************/
 
-// TODO: QUITE a LOT still missing here. Including understanding macros 8-)
 class KbdMacro
   {
   public:
-    KbdMacro(int mods = 0, int keys = 0, MacroKey const *values = NULL)
-      : mods(mods)
-      { Resize(keys, values); }
+    /* packed transfer format (LEN_MACRO bytes):
+       [0] = modifiers
+       [1] = reserved
+       [2] .. [LEN_MACRO - 1] = macro keys
+    */
+    enum { MaxKeys = LEN_MACRO - 2 };
 
-    void Resize(int newkeys = 0, MacroKey const *values = NULL)
+    KbdMacro(int mods = 0, int keys = 0, MacroKey const *values = NULL)
+      : mods((wxUint8)mods), reserved(0)
+      { SetKeys(values, keys); }
+    KbdMacro(wxUint8 const *packed)
+      { FromPacked(packed); }
+    bool operator==(KbdMacro const &other) const
       {
-      // TODO: get that right!
-      newkeys = max(min(newkeys, 6), 0);
-      keys.resize(newkeys);
-      SetKeys(values);
+      if (mods != other.mods || reserved != other.reserved)
+        return false;
+      return !memcmp(keys, other.keys, sizeof(keys));
+      }
+    bool operator!=(KbdMacro const &other) const
+      { return !(*this == other); }
+
+    int GetMods() const { return mods; }
+    void SetMods(int newmods) { mods = (wxUint8)newmods; }
+    MacroKey GetKey(int n) const
+      { return (n >= 0 && n < MaxKeys) ? keys[n] : (MacroKey)KB_UNUSED; }
+    void SetKey(int n, MacroKey value)
+      {
+      if (n >= 0 && n < MaxKeys)
+        keys[n] = value;
       }
+    void SetKeys(MacroKey const *values = NULL, int count = MaxKeys)
+      {
+      count = max(min(count, (int)MaxKeys), 0);
+      for (int i = 0; i < MaxKeys; i++)
+        keys[i] = (values && i < count) ? values[i] : (MacroKey)KB_UNUSED;
+      }
+    int GetKeyCount() const             /* # keys up to the last used one    */
+      {
+      int n = MaxKeys;
+      while (n > 0 && keys[n - 1] == KB_UNUSED)
+        n--;
+      return n;
+      }
+    bool IsEmpty() const
+      { return !mods && !GetKeyCount(); }
 
-    void SetKeys(MacroKey const *values = NULL)
+    void FromPacked(wxUint8 const *packed)
       {
-      if (values)
-        {
-        for (size_t i = 0; i < keys.size(); i++)
-          keys[i] = values[i];
-        }
-      else
-        {
-        for (size_t i = 0; i < keys.size(); i++)
-          keys[i] = KB_UNUSED;
-        }
+      mods = packed[0];
+      reserved = packed[1];
+      memcpy(keys, packed + 2, sizeof(keys));
+      }
+    void ToPacked(wxUint8 *packed) const
+      {
+      packed[0] = mods;
+      packed[1] = reserved;
+      memcpy(packed + 2, keys, sizeof(keys));
       }
 
   protected:
     wxUint8 mods;
-    wxVector<MacroKey> keys;
-    KbdMacro &DoCopy(KbdMacro const &org)
+    wxUint8 reserved;
+    MacroKey keys[MaxKeys];
+  };
+
+/*****************************************************************************/
+/* KbdLayoutEdit : a set of key changes in a layout, as one undo step        */
+/*****************************************************************************/
+
+class KbdLayoutEdit
+  {
+  public:
+    struct Change
       {
-      mods = org.mods;
-      keys.assign(org.keys.begin(), org.keys.end());
-      return *this;
+      wxUint8 layer, row, col;
+      MatrixKey oldKey, newKey;
+      };
+
+    KbdLayoutEdit(wxString const &name = wxEmptyString) : name(name) { }
+
+    wxString const &GetName() const { return name; }
+    bool IsEmpty() const { return changes.empty(); }
+    size_t GetCount() const { return changes.size(); }
+    Change const &GetChange(size_t n) const { return changes[n]; }
+    void Add(int layer, int row, int col, MatrixKey oldKey, MatrixKey newKey)
+      {
+      Change ch = { (wxUint8)layer, (wxUint8)row, (wxUint8)col, oldKey, newKey };
+      changes.push_back(ch);
+      }
+    // bit n set if layer n is affected
+    wxUint32 GetLayerMask() const
+      {
+      wxUint32 mask = 0;
+      for (size_t i = 0; i < changes.size(); i++)
+        mask |= 1 << changes[i].layer;
+      return mask;
       }
 
+  protected:
+    wxString name;
+    wxVector<Change> changes;
   };
 
 /*****************************************************************************/
@@ -151,14 +261,15 @@ class KbdMacro
 class KbdLayout
   {
   public:
-    // TODO: devise macro initialization functionality
     KbdLayout(int layers = 0, int rows = 0, int cols = 0, int macros = 0, MatrixKey *values = NULL)
-      : layers(0), rows(0), cols(0), macros(0)
+      : changes(0), layers(0), rows(0), cols(0), macros(0)
       {
+      memset(macrodata, KB_UNUSED, sizeof(macrodata));
       Resize(layers, rows, cols, macros, values);
       SetModified(false);
       }
     KbdLayout(KbdLayout const &org)
+      : changes(0)
       { DoCopy(org); }
     virtual ~KbdLayout() {}
     KbdLayout &operator=(KbdLayout const &org)
@@ -188,7 +299,6 @@ class KbdLayout
       }
     bool AddLayer(int count = 1)
       { return InsertLayer(layers, count); }
-    // TODO: devise macro initialization functionality
     void Resize(int layers = 0, int rows = 0, int cols = 0, int macros = 0, MatrixKey *values = NULL)
       {
       layers = max(min(layers, NUMLAYERS_MAX), 0);
@@ -197,11 +307,16 @@ class KbdLayout
       macros = max(min(macros, NUM_MACROKEYS), 0);
       if (this->layers != layers ||
           this->rows != rows ||
-          this->cols != cols)
+          this->cols != cols ||
+          this->macros != macros)
         SetModified();
       this->layers = layers;
       this->rows = rows;
       this->cols = cols;
+      if (macros < this->macros)        /* clear dropped macro slots         */
+        memset(macrodata + macros * LEN_MACRO, KB_UNUSED,
+               (this->macros - macros) * LEN_MACRO);
+      this->macros = macros;
       if (layers > 0 && rows > 0 && cols > 0)
         {
         for (int i = 0; i < layers; i++)
@@ -229,8 +344,26 @@ class KbdLayout
         SetModified();
       return layer[layernum].SetKey(row, col, value);
       }
-    KbdMacro &GetMacro(int macronum = 0) { return macro[macronum]; }
-    // TODO: some sort of macro getter/setter
+    // macro access; the macros are kept in packed transfer format
+    KbdMacro GetMacro(int macronum = 0) const
+      { return KbdMacro(macrodata + macronum * LEN_MACRO); }
+    void SetMacro(int macronum, KbdMacro const &value)
+      {
+      if (macronum < 0 || macronum >= NUM_MACROKEYS)
+        return;
+      if (macronum >= macros)           /* implicitly extend the macro set   */
+        macros = macronum + 1;
+      wxUint8 packed[LEN_MACRO];
+      value.ToPacked(packed);
+      if (memcmp(macrodata + macronum * LEN_MACRO, packed, LEN_MACRO))
+        {
+        memcpy(macrodata + macronum * LEN_MACRO, packed, LEN_MACRO);
+        SetModified();
+        }
+      }
+    wxUint8 const *GetMacroData() const { return macrodata; }
+    bool HasSameMacros(wxUint8 const *macrobuf) const
+      { return !memcmp(macrodata, macrobuf, sizeof(macrodata)); }
 
     // import layout in Model M USB transfer format
     bool Import(wxUint8 *layout, int bufsize /* in bytes! */ = -1,
@@ -254,7 +387,7 @@ class KbdLayout
            pmac[2] .. pmac[7] = macro keys
         */
         // sanity check: must not consist of FF only
-        int zeros = 0, ffs = 0;
+        int ffs = 0;
         for (int i = 0; i < LEN_MACRO; i++)
           if (pmac[i] == 0xff)
             ffs++;
@@ -263,6 +396,7 @@ class KbdLayout
           memset(pmac, KB_UNUSED, LEN_MACRO);
         }
       Resize(newLayers, tgtrows, tgtcols, macros);
+      ImportMacros(macrobuf, macrosize);
 	  if (transformat == 1)
         layout += sizeof(wxUint8);
 	  else
@@ -276,8 +410,8 @@ class KbdLayout
             k += (*layout++) << 8;
             SetKey(l, r, c, k);
             }
-      // TODO: import the macros!
       SetModified(false);
+      changes++;                        /* replaced, even if identical       */
       return true;
       }
     // export layout to Model M USB transfer format
@@ -302,21 +436,76 @@ class KbdLayout
             *buf++ = k & 0xff;
             *buf++ = k >> 8;
             }
-      // TODO: export the macros!
       return true;
       }
+    // import macros in Model M USB transfer format
+    bool ImportMacros(wxUint8 const *macrobuf, int macrosize /* in bytes! */)
+      {
+      int newMacros = macrobuf ? macrosize / LEN_MACRO : 0;
+      newMacros = max(min(newMacros, NUM_MACROKEYS), 0);
+      memset(macrodata, KB_UNUSED, sizeof(macrodata));
+      if (newMacros)
+        memcpy(macrodata, macrobuf, newMacros * LEN_MACRO);
+      if (macros != newMacros)
+        SetModified();
+      macros = newMacros;
+      return true;
+      }
+    // export macros to Model M USB transfer format (always the full set)
+    bool ExportMacros(wxUint8 *buf, int &bufsize /* in bytes!*/) const
+      {
+      if (bufsize < (int)sizeof(macrodata))
+        return false;
+      bufsize = (int)sizeof(macrodata);
+      memcpy(buf, macrodata, bufsize);
+      return true;
+      }
+    // macros in text format ("n=mods res key1 .. key6, ...", n=1..NUM_MACROKEYS)
+    wxString MacrosToText() const;
+    bool MacrosFromText(wxString const &s);
     bool ReadFile(wxString const &filename);
     bool WriteFile(wxString const &filename, bool bNative = true,
-                   int tgtrows = NUMROWS, int tgtcols = NUMCOLS);
+                   int tgtrows = NUMROWS, int tgtcols = NUMCOLS,
+                   bool bSparse = false, bool bHex = true);
+
+    // bulk edits on the layers in layerMask (bit n = layer n); each one
+    // returns the number of changed keys and records them in edit, if given
+    int MapKeys(wxUint32 layerMask, MatrixKey from, MatrixKey to,
+                KbdLayoutEdit *edit = NULL);
+    int SwapKeys(wxUint32 layerMask, int row1, int col1, int row2, int col2,
+                 KbdLayoutEdit *edit = NULL);
+    int FillKeys(wxUint32 layerMask, int row, int col, int nRows, int nCols,
+                 MatrixKey value, KbdLayoutEdit *edit = NULL);
+    int CopyKeys(int srcLayer, wxUint32 layerMask,
+                 int row, int col, int nRows, int nCols,
+                 KbdLayoutEdit *edit = NULL);
+    // (re)do or undo a recorded edit
+    void ApplyEdit(KbdLayoutEdit const &edit, bool bUndo = false);
 
     bool IsModified() { return bModified; }
-    void SetModified(bool bOn = true) { bModified = bOn; }
+    void SetModified(bool bOn = true) { bModified = bOn; if (bOn) changes++; }
+    // counts edits and replacements; unlike the modified flag, it's never
+    // reset, so it tells whether anything happened since a given point
+    wxUint32 GetChangeCount() const { return changes; }
+
+  protected:
+    wxUint32 ClipLayerMask(wxUint32 layerMask) const
+      { return layerMask & ((1 << layers) - 1); }
+    bool ClipRegion(int &row, int &col, int &nRows, int &nCols) const
+      {
+      if (row < 0) { nRows += row; row = 0; }
+      if (col < 0) { nCols += col; col = 0; }
+      nRows = min(nRows, rows - row);
+      nCols = min(nCols, cols - col);
+      return nRows > 0 && nCols > 0;
+      }
 
   protected:
     bool bModified;
+    wxUint32 changes;
     int layers, rows, cols, macros;
     wxVector<KbdMatrix> layer;
-    wxVector<KbdMacro> macro;
+    wxUint8 macrodata[NUM_MACROKEYS * LEN_MACRO];  /* packed macro store     */
     KbdLayout &DoCopy(KbdLayout const &org)
       {
       layers = org.layers;
@@ -324,12 +513,63 @@ class KbdLayout
       cols = org.cols;
       macros = org.macros;
       layer.assign(org.layer.begin(), org.layer.end());
-      macro.assign(org.macro.begin(), org.macro.end());
+      memcpy(macrodata, org.macrodata, sizeof(macrodata));
       SetModified(false);
+      changes++;                        /* the change count isn't copied     */
       return *this;
       }
   };
 
+/*****************************************************************************/
+/* KbdLayoutHistory : undo / redo stacks for layout edits                    */
+/*****************************************************************************/
+
+class KbdLayoutHistory
+  {
+  public:
+    KbdLayoutHistory(int maxSteps = 100) : maxSteps(maxSteps) { }
+
+    void Clear() { undo.clear(); redo.clear(); }
+    void Add(KbdLayoutEdit const &edit)
+      {
+      if (edit.IsEmpty())
+        return;
+      undo.push_back(edit);
+      if ((int)undo.size() > maxSteps)
+        undo.erase(undo.begin());
+      redo.clear();
+      }
+    bool CanUndo() const { return !undo.empty(); }
+    bool CanRedo() const { return !redo.empty(); }
+    wxString GetUndoName() const
+      { return undo.empty() ? wxString() : undo.back().GetName(); }
+    wxString GetRedoName() const
+      { return redo.empty() ? wxString() : redo.back().GetName(); }
+    // both return the edit that has been undone / redone, or NULL
+    KbdLayoutEdit const *Undo(KbdLayout &layout)
+      {
+      if (undo.empty())
+        return NULL;
+      redo.push_back(undo.back());
+      undo.pop_back();
+      layout.ApplyEdit(redo.back(), true);
+      return &redo.back();
+      }
+    KbdLayoutEdit const *Redo(KbdLayout &layout)
+      {
+      if (redo.empty())
+        return NULL;
+      undo.push_back(redo.back());
+      redo.pop_back();
+      layout.ApplyEdit(undo.back());
+      return &undo.back();
+      }
+
+  protected:
+    int maxSteps;
+    wxVector<KbdLayoutEdit> undo, redo;
+  };
+
 /*****************************************************************************/
 /* GuiKey : definition for one key                                           */
 /*****************************************************************************/
@@ -381,24 +621,38 @@ class KbdGui
     wxString const &GetName() { return layoutName; }
     size_t size() const { return keys.size(); }
     GuiKey const &GetKey(int index) const { return keys[index]; }
-    float GetHorizontalUnits() { return unitsH; }
-    float GetVerticalUnits() { return unitsV; }
+    float GetHorizontalUnits() const { return unitsH; }
+    float GetVerticalUnits() const { return unitsV; }
     void GetMatrixLayout(int &nRows, int &nCols) const
       { nRows = nMaxRow + 1; nCols = nMaxCol + 1; }
     int GetMaxRow() { return nMaxRow; }
     int GetMaxCol() { return nMaxCol; }
 
-    bool ReadLayoutFile(wxString const &filename, wxString *error = NULL);
+    // if cachefile is given, a compiled version of the layout is used
+    // as long as it's up to date, and (re)written otherwise
+    bool ReadLayoutFile(wxString const &filename, wxString *error = NULL,
+                        wxString const &cachefile = wxEmptyString);
+    // compiled layout (see KbdGuiLayout.cpp for the format)
+    bool SetCompiled(const void *data, size_t len);
+    void GetCompiled(wxMemoryBuffer &mb) const;
     bool WriteLayoutFile(wxString const &filename);
 
     // convert OS Virtual Key -> HID
     static int GetHID(int /* wxKeyCode */ vkey);
+    // convert key event -> HID, preferring the raw key code if available
+    static int GetHID(wxKeyEvent &ev);
     // convert scan code -> HID
     static int GetHIDFromScancode(int scancode);
+    // convert raw (X11 / GTK hardware) key code -> HID
+    static int GetHIDFromKeycode(int keycode);
 
   protected:
     KbdGui &DoCopy(KbdGui const &org);
     void CalcLayout();
+    bool ReadCacheFile(wxString const &cachefile, wxString const &srcfile,
+                       wxMemoryBuffer const &src);
+    bool WriteCacheFile(wxString const &cachefile, wxString const &srcfile,
+                        wxMemoryBuffer const &src);
 
   protected:
     static GuiKey *pDefault;
@@ -23,6 +23,8 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 #include "KbdWnd.h"
 
+#include "wx/display.h"
+
 #ifndef wxHAS_IMAGES_IN_RESOURCES
 // nothing yet.
 //#include "res/Application.xpm"
@@ -50,6 +52,9 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 static wxVector<CKbdWnd *> regWnds;
 static bool bGUIKeyInhibited = false;
+#ifdef _DEBUG
+static bool bBenchLookup = false;       /* BenchmarkLookup() requested?    */
+#endif
 
 #ifdef __WXMSW__
 static HHOOK hKeyboardHook = NULL;
@@ -159,7 +164,9 @@ wxBEGIN_EVENT_TABLE(CKbdWnd, wxPanel)
     EVT_KEY_UP(CKbdWnd::OnKeyUp)
 #endif
     EVT_LEFT_DOWN(CKbdWnd::OnLButtonDown)
+    EVT_MOUSEWHEEL(CKbdWnd::OnMouseWheel)
     EVT_TIMER(Kbd_Timer1, CKbdWnd::OnReadLEDTimer)
+    EVT_TIMER(Kbd_RefreshTimer, CKbdWnd::OnRefreshTimer)
 wxEND_EVENT_TABLE()
 
 /*****************************************************************************/
@@ -200,10 +207,12 @@ CKbdWnd::CKbdWnd
     long style,
     const wxString& name
     )
-: wxPanel(), // default constructor, because of SetBackgroundStyle()
-  keyFont(wxFontInfo(wxSize(0, 11)).Family(wxFONTFAMILY_SWISS))
+: wxPanel() // default constructor, because of SetBackgroundStyle()
 {
 SetBackgroundStyle(wxBG_STYLE_PAINT);
+zoom = GetDefaultZoom();
+pZoom = NULL;
+ClearLookup();
 wxSize szInitial = CalcLayout(size);
 Create(parent, id, pos, szInitial, style, name);
 SetMinSize(szInitial);
@@ -238,6 +247,11 @@ clrKey[ksAlert][0] = clrKey[ksAlert][1] =
 clrKey[ksLEDOn][0] = wxColour(KEYCLR_LEDON);
 clrKey[ksLEDOn][1] = wxColour(KEYCLR_LEDON_HI);
 
+bPaintObjects = false;
+#ifdef _DEBUG
+usPaint = 0;
+nPaints = 0;
+#endif
 bAllKeys = false;
 getLEDStates = true;
 for (int i = 0; i < _countof(bLEDState); i++)
@@ -245,6 +259,10 @@ for (int i = 0; i < _countof(bLEDState); i++)
 // set up 2ms timer
 t.SetOwner(this, Kbd_Timer1);
 t.Start(2);
+tRefresh.SetOwner(this, Kbd_RefreshTimer);
+frameTime = 0;
+bHeatmap = false;
+ResetPressCounts();
 }
 
 /*****************************************************************************/
@@ -254,9 +272,11 @@ t.Start(2);
 CKbdWnd::~CKbdWnd(void)
 {
 CaptureAllKeys(false); // stop capturing in any case
-matrix2Key.clear();
-hid2Key.clear();
+tRefresh.Stop();
+dirtyKeys.clear();
+ClearLookup();
 keys.clear();
+ClearZooms();
 }
 
 /*****************************************************************************/
@@ -311,10 +331,48 @@ void CKbdWnd::SetLayout(KbdGui const &newlayout)
 for (int i = 0; i < _countof(bLEDState); i++)
   bLEDState[i] = false;
 
-wxSize szOld = GetMinSize();
 layout = newlayout;
-wxSize szNew = CalcLayout(szOld);
-if (szOld != szNew)
+SetNewSize(CalcLayout(GetMinSize()));
+Refresh();
+}
+
+/*****************************************************************************/
+/* GetDefaultZoom : returns the zoom factor for the current screen           */
+/*****************************************************************************/
+
+int CKbdWnd::GetDefaultZoom()
+{
+#ifdef __WXMSW__
+// Windows works in physical pixels, so high DPI screens need a larger zoom
+int dpiZoom = (wxScreenDC().GetPPI().y * 100 + 48) / 96;
+return max(100, min(dpiZoom / zoomStep * zoomStep, (int)zoomMax));
+#else
+// the others scale the window contents; key images use the content scale
+return 100;
+#endif
+}
+
+/*****************************************************************************/
+/* SetZoom : sets a new zoom factor                                          */
+/*****************************************************************************/
+
+void CKbdWnd::SetZoom(int newZoom)
+{
+newZoom = max((int)zoomMin, min(newZoom, (int)zoomMax));
+if (newZoom == zoom)
+  return;
+zoom = newZoom;
+SetNewSize(ApplyZoom());
+Refresh();
+}
+
+/*****************************************************************************/
+/* SetNewSize : sets a new window size                                       */
+/*****************************************************************************/
+
+void CKbdWnd::SetNewSize(wxSize const &szNew)
+{
+if (GetMinSize() != szNew)
   {
   SetSize(szNew);
   SetMinSize(szNew);
@@ -322,7 +380,6 @@ if (szOld != szNew)
   if (GetParent())
     GetParent()->Layout();
   }
-Refresh();
 }
 
 /*****************************************************************************/
@@ -334,161 +391,584 @@ wxSize CKbdWnd::CalcLayout(wxSize sz)
 if (sz.x < 0 || sz.y < 0)
   return sz;
 
-#if 1
-// fixed size
-int nMult = 36;  // neatly divisible by 2, 3 and 4
-
-sz.x = 8 + (int)ceil(nMult * layout.GetHorizontalUnits());
-sz.y = 8 + (int)ceil(nMult * layout.GetVerticalUnits());
-#else
-// variable layout based on externally dictated size
-int nMult = (int)ceil(sz.x / layout.GetHorizontalUnits());
-sz.y = (int)ceil(nMult * layout.GetVerticalUnits());
-#endif
-
+ClearZooms();                           /* all geometry has to be redone     */
+tRefresh.Stop();                        /* whole window is refreshed anyway  */
+dirtyKeys.clear();
 keys.clear();
 KeyLayout kl;
 kl.state = ksUnpressed;
+kl.sprite = NULL;
+kl.bDirty = false;
 for (size_t i = 0; i < layout.size(); i++)
   {
   kl.def = &layout.GetKey(i);
-  if (kl.def->hidcode < 0 &&
-      kl.def->matrixrow < 0 &&
-      kl.def->matrixcol < 0)
+  if (!IsKeyShown(*kl.def))
     continue;
-  kl.rects = 1;
-  kl.rect[0].x = 4 + (int)(kl.def->startx1 * nMult);
-  kl.rect[0].width = -2 + (int)(fabs(kl.def->width1) * nMult);
-  kl.rect[0].y = 4 + (int)(kl.def->starty1 * nMult);
-  if (kl.def->height <= 1.f || kl.def->width1 == kl.def->width2)
-    kl.rect[0].height = -2 + (int)(fabs(kl.def->height) * nMult);
-  else
+  kl.rects = GetKeyRects(*kl.def);
+  keys.push_back(kl);
+  }
+keyMark.assign(keys.size(), 0);
+markStamp = 0;
+
+ClearLookup();
+for (size_t i = 0; i < keys.size(); i++)
+  {
+  KeyLayout &k = keys[i];
+  int hidcode = k.def->hidcode;
+  if (hidcode >= 0 && hidcode <= 0xffff)
     {
-    // 2-unit irregular key like ISO Enter
-    kl.rects++;
-    kl.rect[1].x = 4 + (int)(kl.def->startx2 * nMult);
-    kl.rect[1].width = -2 + (int)(fabs(kl.def->width2) * nMult);
-    // if 2-part and lower part is smaller (ISO Enter)
-    if (kl.def->width2 < kl.def->width1)
-      {
-      kl.rect[0].height = -2 + nMult;
-      kl.rect[1].height = nMult + 1;
-      }
-    else  // if 2-part and lower part is larger
-      {
-      kl.rect[0].height = nMult + 1;
-      kl.rect[1].height = -2 + nMult;
-      }
-    kl.rect[1].y = kl.rect[0].y + kl.rect[0].height - 1;
+    wxVector<KeyLayout *> &codes = hid2Key[hidcode >> 8];
+    if (codes.empty())                  /* only the types in use get a table */
+      codes.assign(256, (KeyLayout *)NULL);
+    codes[hidcode & 0xff] = &k;
+    }
+  int row = k.def->matrixrow, col = k.def->matrixcol;
+  if (row >= 0 && row < MAXROWS && col >= 0 && col < MAXCOLS)
+    matrix2Key[row][col] = &k;
+  }
+#ifdef _DEBUG
+if (bBenchLookup)                       /* only if explicitly requested      */
+  {
+  bBenchLookup = false;
+  BenchmarkLookup();
+  }
+#endif
+return ApplyZoom();
+}
+
+/*****************************************************************************/
+/* ClearLookup : clears the key lookup tables                                */
+/*****************************************************************************/
+
+void CKbdWnd::ClearLookup()
+{
+for (int i = 0; i < _countof(hid2Key); i++)
+  hid2Key[i].clear();
+for (int row = 0; row < MAXROWS; row++)
+  for (int col = 0; col < MAXCOLS; col++)
+    matrix2Key[row][col] = NULL;
+}
+
+#ifdef _DEBUG
+/*****************************************************************************/
+/* RequestLookupBenchmark : run BenchmarkLookup() on next CalcLayout()       */
+/*****************************************************************************/
+
+void CKbdWnd::RequestLookupBenchmark()
+{
+bBenchLookup = true;
+}
+
+/*****************************************************************************/
+/* BenchmarkLookup : logs the cost of key lookups                            */
+/*****************************************************************************/
+
+// the hash maps that were used before, for comparison
+WX_DECLARE_HASH_MAP(wxUint32, CKbdWnd::KeyLayout *, wxIntegerHash, wxIntegerEqual, KbdIndex2Key);
+
+
+void CKbdWnd::BenchmarkLookup()
+{
+if (keys.empty())
+  return;
+KbdIndex2Key hidMap, matrixMap;
+for (size_t i = 0; i < keys.size(); i++)
+  {
+  hidMap[keys[i].def->hidcode] = &keys[i];
+  matrixMap[(keys[i].def->matrixrow << 24) | keys[i].def->matrixcol] = &keys[i];
+  }
+
+int const rounds = 1000;
+int nLookups = rounds * (int)keys.size() * 2;
+int found = 0;
+wxStopWatch sw;
+for (int r = 0; r < rounds; r++)
+  for (size_t i = 0; i < keys.size(); i++)
+    {
+    GuiKey const *def = keys[i].def;
+    found += (FindHID(def->hidcode) != NULL);
+    found += (FindMatrix(def->matrixrow, def->matrixcol) != NULL);
     }
-  // if that's a LED, key.rects = 1, but rect2 gives the LED position
-  if ((kl.def->hidcode >> 8) == TYPE_LED)
+wxLongLong usTables = sw.TimeInMicro();
+sw.Start();
+for (int r = 0; r < rounds; r++)
+  for (size_t i = 0; i < keys.size(); i++)
     {
-    kl.rect[1].width = 9;
-    kl.rect[1].height = 6;
-    kl.rect[1].x = kl.rect[0].x + + (kl.rect[0].width - kl.rect[1].width) / 2;
-    kl.rect[1].y = kl.rect[0].y + kl.rect[0].height - kl.rect[1].height - 2;
+    GuiKey const *def = keys[i].def;
+    KbdIndex2Key::const_iterator it = hidMap.find(def->hidcode);
+    found += (it != hidMap.end() && it->second);
+    it = matrixMap.find((def->matrixrow << 24) | def->matrixcol);
+    found += (it != matrixMap.end() && it->second);
     }
+wxLongLong usMaps = sw.TimeInMicro();
+wxLogDebug(wxT("CKbdWnd key lookup: %.1f ns with tables, %.1f ns with hash maps (%d)"),
+           usTables.ToDouble() * 1000. / nLookups,
+           usMaps.ToDouble() * 1000. / nLookups,
+           found);
+}
+#endif
 
-  keys.push_back(kl);
+/*****************************************************************************/
+/* IsKeyShown : returns whether a GUI key is shown at all                    */
+/*****************************************************************************/
+
+bool CKbdWnd::IsKeyShown(GuiKey const &def)
+{
+return def.hidcode >= 0 || def.matrixrow >= 0 || def.matrixcol >= 0;
+}
+
+/*****************************************************************************/
+/* GetKeyRects : returns the number of rectangles a GUI key consists of      */
+/*****************************************************************************/
+
+int CKbdWnd::GetKeyRects(GuiKey const &def)
+{
+// 2 for irregular keys like ISO Enter
+return (def.height <= 1.f || def.width1 == def.width2) ? 1 : 2;
+}
+
+/*****************************************************************************/
+/* GetKeyUnit : returns the pixels per key unit for a zoom factor            */
+/*****************************************************************************/
+
+int CKbdWnd::GetKeyUnit(int zoom)
+{
+// 36 pixels per key unit at 100% - neatly divisible by 2, 3 and 4
+return max(4, (36 * zoom + 50) / 100);
+}
+
+/*****************************************************************************/
+/* CalcSize : calculates the size of a keyboard for a zoom factor            */
+/*****************************************************************************/
+
+wxSize CKbdWnd::CalcSize(KbdGui const &layout, int zoom)
+{
+int nMult = GetKeyUnit(zoom);
+return wxSize(8 + (int)ceil(nMult * layout.GetHorizontalUnits()),
+              8 + (int)ceil(nMult * layout.GetVerticalUnits()));
+}
+
+/*****************************************************************************/
+/* CreateKeyFont : creates the key label font for a zoom factor              */
+/*****************************************************************************/
+
+wxFont CKbdWnd::CreateKeyFont(int zoom)
+{
+return wxFont(wxFontInfo(wxSize(0, max(4, (11 * zoom + 50) / 100)))
+                  .Family(wxFONTFAMILY_SWISS));
+}
+
+/*****************************************************************************/
+/* CalcKeyGeometry : calculates a key's rectangles for a zoom factor         */
+/*****************************************************************************/
+
+void CKbdWnd::CalcKeyGeometry
+    (
+    GuiKey const &def,
+    int rects,
+    int zoom,
+    KeyGeometry &kg
+    )
+{
+int nMult = GetKeyUnit(zoom);
+kg.rect[0].x = 4 + (int)(def.startx1 * nMult);
+kg.rect[0].width = -2 + (int)(fabs(def.width1) * nMult);
+kg.rect[0].y = 4 + (int)(def.starty1 * nMult);
+if (rects < 2)
+  kg.rect[0].height = -2 + (int)(fabs(def.height) * nMult);
+else
+  {
+  // 2-unit irregular key like ISO Enter
+  kg.rect[1].x = 4 + (int)(def.startx2 * nMult);
+  kg.rect[1].width = -2 + (int)(fabs(def.width2) * nMult);
+  // if 2-part and lower part is smaller (ISO Enter)
+  if (def.width2 < def.width1)
+    {
+    kg.rect[0].height = -2 + nMult;
+    kg.rect[1].height = nMult + 1;
+    }
+  else  // if 2-part and lower part is larger
+    {
+    kg.rect[0].height = nMult + 1;
+    kg.rect[1].height = -2 + nMult;
+    }
+  kg.rect[1].y = kg.rect[0].y + kg.rect[0].height - 1;
+  }
+// if that's a LED, key.rects = 1, but rect2 gives the LED position
+if ((def.hidcode >> 8) == TYPE_LED)
+  {
+  kg.rect[1].width = max(3, (9 * zoom + 50) / 100);
+  kg.rect[1].height = max(2, (6 * zoom + 50) / 100);
+  kg.rect[1].x = kg.rect[0].x + (kg.rect[0].width - kg.rect[1].width) / 2;
+  kg.rect[1].y = kg.rect[0].y + kg.rect[0].height - kg.rect[1].height - 2;
   }
 
-hid2Key.clear();
-matrix2Key.clear();
+kg.bounds = kg.rect[0];
+if (rects > 1)
+  kg.bounds.Union(kg.rect[1]);
+kg.sprite = NULL;
+}
+
+/*****************************************************************************/
+/* GetZoomCache : returns the geometry for a zoom factor                     */
+/*****************************************************************************/
+
+CKbdWnd::KbdZoom *CKbdWnd::GetZoomCache(int zoom)
+{
+KbdZooms::iterator it = zooms.find(zoom);
+if (it != zooms.end())
+  return it->second;
+if (zooms.size() >= 8)                  /* don't collect too many of them    */
+  ClearZooms();
+
+KbdZoom *pz = new KbdZoom;
+pz->nMult = GetKeyUnit(zoom);
+pz->size = CalcSize(layout, zoom);
+pz->font = CreateKeyFont(zoom);
+pz->scale = 0.;                         /* set when painting                 */
+pz->keys.resize(keys.size());
 for (size_t i = 0; i < keys.size(); i++)
   {
-  KeyLayout &k = keys[i];
-  if (k.def->hidcode >= 0)
-    hid2Key[k.def->hidcode] = &k;
-  wxUint32 pos = (k.def->matrixrow << 24) | k.def->matrixcol;
-  if (pos != (wxUint32)-1)
-    matrix2Key[pos] = &k;
+  GuiKey const *def = keys[i].def;
+  KeyGeometry &kg = pz->keys[i];
+  CalcKeyGeometry(*def, keys[i].rects, zoom, kg);
+
+  // keys with the same size, shape and label can share their images
+  bool bIsLed = ((def->hidcode >> 8) == TYPE_LED);
+  wxString id = wxString::Format(wxT("%d %d %d %d %d"),
+                                 bIsLed,
+                                 kg.bounds.width, kg.bounds.height,
+                                 kg.rect[0].width, kg.rect[0].height);
+  if (keys[i].rects > 1 || bIsLed)      /* 2nd rectangle relative to 1st     */
+    id += wxString::Format(wxT(" %d %d %d %d"),
+                           kg.rect[1].x - kg.rect[0].x,
+                           kg.rect[1].y - kg.rect[0].y,
+                           kg.rect[1].width, kg.rect[1].height);
+  kg.sprite = &pz->sprites[id + wxT("|") + def->label[0]];
   }
-return sz;
+
+BuildGrid(*pz);
+zooms[zoom] = pz;
+return pz;
 }
 
 /*****************************************************************************/
-/* OnPaint : called to repaint the window                                    */
+/* ClearZooms : discards the geometry for all zoom factors                   */
 /*****************************************************************************/
 
-void CKbdWnd::OnPaint(wxPaintEvent &ev)
+void CKbdWnd::ClearZooms()
 {
-wxBufferedPaintDC dc(this);
-// wxPaintDC dc(this);
+for (KbdZooms::iterator it = zooms.begin(); it != zooms.end(); ++it)
+  delete it->second;
+zooms.clear();
+pZoom = NULL;
+}
 
-wxBrush brBack(clrBkgnd);
-wxPen penBack(clrBkgnd);
-wxPen penKeyBound(clrBorder);
-wxBrush brKey[ksStates][2] =
-  {
-    { wxBrush(clrKey[ksUnpressed][0]), wxBrush(clrKey[ksUnpressed][1]) },
-    { wxBrush(clrKey[ksPressed][0]),   wxBrush(clrKey[ksPressed][1]) },
-    { wxBrush(clrKey[ksReleased][0]),  wxBrush(clrKey[ksReleased][1]) },
-    { wxBrush(clrKey[ksAlert][0]),     wxBrush(clrKey[ksAlert][1]) },
-    { wxBrush(clrKey[ksLEDOn][0]),     wxBrush(clrKey[ksLEDOn][1]) }
-  };
-wxPen penKey[ksStates][2] =
+/*****************************************************************************/
+/* ApplyZoom : puts the current zoom factor's geometry into the keys         */
+/*****************************************************************************/
+
+wxSize CKbdWnd::ApplyZoom()
+{
+pZoom = GetZoomCache(zoom);
+for (size_t i = 0; i < keys.size(); i++)
   {
-    { wxPen(clrKey[ksUnpressed][0]), wxPen(clrKey[ksUnpressed][1]) },
-    { wxPen(clrKey[ksPressed][0]),   wxPen(clrKey[ksPressed][1]) },
-    { wxPen(clrKey[ksReleased][0]),  wxPen(clrKey[ksReleased][1]) },
-    { wxPen(clrKey[ksAlert][0]),     wxPen(clrKey[ksAlert][1]) },
-    { wxPen(clrKey[ksLEDOn][0]),     wxPen(clrKey[ksLEDOn][1]) }
-  };
-KeyClrs kclr[ksStates][2] =
+  KeyGeometry const &kg = pZoom->keys[i];
+  keys[i].rect[0] = kg.rect[0];
+  keys[i].rect[1] = kg.rect[1];
+  keys[i].bounds = kg.bounds;
+  keys[i].sprite = kg.sprite;
+  }
+return pZoom->size;
+}
+
+/*****************************************************************************/
+/* BuildGrid : sets up the grid of cells covered by each key                 */
+/*****************************************************************************/
+
+void CKbdWnd::BuildGrid(KbdZoom &z)
+{
+int &gridCell = z.gridCell, &gridCols = z.gridCols, &gridRows = z.gridRows;
+wxVector<int> &gridStart = z.gridStart, &gridKeys = z.gridKeys;
+gridCell = z.nMult;                     /* one key unit per cell             */
+gridCols = z.size.x / gridCell + 1;
+gridRows = z.size.y / gridCell + 1;
+int cells = gridCols * gridRows;
+gridStart.assign(cells + 1, 0);
+gridKeys.clear();
+
+// done in 2 passes; the first one counts the keys per cell,
+// the second one fills them in
+for (int pass = 0; pass < 2; pass++)
   {
+  for (size_t i = 0; i < keys.size(); i++)
     {
-      { brKey[ksUnpressed][0], brKey[ksUnpressed][0], penKeyBound, penKey[ksUnpressed][0] },
-      { brKey[ksUnpressed][1], brKey[ksUnpressed][1], penKeyBound, penKey[ksUnpressed][1] }
-    },
+    KeyLayout const &key = keys[i];
+    KeyGeometry const &kg = z.keys[i];
+    if (kg.bounds.IsEmpty())
+      continue;
+    int col1 = max(0, kg.bounds.x / gridCell);
+    int row1 = max(0, kg.bounds.y / gridCell);
+    int col2 = min(gridCols - 1, kg.bounds.GetRight() / gridCell);
+    int row2 = min(gridRows - 1, kg.bounds.GetBottom() / gridCell);
+    for (int row = row1; row <= row2; row++)
+      for (int col = col1; col <= col2; col++)
+        {
+        // the bounds of an ISO Enter key contain a cell it doesn't touch
+        wxRect cell(col * gridCell, row * gridCell, gridCell, gridCell);
+        if (!cell.Intersects(kg.rect[0]) &&
+            (key.rects < 2 || !cell.Intersects(kg.rect[1])))
+          continue;
+        int n = row * gridCols + col;
+        if (pass == 0)
+          gridStart[n + 1]++;
+        else
+          gridKeys[gridStart[n]++] = (int)i;
+        }
+    }
+  if (pass == 0)
     {
-      { brKey[ksPressed][0], brKey[ksUnpressed][0], penKeyBound, penKey[ksPressed][0] },
-      { brKey[ksPressed][1], brKey[ksUnpressed][1], penKeyBound, penKey[ksPressed][1] }
-    },
+    for (int n = 0; n < cells; n++)
+      gridStart[n + 1] += gridStart[n];
+    gridKeys.resize(gridStart[cells]);
+    }
+  else                                  /* move starts back into place       */
     {
-      { brKey[ksReleased][0], brKey[ksUnpressed][0], penKeyBound, penKey[ksReleased][0] },
-      { brKey[ksReleased][1], brKey[ksUnpressed][1], penKeyBound, penKey[ksReleased][1] }
-    },
+    for (int n = cells; n > 0; n--)
+      gridStart[n] = gridStart[n - 1];
+    gridStart[0] = 0;
+    }
+  }
+}
+
+/*****************************************************************************/
+/* FindKeyAt : returns the key at a given position                           */
+/*****************************************************************************/
+
+CKbdWnd::KeyLayout *CKbdWnd::FindKeyAt(wxPoint const &pt)
+{
+if (pt.x < 0 || pt.y < 0 || !pZoom)
+  return NULL;
+int gridCell = pZoom->gridCell;
+wxVector<int> const &gridStart = pZoom->gridStart;
+int col = pt.x / gridCell, row = pt.y / gridCell;
+if (col >= pZoom->gridCols || row >= pZoom->gridRows)
+  return NULL;
+int n = row * pZoom->gridCols + col;
+for (int i = gridStart[n]; i < gridStart[n + 1]; i++)
+  {
+  KeyLayout &key = keys[pZoom->gridKeys[i]];
+  if (key.rect[0].Contains(pt) ||
+      (key.rects > 1 && key.rect[1].Contains(pt)))
+    return &key;
+  }
+return NULL;
+}
+
+/*****************************************************************************/
+/* FindKeysIn : returns the indices of all keys touching a rectangle         */
+/*****************************************************************************/
+
+int CKbdWnd::FindKeysIn(wxRect const &rect, wxVector<int> &found)
+{
+found.clear();
+if (!pZoom || rect.IsEmpty())
+  return 0;
+int gridCell = pZoom->gridCell, gridCols = pZoom->gridCols;
+wxVector<int> const &gridStart = pZoom->gridStart;
+int col1 = max(0, rect.x / gridCell);
+int row1 = max(0, rect.y / gridCell);
+int col2 = min(gridCols - 1, rect.GetRight() / gridCell);
+int row2 = min(pZoom->gridRows - 1, rect.GetBottom() / gridCell);
+if (col1 > col2 || row1 > row2)
+  return 0;
+
+if (++markStamp == 0)                   /* keys spanning several cells are   */
+  {                                     /* only checked once                 */
+  keyMark.assign(keys.size(), 0);
+  markStamp = 1;
+  }
+for (int row = row1; row <= row2; row++)
+  for (int col = col1; col <= col2; col++)
     {
-      { brKey[ksAlert][0], brKey[ksUnpressed][0], penKeyBound, penKey[ksAlert][0] },
-      { brKey[ksAlert][1], brKey[ksUnpressed][1], penKeyBound, penKey[ksAlert][1] }
-    },
+    int n = row * gridCols + col;
+    for (int i = gridStart[n]; i < gridStart[n + 1]; i++)
+      {
+      int k = pZoom->gridKeys[i];
+      if (keyMark[k] == markStamp)
+        continue;
+      keyMark[k] = markStamp;
+      KeyLayout const &key = keys[k];
+      if (rect.Intersects(key.rect[0]) ||
+          (key.rects > 1 && rect.Intersects(key.rect[1])))
+        found.push_back(k);
+      }
+    }
+// keep the layout order, so the keys are painted as before
+if (row1 != row2 || col1 != col2)
+  wxVectorSort(found);
+return (int)found.size();
+}
+
+/*****************************************************************************/
+/* SetupPaintObjects : creates the brushes and pens for the current colours  */
+/*****************************************************************************/
+
+void CKbdWnd::SetupPaintObjects()
+{
+brBack = wxBrush(clrBkgnd);
+penBack = wxPen(clrBkgnd);
+penKeyBound = wxPen(clrBorder);
+for (int i = 0; i < ksStates; i++)
+  for (int j = 0; j < 2; j++)
     {
-      { brKey[ksLEDOn][0], brKey[ksUnpressed][0], penKeyBound, penKey[ksLEDOn][0] },
-      { brKey[ksLEDOn][1], brKey[ksUnpressed][1], penKeyBound, penKey[ksLEDOn][1] }
-    },
+    brKey[i][j] = wxBrush(clrKey[i][j]);
+    penKey[i][j] = wxPen(clrKey[i][j]);
+    }
+// heatmap goes from yellow for rarely used keys to red
+for (int i = 1; i < heatBuckets; i++)
+  brHeat[i] = wxBrush(wxColour(255, 224 - 224 * (i - 1) / (heatBuckets - 2), 0));
+bPaintObjects = true;
+}
+
+/*****************************************************************************/
+/* InvalidatePaintObjects : discard paint objects and key images             */
+/*****************************************************************************/
+
+void CKbdWnd::InvalidatePaintObjects()
+{
+bPaintObjects = false;
+for (KbdZooms::iterator it = zooms.begin(); it != zooms.end(); ++it)
+  ClearSprites(*it->second);
+}
+
+/*****************************************************************************/
+/* ClearSprites : discard the key images for a zoom factor                   */
+/*****************************************************************************/
+
+void CKbdWnd::ClearSprites(KbdZoom &z)
+{
+for (KbdSprites::iterator it = z.sprites.begin(); it != z.sprites.end(); ++it)
+  for (int i = 0; i < ksStates; i++)
+    for (int j = 0; j < 2; j++)
+      it->second.bmp[i][j] = wxNullBitmap;
+}
+
+/*****************************************************************************/
+/* GetSprite : returns the image for a key in its current state              */
+/*****************************************************************************/
+
+wxBitmap const &CKbdWnd::GetSprite(KeyLayout const &key)
+{
+int clridx = (key.state & ~ksHighlighted);
+int high = !!(key.state & ksHighlighted);
+wxBitmap &bmp = key.sprite->bmp[clridx][high];
+if (bmp.IsOk() || key.bounds.IsEmpty())
+  return bmp;
+
+KeyClrs clrs =
+  {
+  brKey[clridx][high], brKey[ksUnpressed][high],
+  penKeyBound, penKey[clridx][high]
   };
+// on HiDPI screens, the image is drawn in logical coordinates, but
+// has the screen's resolution
+bmp.CreateScaled(key.bounds.width, key.bounds.height,
+                 wxBITMAP_SCREEN_DEPTH, pZoom->scale);
+wxMemoryDC mdc(bmp);
+mdc.SetBackground(brBack);
+mdc.Clear();
+mdc.SetFont(pZoom->font);
+mdc.SetDeviceOrigin(-key.bounds.x, -key.bounds.y);
+DrawKey(mdc, key, clrs, key.def->label[0], pZoom->labels);
+mdc.SelectObject(wxNullBitmap);
+
+if (key.rects > 1)                      /* irregular key like ISO Enter?     */
+  {                                     /* only draw the key itself          */
+  wxBitmap bmpMask;
+  bmpMask.CreateScaled(key.bounds.width, key.bounds.height, 1, pZoom->scale);
+  wxMemoryDC mdcMask(bmpMask);
+  mdcMask.SetBackground(*wxBLACK_BRUSH);
+  mdcMask.Clear();
+  mdcMask.SetBrush(*wxWHITE_BRUSH);
+  mdcMask.SetPen(*wxWHITE_PEN);
+  mdcMask.SetDeviceOrigin(-key.bounds.x, -key.bounds.y);
+  mdcMask.DrawRectangle(key.rect[0]);
+  mdcMask.DrawRectangle(key.rect[1]);
+  mdcMask.SelectObject(wxNullBitmap);
+  bmp.SetMask(new wxMask(bmpMask));
+  }
+return bmp;
+}
 
-dc.SetBrush(brBack);
-dc.SetPen(penBack);
-dc.SetFont(keyFont);
+/*****************************************************************************/
+/* OnPaint : called to repaint the window                                    */
+/*****************************************************************************/
+
+void CKbdWnd::OnPaint(wxPaintEvent &ev)
+{
+#ifdef _DEBUG
+wxStopWatch sw;
+#endif
+wxBufferedPaintDC dc(this);
+// wxPaintDC dc(this);
+
+if (!bPaintObjects)
+  SetupPaintObjects();
+#ifdef __WXMSW__
+double scale = 1.;                      /* Windows paints in physical pixels */
+#else
+double scale = GetContentScaleFactor();
+#endif
+if (pZoom && pZoom->scale != scale)    /* window moved to another screen?   */
+  {
+  ClearSprites(*pZoom);
+  pZoom->scale = scale;
+  }
 // Find Out where the window is scrolled to
 //wxPoint vb = GetViewStart();     // Top left corner of client
 wxRegionIterator upd(GetUpdateRegion()); // get the update rect list
+wxVector<int> found;
 while (upd)
   {
   wxRect rect(upd.GetRect());
+  dc.SetBrush(brBack);
+  dc.SetPen(penBack);
   dc.DrawRectangle(rect);
-  // Repaint this rectangle        ...some code...
-  bool bKeysPainted = false;
-  for (size_t i = 0; i < keys.size(); i++)
+  // Repaint this rectangle; the keys are pre-rendered
+  FindKeysIn(rect, found);
+  for (size_t i = 0; i < found.size(); i++)
     {
-    int clridx = (keys[i].state & ~ksHighlighted);
-    int high = !!(keys[i].state & ksHighlighted);
-    if (rect.Intersects(keys[i].rect[0]) ||
-        (keys[i].rects > 1 && rect.Intersects(keys[i].rect[1])))
+    KeyLayout const &key = keys[found[i]];
+    wxBitmap const &bmp = GetSprite(key);
+    if (bmp.IsOk())
+      dc.DrawBitmap(bmp, key.bounds.x, key.bounds.y, key.rects > 1);
+    int row = key.def->matrixrow, col = key.def->matrixcol;
+    if (bHeatmap &&                     /* heatmap shown as bar on the key   */
+        row >= 0 && row < MAXROWS && col >= 0 && col < MAXCOLS &&
+        heatBucket[row][col])
       {
-      DrawKey(dc, keys[i], kclr[clridx][high]);
-      bKeysPainted = true;
+      int height = max(2, pZoom->nMult / 9);
+      dc.SetBrush(brHeat[heatBucket[row][col]]);
+      dc.SetPen(*wxTRANSPARENT_PEN);
+      dc.DrawRectangle(key.rect[0].x + 2,
+                       key.rect[0].y + key.rect[0].height - height - 2,
+                       key.rect[0].width - 4, height);
       }
     }
-  if (bKeysPainted)
-    {
-    dc.SetBrush(brBack);
-    dc.SetPen(penBack);
-    }
   upd++;
   }
+
+#ifdef _DEBUG
+usPaint += sw.TimeInMicro();
+if (++nPaints == 100)
+  {
+  wxLogDebug(wxT("CKbdWnd::OnPaint: %ld us per frame"),
+             (long)(usPaint / nPaints).ToLong());
+  usPaint = 0;
+  nPaints = 0;
+  }
+#endif
 }
 
 /*****************************************************************************/
@@ -499,7 +979,9 @@ void CKbdWnd::DrawKey
     (
     wxDC &dc,
     KeyLayout const &key,
-    KeyClrs const &clrs
+    KeyClrs const &clrs,
+    wxString const &label,
+    KbdLabels &labels
     )
 {
 GuiKey const &def = *key.def;
@@ -527,10 +1009,53 @@ if (bIsLed)
   }
 
 rc.Deflate(1, 1);
-dc.DrawLabel(def.label[0],
-             wxNullBitmap,
-             rc,
-             wxALIGN_CENTER_HORIZONTAL | wxALIGN_CENTER_VERTICAL);
+wxVector<LabelLine> const &lines = GetLabelLayout(dc, label, rc.GetSize(), labels);
+for (size_t i = 0; i < lines.size(); i++)
+  dc.DrawText(lines[i].text, rc.x + lines[i].pos.x, rc.y + lines[i].pos.y);
+}
+
+/*****************************************************************************/
+/* GetLabelLayout : returns the lines of a label, centered in a rectangle    */
+/*****************************************************************************/
+
+wxVector<CKbdWnd::LabelLine> const &CKbdWnd::GetLabelLayout
+    (
+    wxDC &dc,
+    wxString const &label,
+    wxSize const &sz,
+    KbdLabels &labels
+    )
+{
+// the cache has to be for the font that's selected into the DC
+wxString id = wxString::Format(wxT("%d %d|"), sz.x, sz.y) + label;
+KbdLabels::iterator it = labels.find(id);
+if (it != labels.end())
+  return it->second;
+
+wxVector<LabelLine> &lines = labels[id];
+wxArrayString texts = wxSplit(label, wxT('\n'), 0);
+wxCoord heightLine = 0;
+dc.GetTextExtent(wxT("W"), NULL, &heightLine);
+wxVector<wxCoord> widths;
+for (size_t i = 0; i < texts.size(); i++)
+  {
+  wxCoord w = 0, h = 0;
+  if (texts[i].size())
+    dc.GetTextExtent(texts[i], &w, &h);
+  widths.push_back(w);
+  heightLine = max(heightLine, h);
+  }
+int y = (sz.y - heightLine * (int)texts.size()) / 2;
+for (size_t i = 0; i < texts.size(); i++, y += heightLine)
+  {
+  if (texts[i].empty())
+    continue;
+  LabelLine line;
+  line.text = texts[i];
+  line.pos = wxPoint((sz.x - widths[i]) / 2, y);
+  lines.push_back(line);
+  }
+return lines;
 }
 
 /*****************************************************************************/
@@ -546,6 +1071,8 @@ if (key &&
   {
   key->state = (KeyState)newstate;
   RefreshKey(key);
+  if (newstate == ksPressed)
+    CountPress(key);
   if (passOn &&
       key->def->matrixcol >= 0 &&
       key->def->matrixrow >= 0)
@@ -666,8 +1193,7 @@ return wxPanel::MSWWindowProc(nMsg, wParam, lParam);
 void CKbdWnd::PassOnKeyDown(wxKeyEvent &ev)
 {
 #if !defined(__WXMSW__)
-int kc = ev.GetKeyCode();               /* get key code from event           */
-int key = KbdGui::GetHID(kc);           /* retrieve HID for that key         */
+int key = KbdGui::GetHID(ev);           /* retrieve HID for that key         */
 SetKeyState(key, ksPressed, true);
 #endif
 }
@@ -700,8 +1226,7 @@ if (!bAllKeys)
   }
 
 #else
-int kc = ev.GetKeyCode();               /* get key code from event           */
-key = KbdGui::GetHID(kc);               /* retrieve HID for that key         */
+key = KbdGui::GetHID(ev);               /* retrieve HID for that key         */
 #endif
 
 #if !defined(__WXMSW__)
@@ -725,8 +1250,7 @@ if (key != KB_UNUSED)
 void CKbdWnd::PassOnChar(wxKeyEvent &ev)
 {
 #if !defined(__WXMSW__)
-int kc = ev.GetKeyCode();               /* get key code from event           */
-int key = KbdGui::GetHID(kc);           /* retrieve HID for that key         */
+int key = KbdGui::GetHID(ev);           /* retrieve HID for that key         */
 // SetKeyState(key, ksPressed, false);
 #endif
 }
@@ -760,8 +1284,7 @@ if (!bAllKeys)
 #else
 
 // not for release builds until it really works!
-int kc = ev.GetKeyCode();
-key = KbdGui::GetHID(kc);               /* retrieve HID for that key         */
+key = KbdGui::GetHID(ev);               /* retrieve HID for that key         */
 #endif
 
 #if !defined(__WXMSW__)
@@ -786,8 +1309,7 @@ if (key != KB_UNUSED)
 void CKbdWnd::PassOnKeyUp(wxKeyEvent &ev)
 {
 #if !defined(__WXMSW__)
-int kc = ev.GetKeyCode();               /* get key code from event           */
-int key = KbdGui::GetHID(kc);           /* retrieve HID for that key         */
+int key = KbdGui::GetHID(ev);           /* retrieve HID for that key         */
 SetKeyState(key, ksReleased, false);
 #endif
 }
@@ -816,8 +1338,7 @@ if (!bAllKeys)
   }
 #else
 // not for release builds until it really works!
-int kc = ev.GetKeyCode();
-key = KbdGui::GetHID(kc);               /* retrieve HID for that key         */
+key = KbdGui::GetHID(ev);               /* retrieve HID for that key         */
 #endif
 
 #if !defined(__WXMSW__)
@@ -859,17 +1380,221 @@ if (!this->HasFocus())
 #endif
   
 // look whether it's on a key
-for (size_t i = 0; i < keys.size(); i++)
-  if (keys[i].rect[0].Contains(event.GetPosition()) ||
-      (keys[i].def->width1 != keys[i].def->width2 &&
-       keys[i].rect[1].Contains(event.GetPosition())))
+KeyLayout *key = FindKeyAt(event.GetPosition());
+if (key &&
+    key->def->matrixrow >= 0 &&
+    key->def->matrixcol >= 0)
+  GetApp()->GetMain()->SelectMatrix(key->def->matrixrow,
+                                    key->def->matrixcol);
+}
+
+/*****************************************************************************/
+/* OnMouseWheel : called when the mouse wheel is turned over the window      */
+/*****************************************************************************/
+
+void CKbdWnd::OnMouseWheel(wxMouseEvent& event)
+{
+// Ctrl+Wheel zooms the keyboard
+if (!event.ControlDown() || !event.GetWheelRotation())
+  {
+  event.Skip();
+  return;
+  }
+SetZoom(zoom + ((event.GetWheelRotation() > 0) ? zoomStep : -zoomStep));
+GetApp()->WriteConfig("/Settings/KbdZoom", (long)zoom);
+}
+
+/*****************************************************************************/
+/* GetFrameTime : returns the time between two screen refreshes in ms        */
+/*****************************************************************************/
+
+int CKbdWnd::GetFrameTime()
+{
+if (frameTime)                          /* only determined when necessary    */
+  return frameTime;
+int refresh = 0;
+int nDisplay = wxDisplay::GetFromWindow(this);
+if (nDisplay != wxNOT_FOUND)
+  refresh = wxDisplay(nDisplay).GetCurrentMode().refresh;
+if (refresh <= 0)                       /* unknown? assume the usual 60 Hz   */
+  refresh = 60;
+// no need to go faster than 120 Hz; slower than 24 Hz would look choppy
+refresh = max(24, min(refresh, 120));
+frameTime = 1000 / refresh;
+return frameTime;
+}
+
+/*****************************************************************************/
+/* FlushRefresh : refreshes all keys changed since the last frame            */
+/*****************************************************************************/
+
+void CKbdWnd::FlushRefresh()
+{
+for (size_t i = 0; i < dirtyKeys.size(); i++)
+  {
+  dirtyKeys[i]->bDirty = false;
+  RefreshRect(dirtyKeys[i]->bounds);
+  }
+dirtyKeys.clear();
+}
+
+/*****************************************************************************/
+/* OnRefreshTimer : called once per frame if keys have changed               */
+/*****************************************************************************/
+
+void CKbdWnd::OnRefreshTimer(wxTimerEvent& event)
+{
+FlushRefresh();
+}
+
+/*****************************************************************************/
+/* ShowHeatmap : switches the key press heatmap on or off                    */
+/*****************************************************************************/
+
+void CKbdWnd::ShowHeatmap(bool bOn)
+{
+if (bOn == bHeatmap)
+  return;
+bHeatmap = bOn;
+Refresh();
+}
+
+/*****************************************************************************/
+/* ResetPressCounts : clears all key press counters                          */
+/*****************************************************************************/
+
+void CKbdWnd::ResetPressCounts()
+{
+for (int row = 0; row < MAXROWS; row++)
+  for (int col = 0; col < MAXCOLS; col++)
     {
-    if (keys[i].def->matrixrow >= 0 &&
-        keys[i].def->matrixcol >= 0)
-      GetApp()->GetMain()->SelectMatrix(keys[i].def->matrixrow,
-                                        keys[i].def->matrixcol);
-    break;
+    pressCount[row][col] = 0;
+    heatBucket[row][col] = 0;
     }
+heatBits = 0;
+if (bHeatmap)
+  Refresh();
+}
+
+/*****************************************************************************/
+/* CalcHeatBucket : calculates the heatmap colour index for a count          */
+/*****************************************************************************/
+
+int CKbdWnd::CalcHeatBucket(wxUint32 count)
+{
+// logarithmic scale up to the highest count, so that keys used a
+// thousand times don't look like keys used a million times
+int bits = 0;
+for (; count; count >>= 1)
+  bits++;
+if (!bits)
+  return 0;
+return 1 + (bits - 1) * (heatBuckets - 2) / max(1, heatBits - 1);
+}
+
+/*****************************************************************************/
+/* UpdateHeatBuckets : recalculates all heatmap colour indices               */
+/*****************************************************************************/
+
+void CKbdWnd::UpdateHeatBuckets()
+{
+wxUint32 maxCount = 0;
+for (int row = 0; row < MAXROWS; row++)
+  for (int col = 0; col < MAXCOLS; col++)
+    maxCount = max(maxCount, pressCount[row][col]);
+for (heatBits = 0; maxCount; maxCount >>= 1)
+  heatBits++;
+
+for (int row = 0; row < MAXROWS; row++)
+  for (int col = 0; col < MAXCOLS; col++)
+    {
+    wxUint8 bucket = (wxUint8)CalcHeatBucket(pressCount[row][col]);
+    if (bucket == heatBucket[row][col])
+      continue;
+    heatBucket[row][col] = bucket;
+    KeyLayout *key = FindMatrix(row, col);
+    if (bHeatmap && key)
+      RefreshKey(key);
+    }
+}
+
+/*****************************************************************************/
+/* CountPress : counts a key press                                           */
+/*****************************************************************************/
+
+void CKbdWnd::CountPress(KeyLayout *key)
+{
+int row = key->def->matrixrow, col = key->def->matrixcol;
+if (row < 0 || row >= MAXROWS || col < 0 || col >= MAXCOLS ||
+    pressCount[row][col] == 0xffffffff)
+  return;
+wxUint32 count = ++pressCount[row][col];
+if (!(count & (count - 1)) &&           /* new power of 2 - maybe new scale? */
+    (heatBits < 1 || (count >> (heatBits - 1)) > 1))
+  {
+  UpdateHeatBuckets();                  /* all keys move on the scale        */
+  return;
+  }
+wxUint8 bucket = (wxUint8)CalcHeatBucket(count);
+if (bucket != heatBucket[row][col])     /* only redraw if colour changed     */
+  {
+  heatBucket[row][col] = bucket;
+  if (bHeatmap)
+    RefreshKey(key);
+  }
+}
+
+/*****************************************************************************/
+/* LoadPressCounts : loads the key press counters from a file                */
+/*****************************************************************************/
+
+bool CKbdWnd::LoadPressCounts(wxString const &filename)
+{
+wxTextFile f;
+if (!wxFileExists(filename) || !f.Open(filename))
+  return false;
+for (int row = 0; row < MAXROWS; row++)
+  for (int col = 0; col < MAXCOLS; col++)
+    pressCount[row][col] = 0;
+for (size_t i = 0; i < f.GetLineCount(); i++)
+  {
+  wxString line = f[i];
+  line.Trim(false);
+  if (line.empty() || line[0] == wxT('#'))
+    continue;
+  long row, col;
+  unsigned long count;
+  wxArrayString toks = wxSplit(line, wxT(' '));
+  if (toks.size() >= 3 &&
+      toks[0].ToLong(&row) && row >= 0 && row < MAXROWS &&
+      toks[1].ToLong(&col) && col >= 0 && col < MAXCOLS &&
+      toks[2].ToULong(&count))
+    pressCount[row][col] = (wxUint32)count;
+  }
+UpdateHeatBuckets();
+return true;
+}
+
+/*****************************************************************************/
+/* SavePressCounts : saves the key press counters to a file                  */
+/*****************************************************************************/
+
+bool CKbdWnd::SavePressCounts(wxString const &filename)
+{
+wxTextFile f;
+if (!f.Create(filename) &&
+    !f.Open(filename))
+  return false;
+f.Clear();
+
+f.AddLine(wxT("# BlUSB_GUI Key Press Counts"));
+f.AddLine(wxT("# row col count"));
+for (int row = 0; row < MAXROWS; row++)
+  for (int col = 0; col < MAXCOLS; col++)
+    if (pressCount[row][col])
+      f.AddLine(wxString::Format(wxT("%d %d %u"),
+                                 row, col, (unsigned)pressCount[row][col]));
+return f.Write(wxTextFileType_Unix);
 }
 
 /*****************************************************************************/
@@ -44,14 +44,66 @@ public:
       {
       // Timers
       Kbd_Timer1 = 1,
+      Kbd_RefreshTimer,
+      };
+    enum
+      {
+      // zoom factors in percent
+      zoomMin = 50,
+      zoomMax = 400,
+      zoomStep = 25
+      };
+    enum
+      {
+      // heatmap colours; bucket 0 is for unused keys
+      heatBuckets = 16
+      };
+    struct KeySprite
+      {
+      // pre-rendered key images for all states, created when needed
+      wxBitmap bmp[ksStates][2];
       };
     struct KeyLayout
       {
       int rects;
       wxRect rect[2];
+      wxRect bounds;   // rectangle enclosing the key
       KeyState state;
       GuiKey const *def;
+      KeySprite *sprite;
+      bool bDirty;     // waiting for the next refresh
+      };
+    WX_DECLARE_STRING_HASH_MAP(KeySprite, KbdSprites);
+    struct LabelLine
+      {
+      wxString text;
+      wxPoint pos;     // relative to the label rectangle
       };
+    WX_DECLARE_STRING_HASH_MAP(wxVector<LabelLine>, KbdLabels);
+    struct KeyGeometry
+      {
+      wxRect rect[2];
+      wxRect bounds;
+      KeySprite *sprite;
+      };
+    struct KbdZoom
+      {
+      // geometry and key images for one zoom factor
+      int nMult;       // pixels per key unit
+      wxSize size;     // window size
+      wxFont font;
+      double scale;    // content scale the key images are made for
+      wxVector<KeyGeometry> keys;
+      // key images, shared by keys with the same size and label
+      KbdSprites sprites;
+      // laid out key labels, by label rectangle size and text
+      KbdLabels labels;
+      // uniform grid over the key rectangles for hit-testing and painting
+      int gridCell, gridCols, gridRows;
+      wxVector<int> gridStart;  // first entry of each cell in gridKeys
+      wxVector<int> gridKeys;   // key indices, ascending in each cell
+      };
+    WX_DECLARE_HASH_MAP(int, KbdZoom *, wxIntegerHash, wxIntegerEqual, KbdZooms);
     struct KeyClrs
       {
       // brushes for up to 2 rectangles
@@ -84,6 +136,7 @@ public:
     void SetBkgndColour(wxColour const &newClr)
       {
       clrBkgnd = newClr;
+      InvalidatePaintObjects();
       Refresh();
       }
     wxColour const &GetColour(int ks)
@@ -91,18 +144,59 @@ public:
     void SetColour(int ks, wxColour const &newClr)
       {
       clrKey[ks & ~ksHighlighted][!!(ks & ksHighlighted)] = newClr;
+      InvalidatePaintObjects();
       Refresh();
       }
+    int GetZoom() { return zoom; }
+    void SetZoom(int newZoom);
+    static int GetDefaultZoom();
+    bool IsHeatmapShown() { return bHeatmap; }
+    void ShowHeatmap(bool bOn = true);
+    wxUint32 GetPressCount(int row, int col)
+      {
+      if (row < 0 || row >= MAXROWS || col < 0 || col >= MAXCOLS)
+        return 0;
+      return pressCount[row][col];
+      }
+    void ResetPressCounts();
+    bool LoadPressCounts(wxString const &filename);
+    bool SavePressCounts(wxString const &filename);
     bool GetLEDStates() { return getLEDStates; }
     void GetLEDStates(bool bOn) { getLEDStates = bOn; }
 
+    // the window may have been moved to a display with another refresh rate
+    void InvalidateFrameTime() { frameTime = 0; }
+
     bool CapturingAllKeys() { return bAllKeys; }
     void CaptureAllKeys(bool bOn = true);
 
     KeyLayout *FindHID(int hidcode)
-      { return hid2Key[hidcode]; }
+      {
+      if (hidcode < 0 || hidcode > 0xffff || hid2Key[hidcode >> 8].empty())
+        return NULL;
+      return hid2Key[hidcode >> 8][hidcode & 0xff];
+      }
     KeyLayout *FindMatrix(int row, int col)
-      { return matrix2Key[(row << 24) | col]; }
+      {
+      if (row < 0 || row >= MAXROWS || col < 0 || col >= MAXCOLS)
+        return NULL;
+      return matrix2Key[row][col];
+      }
+
+    // key geometry and drawing, also used for offscreen rendering
+    static bool IsKeyShown(GuiKey const &def);
+    static int GetKeyRects(GuiKey const &def);
+    static int GetKeyUnit(int zoom);
+    static wxSize CalcSize(KbdGui const &layout, int zoom);
+    static wxFont CreateKeyFont(int zoom);
+    static void CalcKeyGeometry(GuiKey const &def, int rects, int zoom,
+                                KeyGeometry &kg);
+    static void DrawKey(wxDC &dc, KeyLayout const &key, KeyClrs const &clrs,
+                        wxString const &label, KbdLabels &labels);
+    static wxVector<LabelLine> const &GetLabelLayout(wxDC &dc,
+                                                     wxString const &label,
+                                                     wxSize const &sz,
+                                                     KbdLabels &labels);
 
     // Functionality to pass on GUI key events to keyboard window
     void PassOnKeyDown(wxKeyEvent &ev);
@@ -111,6 +205,10 @@ public:
     // Functionality to prohinit GUI key propagation
     static void HookLLKeyboard(bool bOn = true); // needs a better name sometime
     static void InhibitGuiKey(bool bOn = true);
+#ifdef _DEBUG
+    // log the key lookup cost once, on the next layout calculation
+    static void RequestLookupBenchmark();
+#endif
 
 private:
     wxDECLARE_EVENT_TABLE();
@@ -120,7 +218,9 @@ private:
     void OnChar(wxKeyEvent &);
     void OnKeyUp(wxKeyEvent &);
     void OnLButtonDown(wxMouseEvent& event);
+    void OnMouseWheel(wxMouseEvent& event);
     void OnReadLEDTimer(wxTimerEvent& event);
+    void OnRefreshTimer(wxTimerEvent& event);
 
 protected:
 #ifdef __WXMSW__
@@ -128,24 +228,71 @@ protected:
     MSWWindowProc(WXUINT nMsg, WXWPARAM wParam, WXLPARAM lParam);
 #endif // __WXMSW__
 
-    void DrawKey(wxDC &dc, KeyLayout const &key, KeyClrs const &clrs);
+    void SetupPaintObjects();
+    void InvalidatePaintObjects();
+    static void ClearSprites(KbdZoom &z);
+    wxBitmap const &GetSprite(KeyLayout const &key);
+    KbdZoom *GetZoomCache(int zoom);
+    void ClearZooms();
+    wxSize ApplyZoom();
+    void SetNewSize(wxSize const &szNew);
+    void BuildGrid(KbdZoom &z);
+    void ClearLookup();
+#ifdef _DEBUG
+    void BenchmarkLookup();
+#endif
+    KeyLayout *FindKeyAt(wxPoint const &pt);
+    int FindKeysIn(wxRect const &rect, wxVector<int> &found);
     void RefreshKey(KeyLayout *key)
       {
-      RefreshRect(key->rect[0]);
-      RefreshRect(key->rect[1]);
-      // Update();
+      // changed keys are collected and refreshed once per frame
+      if (key->bDirty)
+        return;
+      key->bDirty = true;
+      dirtyKeys.push_back(key);
+      if (!tRefresh.IsRunning())
+        tRefresh.StartOnce(GetFrameTime());
       }
+    void FlushRefresh();
+    void CountPress(KeyLayout *key);
+    int CalcHeatBucket(wxUint32 count);
+    void UpdateHeatBuckets();
+    int GetFrameTime();
 
 protected:
     KbdGui layout;
     wxVector<KeyLayout> keys;
-    WX_DECLARE_HASH_MAP(wxUint32, KeyLayout *, wxIntegerHash, wxIntegerEqual, KbdIndex2Key);
-    KbdIndex2Key hid2Key;
-    KbdIndex2Key matrix2Key;
+    // key lookup tables; HID codes are looked up by type, then code
+    wxVector<KeyLayout *> hid2Key[256];
+    KeyLayout *matrix2Key[MAXROWS][MAXCOLS];
+    // geometry for the zoom factors used so far
+    int zoom;
+    KbdZooms zooms;
+    KbdZoom *pZoom;                     // current zoom factor
+    wxVector<int> keyMark;              // used by FindKeysIn()
+    int markStamp;
     wxColour clrBkgnd, clrBorder;
     wxColour clrKey[ksStates][2];
-    wxFont keyFont;
+    // paint objects, kept until the colours change
+    bool bPaintObjects;
+    wxBrush brBack;
+    wxPen penBack, penKeyBound;
+    wxBrush brKey[ksStates][2];
+    wxPen penKey[ksStates][2];
+    wxBrush brHeat[heatBuckets];
+    // key press counters, by matrix position
+    bool bHeatmap;
+    wxUint32 pressCount[MAXROWS][MAXCOLS];
+    wxUint8 heatBucket[MAXROWS][MAXCOLS];
+    int heatBits;                       // bit length of the highest count
+#ifdef _DEBUG
+    wxLongLong usPaint;                 // paint time statistics
+    int nPaints;
+#endif
     wxTimer t;
+    wxVector<KeyLayout *> dirtyKeys;    // keys that need to be refreshed
+    wxTimer tRefresh;
+    int frameTime;                      // ms per screen refresh, or 0
     bool bLEDState[3], getLEDStates;
     bool bAllKeys;
 protected:
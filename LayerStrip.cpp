@@ -0,0 +1,377 @@
+/*****************************************************************************/
+/* LayerStrip.cpp : overview strip with thumbnails of all layout layers      */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "wxStd.h"
+#include "layout.h"
+#include "blusb_gui.h"
+
+#include "LayerStrip.h"
+
+/*****************************************************************************/
+/* Colors for the key states                                                 */
+/*****************************************************************************/
+
+#define THUMBCLR_CHANGED     160, 160, 230  // differs from default layout
+
+/*===========================================================================*/
+/* CLayerStrip class members                                                 */
+/*===========================================================================*/
+
+/*****************************************************************************/
+/* CLayerStrip Event Table                                                   */
+/*****************************************************************************/
+
+wxBEGIN_EVENT_TABLE(CLayerStrip, wxPanel)
+    EVT_PAINT(CLayerStrip::OnPaint)
+    EVT_LEFT_DOWN(CLayerStrip::OnLButtonDown)
+    EVT_MOTION(CLayerStrip::OnMotion)
+wxEND_EVENT_TABLE()
+
+/*****************************************************************************/
+/* CLayerStrip : constructor                                                 */
+/*****************************************************************************/
+
+CLayerStrip::CLayerStrip
+    (
+    wxWindow *parent,
+    wxWindowID id,
+    const wxPoint& pos,
+    const wxSize& size,
+    long style,
+    const wxString& name
+    )
+: wxPanel() // default constructor, because of SetBackgroundStyle()
+{
+SetBackgroundStyle(wxBG_STYLE_PAINT);
+Create(parent, id, pos, size, style, name);
+selLayer = 0;
+tipLayer = -1;
+bPaintObjects = false;
+for (int r = 0; r < MAXROWS; r++)
+  for (int c = 0; c < MAXCOLS; c++)
+    matrix2Key[r][c] = -1;
+szThumb = wxSize(0, 0);
+}
+
+/*****************************************************************************/
+/* SetLayout : sets up a new keyboard layout                                 */
+/*****************************************************************************/
+
+void CLayerStrip::SetLayout(KbdGui const &newlayout)
+{
+layout = newlayout;
+keys.clear();
+nextKey.clear();
+for (int r = 0; r < MAXROWS; r++)
+  for (int c = 0; c < MAXCOLS; c++)
+    matrix2Key[r][c] = -1;
+
+szThumb = CKbdWnd::CalcSize(layout, thumbZoom);
+CKbdWnd::KeyLayout kl;
+kl.state = CKbdWnd::ksUnpressed;
+kl.bDirty = false;
+kl.sprite = NULL;
+for (size_t i = 0; i < layout.size(); i++)
+  {
+  kl.def = &layout.GetKey(i);
+  if (!CKbdWnd::IsKeyShown(*kl.def))
+    continue;
+  kl.rects = CKbdWnd::GetKeyRects(*kl.def);
+  CKbdWnd::KeyGeometry kg = CKbdWnd::KeyGeometry();
+  CKbdWnd::CalcKeyGeometry(*kl.def, kl.rects, thumbZoom, kg);
+  kl.rect[0] = kg.rect[0];
+  kl.rect[1] = kg.rect[1];
+  kl.bounds = kg.bounds;
+  int row = kl.def->matrixrow, col = kl.def->matrixcol;
+  if (row >= 0 && row < MAXROWS && col >= 0 && col < MAXCOLS)
+    {
+    nextKey.push_back(matrix2Key[row][col]);
+    matrix2Key[row][col] = (int)keys.size();
+    }
+  else
+    nextKey.push_back(-1);
+  keys.push_back(kl);
+  }
+
+// the geometry changed, so all thumbnails have to be redrawn completely
+int nLayers = (int)thumbs.size();
+thumbs.clear();
+SetLayers(nLayers);
+}
+
+/*****************************************************************************/
+/* SetLayers : sets the number of layers                                     */
+/*****************************************************************************/
+
+void CLayerStrip::SetLayers(int nLayers)
+{
+nLayers = max(0, min(nLayers, NUMLAYERS_MAX));
+if (nLayers != (int)thumbs.size())
+  {
+  LayerThumb thumb;
+  thumb.state.assign(keys.size(), (wxUint8)tsUnknown);
+  thumb.bDirty.assign(keys.size(), false);
+  thumbs.resize(nLayers, thumb);
+  SetNewSize();
+  }
+// a layer count change normally comes with new contents, too
+InvalidateLayers();
+if (selLayer >= nLayers)
+  SetSelection(nLayers - 1);
+Refresh();
+}
+
+/*****************************************************************************/
+/* SetNewSize : adapts the window size to the number of thumbnails           */
+/*****************************************************************************/
+
+void CLayerStrip::SetNewSize()
+{
+int nLayers = (int)thumbs.size();
+wxSize szNew(thumbGap + nLayers * (szThumb.x + thumbGap),
+             szThumb.y + 2 * thumbGap);
+if (GetMinSize() != szNew)
+  {
+  SetMinSize(szNew);
+  if (GetParent())
+    GetParent()->Layout();
+  }
+}
+
+/*****************************************************************************/
+/* SetSelection : sets the highlighted layer                                 */
+/*****************************************************************************/
+
+void CLayerStrip::SetSelection(int layer)
+{
+if (layer == selLayer)
+  return;
+if (selLayer >= 0 && selLayer < (int)thumbs.size())
+  RefreshRect(GetThumbRect(selLayer).Inflate(thumbGap / 2));
+selLayer = layer;
+if (selLayer >= 0 && selLayer < (int)thumbs.size())
+  RefreshRect(GetThumbRect(selLayer).Inflate(thumbGap / 2));
+}
+
+/*****************************************************************************/
+/* InvalidateKey : marks the keys on a matrix position for redrawing         */
+/*****************************************************************************/
+
+void CLayerStrip::InvalidateKey(int layer, int row, int col)
+{
+if (layer < 0 || layer >= (int)thumbs.size() ||
+    row < 0 || row >= MAXROWS || col < 0 || col >= MAXCOLS)
+  return;
+LayerThumb &thumb = thumbs[layer];
+bool bFound = false;
+for (int i = matrix2Key[row][col]; i >= 0; i = nextKey[i])
+  {
+  MarkDirty(thumb, i);
+  bFound = true;
+  }
+if (bFound)
+  RefreshRect(GetThumbRect(layer));
+}
+
+/*****************************************************************************/
+/* InvalidateLayer : marks all keys of a layer for redrawing                 */
+/*****************************************************************************/
+
+void CLayerStrip::InvalidateLayer(int layer)
+{
+if (layer < 0 || layer >= (int)thumbs.size())
+  return;
+// only keys whose state really changed are redrawn in UpdateThumb()
+LayerThumb &thumb = thumbs[layer];
+for (int i = 0; i < (int)keys.size(); i++)
+  MarkDirty(thumb, i);
+RefreshRect(GetThumbRect(layer));
+}
+
+/*****************************************************************************/
+/* GetThumbRect : returns the position of a layer's thumbnail                */
+/*****************************************************************************/
+
+wxRect CLayerStrip::GetThumbRect(int layer)
+{
+return wxRect(thumbGap + layer * (szThumb.x + thumbGap), thumbGap,
+              szThumb.x, szThumb.y);
+}
+
+/*****************************************************************************/
+/* FindLayerAt : returns the layer whose thumbnail is at a position          */
+/*****************************************************************************/
+
+int CLayerStrip::FindLayerAt(wxPoint const &pt)
+{
+if (szThumb.x <= 0)
+  return -1;
+int layer = (pt.x - thumbGap) / (szThumb.x + thumbGap);
+if (pt.x < thumbGap || layer >= (int)thumbs.size() ||
+    !GetThumbRect(layer).Contains(pt))
+  return -1;
+return layer;
+}
+
+/*****************************************************************************/
+/* GetKeyState : returns how a key is assigned in a layer                    */
+/*****************************************************************************/
+
+int CLayerStrip::GetKeyState(int layer, GuiKey const &def)
+{
+KbdLayout &kbdLayout = GetApp()->GetLayout();
+KbdLayout &kbdDefault = GetApp()->GetDefaultLayout();
+int row = def.matrixrow, col = def.matrixcol;
+if (row < 0 || row >= kbdLayout.GetRows() ||
+    col < 0 || col >= kbdLayout.GetCols())
+  return tsDefault;                     /* not on the matrix, like LEDs      */
+if (layer >= kbdLayout.GetLayers())
+  return tsUnassigned;
+int key = kbdLayout.GetKey(layer, row, col);
+if (key == KB_NONE)
+  return tsUnassigned;
+if (kbdDefault.GetLayers() < 1 ||
+    row >= kbdDefault.GetRows() || col >= kbdDefault.GetCols() ||
+    key != kbdDefault.GetKey(0, row, col))
+  return tsChanged;
+return tsDefault;
+}
+
+/*****************************************************************************/
+/* SetupPaintObjects : creates the brushes and pens                          */
+/*****************************************************************************/
+
+void CLayerStrip::SetupPaintObjects()
+{
+wxColour clrBkgnd = wxSystemSettings::GetColour(wxSYS_COLOUR_FRAMEBK);
+wxColour clrKey = wxSystemSettings::GetColour(wxSYS_COLOUR_BTNFACE);
+// wxGTK3 can deliver "transparent nothingness" for system colours (sigh)
+if (!clrKey.GetRGBA())
+  clrKey = wxColour(230, 230, 230);
+brBack = wxBrush(clrBkgnd);
+penBack = wxPen(clrBkgnd);
+penSel = wxPen(wxSystemSettings::GetColour(wxSYS_COLOUR_HIGHLIGHT), 2);
+brKey[tsUnassigned] = brBack;
+penKey[tsUnassigned] = penBack;
+brKey[tsDefault] = wxBrush(clrKey);
+penKey[tsDefault] = wxPen(clrKey);
+brKey[tsChanged] = wxBrush(wxColour(THUMBCLR_CHANGED));
+penKey[tsChanged] = wxPen(wxColour(THUMBCLR_CHANGED));
+bPaintObjects = true;
+}
+
+/*****************************************************************************/
+/* UpdateThumb : redraws the dirty keys of a layer's thumbnail               */
+/*****************************************************************************/
+
+void CLayerStrip::UpdateThumb(int layer)
+{
+LayerThumb &thumb = thumbs[layer];
+if (!thumb.bmp.IsOk())
+  {
+  thumb.bmp.Create(szThumb.x, szThumb.y);
+  wxMemoryDC dc(thumb.bmp);
+  dc.SetBackground(brBack);
+  dc.Clear();
+  thumb.state.assign(keys.size(), (wxUint8)tsUnknown);
+  for (int i = 0; i < (int)keys.size(); i++)
+    MarkDirty(thumb, i);
+  }
+if (thumb.dirtyKeys.empty())
+  return;
+
+wxMemoryDC dc(thumb.bmp);
+for (size_t i = 0; i < thumb.dirtyKeys.size(); i++)
+  {
+  int k = thumb.dirtyKeys[i];
+  thumb.bDirty[k] = false;
+  int ts = GetKeyState(layer, *keys[k].def);
+  if (ts == thumb.state[k])             /* unchanged - nothing to draw       */
+    continue;
+  thumb.state[k] = (wxUint8)ts;
+  // no labels; they'd be unreadable at this size. No border either;
+  // keys are only 2 pixels high, so it would hide the state colour
+  CKbdWnd::KeyClrs clrs = { brKey[ts], brKey[tsDefault],
+                            penKey[ts], penKey[ts] };
+  CKbdWnd::DrawKey(dc, keys[k], clrs, wxEmptyString, labels);
+  }
+thumb.dirtyKeys.clear();
+dc.SelectObject(wxNullBitmap);
+}
+
+/*****************************************************************************/
+/* OnPaint : called to paint the window                                      */
+/*****************************************************************************/
+
+void CLayerStrip::OnPaint(wxPaintEvent &ev)
+{
+wxBufferedPaintDC dc(this);
+
+if (!bPaintObjects)
+  SetupPaintObjects();
+dc.SetBackground(brBack);
+dc.Clear();
+wxRect rcUpdate = GetUpdateRegion().GetBox();
+for (int i = 0; i < (int)thumbs.size(); i++)
+  {
+  wxRect rc = GetThumbRect(i);
+  if (!rcUpdate.Intersects(wxRect(rc).Inflate(thumbGap / 2)))
+    continue;
+  UpdateThumb(i);
+  dc.DrawBitmap(thumbs[i].bmp, rc.x, rc.y);
+  if (i == selLayer)
+    {
+    dc.SetBrush(*wxTRANSPARENT_BRUSH);
+    dc.SetPen(penSel);
+    dc.DrawRectangle(rc.Inflate(thumbGap / 2 - 1));
+    }
+  }
+}
+
+/*****************************************************************************/
+/* OnLButtonDown : called when the left mouse button is pressed              */
+/*****************************************************************************/
+
+void CLayerStrip::OnLButtonDown(wxMouseEvent& event)
+{
+int layer = FindLayerAt(event.GetPosition());
+if (layer < 0)
+  return;
+SetSelection(layer);
+wxCommandEvent ev(wxEVT_CHOICE, GetId());
+ev.SetEventObject(this);
+ev.SetInt(layer);
+HandleWindowEvent(ev);
+}
+
+/*****************************************************************************/
+/* OnMotion : called when the mouse moves over the window                    */
+/*****************************************************************************/
+
+void CLayerStrip::OnMotion(wxMouseEvent& event)
+{
+int layer = FindLayerAt(event.GetPosition());
+if (layer == tipLayer)
+  return;
+tipLayer = layer;
+if (layer < 0)
+  UnsetToolTip();
+else
+  SetToolTip(wxString::Format(wxT("Matrix Layer %d"), layer));
+}
@@ -0,0 +1,128 @@
+/*****************************************************************************/
+/* LayerStrip.h : overview strip with thumbnails of all layout layers        */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LayerStrip_h__included_
+#define _LayerStrip_h__included_
+
+#include "KbdGuiLayout.h"
+#include "KbdWnd.h"
+
+/*****************************************************************************/
+/* CLayerStrip : shows all layers of the current layout as thumbnails        */
+/*****************************************************************************/
+
+/*
+Each layer is drawn as a small keyboard, using the on-screen keyboard's
+geometry and drawing code; a key shows whether it's unassigned, has its
+default assignment or has been changed. The thumbnails are kept as
+bitmaps; changed keys are marked dirty, and only these are redrawn into
+the bitmap on the next paint.
+Clicking on a thumbnail sends a wxEVT_CHOICE command event with the
+layer number in its integer field.
+*/
+
+class CLayerStrip : public wxPanel
+{
+public:
+    enum
+      {
+      thumbZoom = 12,                   /* zoom factor of the thumbnails     */
+      thumbGap = 6                      /* space around the thumbnails       */
+      };
+    enum ThumbState
+      {
+      tsUnassigned,
+      tsDefault,
+      tsChanged,
+
+      tsStates,
+      tsUnknown = 0xff                  /* not drawn yet                     */
+      };
+    struct LayerThumb
+      {
+      wxBitmap bmp;
+      wxVector<wxUint8> state;          /* drawn state, by key index         */
+      wxVector<bool> bDirty;            /* by key index                      */
+      wxVector<int> dirtyKeys;          /* keys to redraw on the next paint  */
+      };
+
+public:
+    CLayerStrip(wxWindow *parent,
+                wxWindowID id = wxID_ANY,
+                const wxPoint& pos = wxDefaultPosition,
+                const wxSize& size = wxDefaultSize,
+                long style = 0,
+                const wxString& name = wxT("LayerStrip"));
+
+    void SetLayout(KbdGui const &newlayout);
+    int GetLayers() { return (int)thumbs.size(); }
+    void SetLayers(int nLayers);
+    int GetSelection() { return selLayer; }
+    void SetSelection(int layer);
+
+    void InvalidateKey(int layer, int row, int col);
+    void InvalidateLayer(int layer);
+    void InvalidateLayers()
+      {
+      for (int i = 0; i < (int)thumbs.size(); i++)
+        InvalidateLayer(i);
+      }
+
+private:
+    wxDECLARE_EVENT_TABLE();
+
+    void OnPaint(wxPaintEvent &ev);
+    void OnLButtonDown(wxMouseEvent& event);
+    void OnMotion(wxMouseEvent& event);
+
+protected:
+    void SetupPaintObjects();
+    wxRect GetThumbRect(int layer);
+    int FindLayerAt(wxPoint const &pt);
+    void MarkDirty(LayerThumb &thumb, int key)
+      {
+      if (thumb.bDirty[key])
+        return;
+      thumb.bDirty[key] = true;
+      thumb.dirtyKeys.push_back(key);
+      }
+    int GetKeyState(int layer, GuiKey const &def);
+    void UpdateThumb(int layer);
+    void SetNewSize();
+
+protected:
+    KbdGui layout;
+    wxSize szThumb;
+    wxVector<CKbdWnd::KeyLayout> keys;
+    // keys by matrix position; more than one key can be on a position
+    int matrix2Key[MAXROWS][MAXCOLS];
+    wxVector<int> nextKey;
+    wxVector<LayerThumb> thumbs;
+    int selLayer;
+    int tipLayer;                       /* layer the tooltip is for          */
+    CKbdWnd::KbdLabels labels;
+    // paint objects
+    bool bPaintObjects;
+    wxBrush brBack;
+    wxPen penBack, penSel;
+    wxBrush brKey[tsStates];
+    wxPen penKey[tsStates];
+};
+
+#endif // !defined(_LayerStrip_h__included_)
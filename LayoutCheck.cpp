@@ -0,0 +1,276 @@
+/*****************************************************************************/
+/* LayoutCheck.cpp : keyboard layout validation                              */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "wxStd.h"
+#include "layout.h"
+#include "LayoutCheck.h"
+
+/*===========================================================================*/
+/* KbdLayoutCheck class members                                              */
+/*===========================================================================*/
+
+/*****************************************************************************/
+/* Clear : reset to empty layout                                             */
+/*****************************************************************************/
+
+void KbdLayoutCheck::Clear()
+{
+layers = rows = cols = 0;
+memset(keys, 0, sizeof(keys));
+memset(momentary, 0, sizeof(momentary));
+memset(toggle, 0, sizeof(toggle));
+memset(noRelease, 0, sizeof(noRelease));
+problems.clear();
+bAnalyzed = true;
+}
+
+/*****************************************************************************/
+/* Reset : set up for a complete layout                                      */
+/*****************************************************************************/
+
+void KbdLayoutCheck::Reset(KbdLayout &layout)
+{
+Clear();
+layers = layout.GetLayers();
+rows = layout.GetRows();
+cols = layout.GetCols();
+int l, r, c;
+for (l = 0; l < layers; l++)
+  for (r = 0; r < rows; r++)
+    for (c = 0; c < cols; c++)
+      {
+      keys[l][r][c] = layout.GetKey(l, r, c);
+      AddKey(l, r, c, 1);
+      }
+for (r = 0; r < rows; r++)
+  for (c = 0; c < cols; c++)
+    CheckRelease(r, c);
+bAnalyzed = false;
+}
+
+/*****************************************************************************/
+/* Update : incremental check after one key has changed                      */
+/*****************************************************************************/
+
+void KbdLayoutCheck::Update(KbdLayout &layout, int layer, int row, int col)
+{
+if (layout.GetLayers() != layers ||     /* layout has been restructured?     */
+    layout.GetRows() != rows ||
+    layout.GetCols() != cols)
+  {
+  Reset(layout);
+  return;
+  }
+if (layer < 0 || layer >= layers ||
+    row < 0 || row >= rows ||
+    col < 0 || col >= cols)
+  return;
+
+MatrixKey key = layout.GetKey(layer, row, col);
+if (key == keys[layer][row][col])
+  return;
+AddKey(layer, row, col, -1);            /* remove old key's edge             */
+keys[layer][row][col] = key;
+AddKey(layer, row, col, 1);             /* add new key's edge                */
+CheckRelease(row, col);                 /* only this position is affected    */
+bAnalyzed = false;
+}
+
+/*****************************************************************************/
+/* GetTarget : returns target layer of a layer key, or -1                    */
+/*****************************************************************************/
+
+int KbdLayoutCheck::GetTarget(MatrixKey key, int &type)
+{
+type = key >> 8;
+if (type != TYPE_MOMENTARY && type != TYPE_TOGGLE)
+  return -1;
+int target = key & 0xff;
+return (target < NUMLAYERS_MAX) ? target : NUMLAYERS_MAX;
+}
+
+/*****************************************************************************/
+/* AddKey : add or remove the graph edge for a key                           */
+/*****************************************************************************/
+
+void KbdLayoutCheck::AddKey(int layer, int row, int col, int delta)
+{
+int type;
+int target = GetTarget(keys[layer][row][col], type);
+if (target < 0)
+  return;
+if (type == TYPE_MOMENTARY)
+  momentary[layer][target] += delta;
+else
+  toggle[layer][target] += delta;
+}
+
+/*****************************************************************************/
+/* CheckRelease : check momentary layer keys at a matrix position            */
+/*****************************************************************************/
+
+void KbdLayoutCheck::CheckRelease(int row, int col)
+{
+wxUint8 bits = 0;
+for (int l = 0; l < layers; l++)
+  {
+  int type;
+  MatrixKey key = keys[l][row][col];
+  int target = GetTarget(key, type);
+  if (type == TYPE_MOMENTARY &&
+      target >= 0 && target < layers && target != l &&
+      keys[target][row][col] != key)
+    bits |= (1 << l);
+  }
+noRelease[row][col] = bits;
+}
+
+/*****************************************************************************/
+/* Analyze : analyze the layer graph                                         */
+/*****************************************************************************/
+
+void KbdLayoutCheck::Analyze()
+{
+if (bAnalyzed)
+  return;
+problems.clear();
+
+int l, t, r, c;
+Problem p;
+for (l = 0; l < layers; l++)            /* keys to nonexisting layers        */
+  for (t = layers; t <= NUMLAYERS_MAX; t++)
+    if (momentary[l][t] || toggle[l][t])
+      {
+      p.type = ptBadTarget;
+      p.layer = l;
+      p.target = (t < NUMLAYERS_MAX) ? t : -1;
+      p.row = p.col = -1;
+      problems.push_back(p);
+      }
+
+for (r = 0; r < rows; r++)              /* momentary keys without release    */
+  for (c = 0; c < cols; c++)
+    if (noRelease[r][c])
+      for (l = 0; l < layers; l++)
+        if (noRelease[r][c] & (1 << l))
+          {
+          int type;
+          p.type = ptNoRelease;
+          p.layer = l;
+          p.target = GetTarget(keys[l][r][c], type);
+          p.row = r;
+          p.col = c;
+          problems.push_back(p);
+          }
+
+// edges between existing layers; a momentary switch implies a way back
+bool edge[NUMLAYERS_MAX][NUMLAYERS_MAX] = { { false } };
+for (l = 0; l < layers; l++)
+  for (t = 0; t < layers; t++)
+    {
+    if (t == l)
+      {
+      if (toggle[l][l])                 /* toggles the active layer off      */
+        edge[l][0] = true;
+      continue;
+      }
+    if (toggle[l][t])
+      edge[l][t] = true;
+    if (momentary[l][t])
+      edge[l][t] = edge[t][l] = true;
+    }
+
+bool reached[NUMLAYERS_MAX] = { false };
+bool returns[NUMLAYERS_MAX] = { false };
+if (layers > 0)
+  reached[0] = returns[0] = true;
+bool bChanged = true;
+while (bChanged)                        /* propagate until stable            */
+  {
+  bChanged = false;
+  for (l = 0; l < layers; l++)
+    for (t = 0; t < layers; t++)
+      if (edge[l][t])
+        {
+        if (reached[l] && !reached[t])
+          reached[t] = bChanged = true;
+        if (returns[t] && !returns[l])
+          returns[l] = bChanged = true;
+        }
+  }
+
+for (l = 1; l < layers; l++)
+  {
+  p.layer = l;
+  p.target = 0;
+  p.row = p.col = -1;
+  if (!reached[l])
+    {
+    p.type = ptUnreachable;
+    problems.push_back(p);
+    }
+  else if (!returns[l])
+    {
+    p.type = ptTrap;
+    problems.push_back(p);
+    }
+  }
+
+bAnalyzed = true;
+}
+
+/*****************************************************************************/
+/* GetProblemText : returns a descriptive text for a problem                 */
+/*****************************************************************************/
+
+wxString KbdLayoutCheck::GetProblemText(int n)
+{
+Problem const &p = GetProblem(n);
+switch (p.type)
+  {
+  case ptBadTarget :
+    if (p.target < 0)
+      return wxString::Format(wxT("Layer %d: layer key to invalid layer"),
+                              p.layer);
+    return wxString::Format(wxT("Layer %d: layer key to nonexisting layer %d"),
+                            p.layer, p.target);
+  case ptNoRelease :
+    return wxString::Format(wxT("Layer %d, row %d, col %d: layer %d lacks the same key to return"),
+                            p.layer, p.row, p.col, p.target);
+  case ptUnreachable :
+    return wxString::Format(wxT("Layer %d can't be reached"), p.layer);
+  case ptTrap :
+    return wxString::Format(wxT("Layer %d has no way back to layer 0"), p.layer);
+  }
+return wxEmptyString;
+}
+
+/*****************************************************************************/
+/* GetSummary : returns a one-line summary                                   */
+/*****************************************************************************/
+
+wxString KbdLayoutCheck::GetSummary()
+{
+int nProblems = GetProblems();
+if (!nProblems)
+  return wxT("Layout OK");
+wxString s = (nProblems == 1) ? wxString(wxT("1 layout problem: ")) :
+             wxString::Format(wxT("%d layout problems: "), nProblems);
+return s + GetProblemText(0);
+}
@@ -0,0 +1,98 @@
+/*****************************************************************************/
+/* LayoutCheck.h : keyboard layout validation                                */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LayoutCheck_h__included_
+#define _LayoutCheck_h__included_
+
+#include "KbdGuiLayout.h"
+
+/*****************************************************************************/
+/* KbdLayoutCheck : layer transition graph and problem detection             */
+/*****************************************************************************/
+
+/*
+The layer keys form a graph between the layers:
+- MLAYER_n on layer x switches to layer n while held; releasing it
+  returns to layer x. The firmware looks up the release in layer n,
+  so the same position on layer n has to contain MLAYER_n as well,
+  or the keyboard is stuck in layer n.
+- TLAYER_n on layer x toggles to layer n; TLAYER_n on layer n
+  toggles back to layer 0.
+Problems reported:
+- layer keys addressing layers beyond the current layer count
+- momentary layer keys without the release key on the target layer
+- layers that can't be reached from layer 0
+- reachable layers that have no way back to layer 0
+
+The checker keeps its own copy of the layer keys and the edge counts
+of the graph, so a single key change only needs to update the edges
+of that key and the release check of that matrix position. The graph
+itself has at most NUMLAYERS_MAX nodes, so its analysis is cheap.
+*/
+
+class KbdLayoutCheck
+  {
+  public:
+    enum ProblemType
+      {
+      ptBadTarget,                      /* layer key to nonexisting layer    */
+      ptNoRelease,                      /* momentary key can't be released   */
+      ptUnreachable,                    /* layer can't be reached            */
+      ptTrap,                           /* no way back to layer 0            */
+      };
+    struct Problem
+      {
+      int type;
+      int layer;
+      int target;                       /* target layer, or -1               */
+      int row, col;                     /* matrix position, or -1            */
+      };
+
+    KbdLayoutCheck() { Clear(); }
+
+    void Clear();
+    void Reset(KbdLayout &layout);      /* full check                        */
+    void Update(KbdLayout &layout,      /* incremental check for one key     */
+                int layer, int row, int col);
+
+    int GetProblems()
+      { Analyze(); return (int)problems.size(); }
+    Problem const &GetProblem(int n)
+      { Analyze(); return problems[n]; }
+    wxString GetProblemText(int n);
+    wxString GetSummary();
+
+  protected:
+    static int GetTarget(MatrixKey key, int &type);
+    void AddKey(int layer, int row, int col, int delta);
+    void CheckRelease(int row, int col);
+    void Analyze();
+
+  protected:
+    int layers, rows, cols;
+    MatrixKey keys[NUMLAYERS_MAX][MAXROWS][MAXCOLS];
+    // [from][to] key counts; [from][NUMLAYERS_MAX] counts invalid targets
+    int momentary[NUMLAYERS_MAX][NUMLAYERS_MAX + 1];
+    int toggle[NUMLAYERS_MAX][NUMLAYERS_MAX + 1];
+    wxUint8 noRelease[MAXROWS][MAXCOLS];  /* bit n: layer n key not released */
+    bool bAnalyzed;
+    wxVector<Problem> problems;
+  };
+
+#endif // !defined(_LayoutCheck_h__included_)
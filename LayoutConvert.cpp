@@ -0,0 +1,274 @@
+/*****************************************************************************/
+/* LayoutConvert.cpp : batch conversion of layout files                      */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "wxStd.h"
+#include "layout.h"
+#include "LayoutConvert.h"
+
+#include "wx/thread.h"
+
+/*****************************************************************************/
+/* CConvertJob : one file to convert                                         */
+/*****************************************************************************/
+
+struct CConvertJob
+  {
+  wxString srcFile, tgtFile;
+  wxLongLong_t size;
+  int result;                           /* KbdConverter::Result              */
+  };
+
+/*****************************************************************************/
+/* CConvertWorker : worker thread that converts files                        */
+/*****************************************************************************/
+
+class CConvertWorker : public wxThread
+  {
+  public:
+    CConvertWorker
+        (
+        KbdConverter const &conv,
+        wxVector<CConvertJob> &jobs,
+        size_t &next,
+        wxCriticalSection &cs
+        )
+      : wxThread(wxTHREAD_JOINABLE), conv(conv), jobs(jobs), next(next), cs(cs)
+      { }
+
+    static void ConvertFiles
+        (
+        KbdConverter const &conv,
+        wxVector<CConvertJob> &jobs,
+        size_t &next,
+        wxCriticalSection &cs
+        )
+      {
+      for (;;)
+        {
+        size_t n;
+          {
+          wxCriticalSectionLocker lock(cs);
+          n = next++;
+          }
+        if (n >= jobs.size())
+          break;
+        jobs[n].result = conv.ConvertFile(jobs[n].srcFile, jobs[n].tgtFile);
+        }
+      }
+
+  protected:
+    virtual ExitCode Entry()
+      {
+      ConvertFiles(conv, jobs, next, cs);
+      return 0;
+      }
+
+  protected:
+    KbdConverter const &conv;
+    wxVector<CConvertJob> &jobs;
+    size_t &next;
+    wxCriticalSection &cs;
+  };
+
+/*===========================================================================*/
+/* KbdConverter class members                                                */
+/*===========================================================================*/
+
+/*****************************************************************************/
+/* Reset : reset the statistics                                              */
+/*****************************************************************************/
+
+void KbdConverter::Reset()
+{
+nConverted = 0;
+failed.Clear();
+cut.Clear();
+nBytes = 0;
+msTime = 0;
+}
+
+/*****************************************************************************/
+/* HasKeysBeyond : check whether a layout uses columns from tgtcols on       */
+/*****************************************************************************/
+
+static bool HasKeysBeyond(KbdLayout &layout, int tgtcols)
+{
+for (int l = 0; l < layout.GetLayers(); l++)
+  for (int r = 0; r < layout.GetRows(); r++)
+    for (int c = tgtcols; c < layout.GetCols(); c++)
+      if (layout.GetKey(l, r, c) != KB_NONE)
+        return true;
+return false;
+}
+
+/*****************************************************************************/
+/* ConvertFile : convert a single file                                       */
+/*****************************************************************************/
+
+int KbdConverter::ConvertFile
+    (
+    wxString const &srcFile,
+    wxString const &tgtFile
+    ) const
+{
+wxLogNull noLog;                        /* failures are collected instead    */
+KbdLayout layout;
+if (!layout.ReadFile(srcFile))
+  return resFailed;
+bool bCut = HasKeysBeyond(layout, tgtcols);
+if (bCut && !bForce)
+  return resCut;
+
+// the target is only replaced by a complete file; this also keeps the
+// source intact if it's converted in place and writing fails
+wxString tmpFile = tgtFile + wxT(".tmp");
+if (!layout.WriteFile(tmpFile, format == fmtBinary,
+                      NUMROWS, tgtcols, bSparse,
+                      format != fmtDecimal) ||
+    !wxRenameFile(tmpFile, tgtFile, true))
+  {
+  wxRemoveFile(tmpFile);
+  return resFailed;
+  }
+return bCut ? resCut : resOK;
+}
+
+/*****************************************************************************/
+/* Convert : convert all matching files in a directory tree                  */
+/*****************************************************************************/
+
+int KbdConverter::Convert
+    (
+    wxString const &srcDir,
+    wxString const &tgtDir,
+    wxString const &filespec,
+    int nThreads
+    )
+{
+Reset();
+wxStopWatch sw;
+wxString srcBase = wxFileName::DirName(srcDir).GetFullPath();
+wxString tgtBase = wxFileName::DirName(tgtDir).GetFullPath();
+wxArrayString found;
+if (wxDir::Exists(srcBase))
+  wxDir::GetAllFiles(srcBase, &found, filespec);
+found.Sort();
+
+// target directories are created up front, so the workers only have
+// to deal with their files
+wxVector<CConvertJob> jobs;
+jobs.reserve(found.size());
+wxString lastDir;
+for (size_t i = 0; i < found.size(); i++)
+  {
+  CConvertJob job;
+  job.srcFile = found[i];
+  job.tgtFile = tgtBase + found[i].Mid(srcBase.size());
+  wxStructStat st;
+  job.size = (wxStat(job.srcFile, &st) == 0) ? (wxLongLong_t)st.st_size : 0;
+  job.result = resFailed;
+  wxString dir = wxFileName(job.tgtFile).GetPath();
+  if (dir != lastDir &&
+      !wxFileName::Mkdir(dir, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL))
+    {
+    failed.Add(job.srcFile);
+    continue;
+    }
+  lastDir = dir;
+  jobs.push_back(job);
+  }
+
+if (jobs.size())
+  {
+  if (nThreads <= 0)
+    nThreads = wxThread::GetCPUCount();
+  nThreads = max(1, min(nThreads, (int)jobs.size()));
+  size_t next = 0;
+  wxCriticalSection cs;
+  wxVector<CConvertWorker *> workers;
+  for (int i = 1; i < nThreads; i++)    /* this thread is the first worker   */
+    {
+    CConvertWorker *pWorker = new CConvertWorker(*this, jobs, next, cs);
+    if (pWorker->Run() != wxTHREAD_NO_ERROR)
+      {
+      delete pWorker;
+      break;
+      }
+    workers.push_back(pWorker);
+    }
+  CConvertWorker::ConvertFiles(*this, jobs, next, cs);
+  for (size_t i = 0; i < workers.size(); i++)
+    {
+    workers[i]->Wait();
+    delete workers[i];
+    }
+  }
+
+for (size_t i = 0; i < jobs.size(); i++)
+  {
+  if (jobs[i].result == resFailed)
+    {
+    failed.Add(jobs[i].srcFile);
+    continue;
+    }
+  if (jobs[i].result == resCut)
+    {
+    cut.Add(jobs[i].srcFile);
+    if (!bForce)                        /* not converted                     */
+      continue;
+    }
+  nConverted++;
+  nBytes += jobs[i].size;
+  }
+msTime = sw.Time();
+return nConverted;
+}
+
+/*****************************************************************************/
+/* GetReport : get a summary of the last conversion                          */
+/*****************************************************************************/
+
+wxString KbdConverter::GetReport() const
+{
+double secs = max(msTime, 1L) / 1000.;
+wxString s = wxString::Format(wxT("%d files (%") wxLongLongFmtSpec wxT("d bytes)")
+                              wxT(" converted in %.3f seconds")
+                              wxT(" (%.0f files/s, %.2f MB/s)"),
+                              nConverted, nBytes, msTime / 1000.,
+                              nConverted / secs,
+                              nBytes / secs / (1024. * 1024.));
+if (failed.size())
+  {
+  s += wxString::Format(wxT("\n%d files could not be converted:"),
+                        (int)failed.size());
+  for (size_t i = 0; i < failed.size(); i++)
+    s += wxT("\n  ") + failed[i];
+  }
+if (cut.size())
+  {
+  s += wxString::Format(bForce ?
+                            wxT("\n%d files lost their keys in columns %d and up:") :
+                            wxT("\n%d files have keys in columns %d and up and were ")
+                            wxT("not converted (use --force to convert them anyway):"),
+                        (int)cut.size(), tgtcols);
+  for (size_t i = 0; i < cut.size(); i++)
+    s += wxT("\n  ") + cut[i];
+  }
+return s;
+}
@@ -0,0 +1,92 @@
+/*****************************************************************************/
+/* LayoutConvert.h : batch conversion of layout files                        */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LayoutConvert_h__included_
+#define _LayoutConvert_h__included_
+
+#include "KbdGuiLayout.h"
+
+/*****************************************************************************/
+/* KbdConverter : converts directories of layout files                       */
+/*****************************************************************************/
+
+/*
+Every layout file in the source directory (and its subdirectories) is
+read with KbdLayout::ReadFile() and written to the same relative
+location below the target directory with KbdLayout::WriteFile(), using
+the target format and matrix width. Source and target directory can be
+the same; files are converted in place then. Each file is written to a
+temporary file first, which replaces the target only if it's complete.
+Files that have keys in columns that don't fit into the target width are
+not converted, unless that's forced; either way, they are reported.
+The files are distributed over several threads; files that can't be
+converted are collected, and the rest is converted nevertheless.
+*/
+
+class KbdConverter
+  {
+  public:
+    enum Format
+      {
+      fmtBinary,                        /* compact binary                    */
+      fmtHex,                           /* Joern's text format, hexadecimal  */
+      fmtDecimal                        /* Joern's text format, decimal      */
+      };
+    enum Result
+      {
+      resOK,                            /* converted                         */
+      resFailed,                        /* not converted                     */
+      resCut,                           /* keys outside the target width;    */
+                                        /* converted only if forced          */
+      };
+
+    KbdConverter(int format = fmtBinary, int tgtcols = NUMCOLS,
+                 bool bSparse = false, bool bForce = false)
+      : format(format), tgtcols(tgtcols), bSparse(bSparse), bForce(bForce)
+      { Reset(); }
+
+    void Reset();
+    // returns the number of converted files
+    int Convert(wxString const &srcDir, wxString const &tgtDir,
+                wxString const &filespec = wxT("*.blu"), int nThreads = 0);
+    int ConvertFile(wxString const &srcFile, wxString const &tgtFile) const;
+
+    int GetConverted() const { return nConverted; }
+    wxArrayString const &GetFailed() const { return failed; }
+    // files with keys outside the target width; skipped unless forced
+    wxArrayString const &GetCut() const { return cut; }
+    bool IsComplete() const
+      { return failed.empty() && (bForce || cut.empty()); }
+    wxLongLong_t GetBytes() const { return nBytes; }
+    long GetTime() const { return msTime; }    /* in milliseconds            */
+    wxString GetReport() const;
+
+  protected:
+    int format;
+    int tgtcols;
+    bool bSparse;
+    bool bForce;
+    int nConverted;
+    wxArrayString failed;
+    wxArrayString cut;
+    wxLongLong_t nBytes;                /* size of the converted files       */
+    long msTime;
+  };
+
+#endif // !defined(_LayoutConvert_h__included_)
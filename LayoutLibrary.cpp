@@ -0,0 +1,537 @@
+/*****************************************************************************/
+/* LayoutLibrary.cpp : indexed library of layout files                       */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "wxStd.h"
+#include "layout.h"
+#include "Profile.h"
+#include "LayoutLibrary.h"
+
+#include "wx/thread.h"
+
+/*===========================================================================*/
+/* Library index file format                                                 */
+/*===========================================================================*/
+
+// All values are 32-bit little-endian, like in the compiled GUI layouts;
+// an index that can't be used simply causes a full rescan.
+
+#define KLI_MAGIC      "KLI1"
+#define KLI_BYTEORDER  0x01020304
+
+struct KliHeader                        /* all values little-endian          */
+  {
+  char magic[4];                        /* KLI_MAGIC                         */
+  wxUint32 byteOrder;                   /* KLI_BYTEORDER                     */
+  wxUint32 nFiles;                      /* number of file records            */
+  };
+
+struct KliFile                          /* followed by path, name, codes     */
+  {
+  wxUint32 mtime[2];                    /* modification time lo/hi           */
+  wxUint32 size[2];                     /* file size lo/hi                   */
+  wxInt32 type;
+  wxInt32 layers, rows, cols, macros;
+  wxInt32 keys;
+  wxUint32 pathLen, nameLen;            /* UTF-8 lengths                     */
+  wxUint32 nCodes;
+  };
+
+/*****************************************************************************/
+/* SwapKliFile : convert a file record between LE and native byte order      */
+/*****************************************************************************/
+
+static void SwapKliFile(KliFile &kf)
+{
+wxUint32 *v = (wxUint32 *)&kf;
+for (size_t i = 0; i < sizeof(kf) / sizeof(wxUint32); i++)
+  v[i] = wxUINT32_SWAP_ON_BE(v[i]);
+}
+
+static const wxChar *libraryExts[] =
+  {
+  wxT("*.blu"),
+  wxT("*.kbl"),
+  wxT("*.bpf"),
+  };
+
+/*****************************************************************************/
+/* GetFileState : get a file's modification time and size                    */
+/*****************************************************************************/
+
+static bool GetFileState
+    (
+    wxString const &filename,
+    wxLongLong_t &mtime,
+    wxLongLong_t &size
+    )
+{
+wxStructStat st;
+if (wxStat(filename, &st) != 0)
+  return false;
+mtime = (wxLongLong_t)st.st_mtime;
+size = (wxLongLong_t)st.st_size;
+return true;
+}
+
+/*****************************************************************************/
+/* CLibraryReader : worker thread that reads library files                   */
+/*****************************************************************************/
+
+// All readers take the next unread file from the same list, so the load
+// is spread evenly regardless of the file sizes.
+
+class CLibraryReader : public wxThread
+  {
+  public:
+    CLibraryReader
+        (
+        wxVector<KbdLibrary::FileInfo> &files,
+        size_t &next,
+        wxCriticalSection &cs
+        )
+      : wxThread(wxTHREAD_JOINABLE), files(files), next(next), cs(cs)
+      { }
+
+    static void ReadFiles
+        (
+        wxVector<KbdLibrary::FileInfo> &files,
+        size_t &next,
+        wxCriticalSection &cs
+        )
+      {
+      for (;;)
+        {
+        size_t n;
+          {
+          wxCriticalSectionLocker lock(cs);
+          n = next++;
+          }
+        if (n >= files.size())
+          break;
+        KbdLibrary::ReadFileInfo(files[n]);
+        }
+      }
+
+  protected:
+    virtual ExitCode Entry()
+      {
+      ReadFiles(files, next, cs);
+      return 0;
+      }
+
+  protected:
+    wxVector<KbdLibrary::FileInfo> &files;
+    size_t &next;
+    wxCriticalSection &cs;
+  };
+
+/*===========================================================================*/
+/* KbdLibrary class members                                                  */
+/*===========================================================================*/
+
+/*****************************************************************************/
+/* AddGuiCodes : add the keys of a GUI layout to a code list                 */
+/*****************************************************************************/
+
+void KbdLibrary::AddGuiCodes(KbdGui const &gui, wxVector<wxUint32> &codes)
+{
+for (size_t i = 0; i < gui.size(); i++)
+  {
+  GuiKey const &key = gui.GetKey((int)i);
+  if (key.hidcode > KB_NONE && key.hidcode <= 0xffff &&
+      key.matrixrow >= 0 && key.matrixrow < MAXROWS &&
+      key.matrixcol >= 0 && key.matrixcol < MAXCOLS)
+    codes.push_back(MakeCode(key.hidcode, guiLayer,
+                             key.matrixrow, key.matrixcol));
+  }
+}
+
+/*****************************************************************************/
+/* ReadFileInfo : read a file's metadata and keys                            */
+/*****************************************************************************/
+
+void KbdLibrary::ReadFileInfo(FileInfo &fi)
+{
+wxLogNull noLog;                        /* unreadable files are just skipped */
+fi.name.clear();
+fi.type = 0;
+fi.layers = fi.rows = fi.cols = fi.macros = fi.keys = 0;
+fi.codes.clear();
+
+wxString ext = fi.path.AfterLast(wxT('.')).Lower();
+if (ext == wxT("kbl"))
+  {
+  KbdGui gui;
+  if (!gui.ReadLayoutFile(fi.path))
+    return;
+  fi.type = ftGui;
+  fi.name = gui.GetName();
+  fi.keys = (int)gui.size();
+  gui.GetMatrixLayout(fi.rows, fi.cols);
+  AddGuiCodes(gui, fi.codes);
+  }
+else
+  {
+  KbdLayout layout;
+  KbdProfile profile;
+  KbdLayout *pLayout = &layout;
+  if (ext == wxT("bpf"))
+    {
+    if (!profile.ReadFile(fi.path, KbdProfile::secAll))
+      return;
+    fi.type = ftProfile;
+    fi.name = profile.GetName();
+    pLayout = &profile.GetLayout();
+    }
+  else
+    {
+    if (!layout.ReadFile(fi.path))
+      return;
+    fi.type = ftLayout;
+    fi.name = wxFileName(fi.path).GetName();
+    }
+  fi.layers = pLayout->GetLayers();
+  fi.rows = pLayout->GetRows();
+  fi.cols = pLayout->GetCols();
+  fi.macros = pLayout->GetMacros();
+  for (int l = 0; l < fi.layers && l < NUMLAYERS_MAX; l++)
+    for (int r = 0; r < fi.rows; r++)
+      for (int c = 0; c < fi.cols; c++)
+        {
+        int k = pLayout->GetKey(l, r, c);
+        if (k != KB_NONE)               /* empty positions aren't indexed    */
+          fi.codes.push_back(MakeCode(k, l, r, c));
+        }
+  if (profile.HasSection(KbdProfile::secGui))
+    {
+    KbdGui const &gui = profile.GetGui();
+    fi.keys = (int)gui.size();
+    AddGuiCodes(gui, fi.codes);
+    }
+  }
+wxVectorSort(fi.codes);
+}
+
+/*****************************************************************************/
+/* IsBelow : returns whether a path is in one of the given directories       */
+/*****************************************************************************/
+
+static bool IsBelow(wxString const &path, wxArrayString const &dirs)
+{
+for (size_t i = 0; i < dirs.size(); i++)
+  if (path.StartsWith(dirs[i]))
+    return true;
+return false;
+}
+
+/*****************************************************************************/
+/* Scan : scan directories for changed files and update the index            */
+/*****************************************************************************/
+
+int KbdLibrary::Scan(wxArrayString const &dirs, int nThreads)
+{
+wxArrayString found, scanned;
+for (size_t i = 0; i < dirs.size(); i++)
+  {
+  wxString dir(dirs[i]);                /* entries below that are refreshed  */
+  if (dir.size() && !wxFileName::IsPathSeparator(dir.Last()))
+    dir += wxFILE_SEP_PATH;
+  scanned.Add(dir);
+  if (!wxDir::Exists(dirs[i]))
+    continue;
+  for (int j = 0; j < _countof(libraryExts); j++)
+    wxDir::GetAllFiles(dirs[i], &found, libraryExts[j]);
+  }
+found.Sort();
+
+// keep everything that's unchanged or outside the scanned directories,
+// drop what has vanished from them, collect the rest for reading
+wxVector<FileInfo> newFiles, toRead;
+wxVector<int> toReadPos;
+size_t oldPos = 0;
+for (size_t i = 0; i < found.size(); i++)
+  {
+  if (i && found[i] == found[i - 1])    /* directories may overlap           */
+    continue;
+  FileInfo fi;
+  if (!GetFileState(found[i], fi.mtime, fi.size))
+    continue;
+  fi.path = found[i];
+  for (; oldPos < files.size() && files[oldPos].path < fi.path; oldPos++)
+    if (!IsBelow(files[oldPos].path, scanned))
+      newFiles.push_back(files[oldPos]);
+  if (oldPos < files.size() && files[oldPos].path == fi.path &&
+      files[oldPos].mtime == fi.mtime && files[oldPos].size == fi.size)
+    newFiles.push_back(files[oldPos++]);
+  else
+    {
+    toReadPos.push_back((int)newFiles.size());
+    newFiles.push_back(fi);
+    toRead.push_back(fi);
+    }
+  if (oldPos < files.size() && files[oldPos].path == fi.path)
+    oldPos++;                           /* replaced by the new one           */
+  }
+for (; oldPos < files.size(); oldPos++)
+  if (!IsBelow(files[oldPos].path, scanned))
+    newFiles.push_back(files[oldPos]);
+
+if (toRead.size())
+  {
+  if (nThreads <= 0)
+    nThreads = wxThread::GetCPUCount();
+  nThreads = max(1, min(nThreads, (int)toRead.size()));
+  size_t next = 0;
+  wxCriticalSection cs;
+  wxVector<CLibraryReader *> readers;
+  for (int i = 1; i < nThreads; i++)    /* this thread is the first reader   */
+    {
+    CLibraryReader *pReader = new CLibraryReader(toRead, next, cs);
+    if (pReader->Run() != wxTHREAD_NO_ERROR)
+      {
+      delete pReader;
+      break;
+      }
+    readers.push_back(pReader);
+    }
+  CLibraryReader::ReadFiles(toRead, next, cs);
+  for (size_t i = 0; i < readers.size(); i++)
+    {
+    readers[i]->Wait();
+    delete readers[i];
+    }
+  for (size_t i = 0; i < toRead.size(); i++)
+    newFiles[toReadPos[i]] = toRead[i];
+  }
+
+files.swap(newFiles);
+BuildIndex();
+return (int)toRead.size();
+}
+
+/*****************************************************************************/
+/* BuildIndex : build the inverted index from the file infos                 */
+/*****************************************************************************/
+
+void KbdLibrary::BuildIndex()
+{
+size_t total = 0;
+for (size_t i = 0; i < files.size(); i++)
+  total += files[i].codes.size();
+index.clear();
+index.reserve(total);
+for (size_t i = 0; i < files.size(); i++)
+  for (size_t j = 0; j < files[i].codes.size(); j++)
+    {
+    IndexEntry ie;
+    ie.code = files[i].codes[j];
+    ie.file = (int)i;
+    index.push_back(ie);
+    }
+wxVectorSort(index);
+}
+
+/*****************************************************************************/
+/* MatchesInfo : check whether a file's metadata match a query               */
+/*****************************************************************************/
+
+bool KbdLibrary::MatchesInfo(Query const &q, FileInfo const &fi) const
+{
+if (!(fi.type & q.types))
+  return false;
+if ((q.rows >= 0 && fi.rows != q.rows) ||
+    (q.cols >= 0 && fi.cols != q.cols))
+  return false;
+if (!q.name.empty())
+  {
+  wxString name = q.name.Lower();
+  if (fi.name.Lower().Find(name) == wxNOT_FOUND &&
+      fi.path.Lower().Find(name) == wxNOT_FOUND)
+    return false;
+  }
+return true;
+}
+
+/*****************************************************************************/
+/* Find : find all files matching a query                                    */
+/*****************************************************************************/
+
+int KbdLibrary::Find(Query const &q, wxArrayInt &found) const
+{
+found.clear();
+if (q.key < 0)                          /* no key - only metadata to check   */
+  {
+  for (size_t i = 0; i < files.size(); i++)
+    if (MatchesInfo(q, files[i]))
+      found.Add((int)i);
+  return (int)found.size();
+  }
+
+wxUint32 first = (wxUint32)q.key << 16;
+size_t lo = 0, hi = index.size();       /* find first entry for the key      */
+while (lo < hi)
+  {
+  size_t mid = (lo + hi) / 2;
+  if (index[mid].code < first)
+    lo = mid + 1;
+  else
+    hi = mid;
+  }
+wxVector<bool> matched(files.size(), false);
+for (; lo < index.size() && (int)(index[lo].code >> 16) == q.key; lo++)
+  {
+  IndexEntry const &ie = index[lo];
+  if (matched[ie.file])
+    continue;
+  int pos = (int)(ie.code & 0xffff);
+  if ((q.layer >= 0 && pos / (MAXROWS * MAXCOLS) != q.layer) ||
+      (q.row >= 0 && (pos / MAXCOLS) % MAXROWS != q.row) ||
+      (q.col >= 0 && pos % MAXCOLS != q.col))
+    continue;
+  if (MatchesInfo(q, files[ie.file]))
+    matched[ie.file] = true;
+  }
+for (size_t i = 0; i < matched.size(); i++)
+  if (matched[i])
+    found.Add((int)i);
+return (int)found.size();
+}
+
+/*****************************************************************************/
+/* LoadIndex : load a previously saved library index                         */
+/*****************************************************************************/
+
+bool KbdLibrary::LoadIndex(wxString const &filename)
+{
+Clear();
+wxFile f;
+if (!wxFileExists(filename) || !f.Open(filename))
+  return false;
+wxFileOffset flen = f.Length();
+if (flen < (wxFileOffset)sizeof(KliHeader) || flen > 0x10000000)
+  return false;
+wxMemoryBuffer mb;
+mb.SetBufSize((size_t)flen);
+if (f.Read(mb.GetData(), (size_t)flen) != (ssize_t)flen)
+  return false;
+
+const wxUint8 *p = (const wxUint8 *)mb.GetData();
+const wxUint8 *end = p + (size_t)flen;
+const KliHeader *hdr = (const KliHeader *)p;
+if (memcmp(hdr->magic, KLI_MAGIC, sizeof(hdr->magic)) ||
+    wxUINT32_SWAP_ON_BE(hdr->byteOrder) != KLI_BYTEORDER)
+  return false;
+wxUint32 nFiles = wxUINT32_SWAP_ON_BE(hdr->nFiles);
+p += sizeof(KliHeader);
+
+wxVector<FileInfo> loaded;
+loaded.reserve(min(nFiles, (wxUint32)((end - p) / sizeof(KliFile))));
+for (wxUint32 i = 0; i < nFiles; i++)
+  {
+  KliFile kf;
+  if ((size_t)(end - p) < sizeof(kf))
+    return false;
+  memcpy(&kf, p, sizeof(kf));
+  SwapKliFile(kf);
+  p += sizeof(kf);
+  if (kf.pathLen > (size_t)(end - p) ||
+      kf.nameLen > (size_t)(end - p) - kf.pathLen ||
+      kf.nCodes > ((size_t)(end - p) - kf.pathLen - kf.nameLen) / sizeof(wxUint32))
+    return false;
+  FileInfo fi;
+  fi.mtime = (wxLongLong_t)(((wxUint64)kf.mtime[1] << 32) | kf.mtime[0]);
+  fi.size = (wxLongLong_t)(((wxUint64)kf.size[1] << 32) | kf.size[0]);
+  fi.type = kf.type;
+  fi.layers = kf.layers;
+  fi.rows = kf.rows;
+  fi.cols = kf.cols;
+  fi.macros = kf.macros;
+  fi.keys = kf.keys;
+  fi.path = wxString::FromUTF8((const char *)p, kf.pathLen);
+  p += kf.pathLen;
+  fi.name = wxString::FromUTF8((const char *)p, kf.nameLen);
+  p += kf.nameLen;
+  fi.codes.resize(kf.nCodes);
+  if (kf.nCodes)
+    memcpy(&fi.codes[0], p, kf.nCodes * sizeof(wxUint32));
+  for (wxUint32 j = 0; j < kf.nCodes; j++)
+    fi.codes[j] = wxUINT32_SWAP_ON_BE(fi.codes[j]);
+  p += kf.nCodes * sizeof(wxUint32);
+  if (loaded.size() && !(loaded.back().path < fi.path))
+    return false;                       /* must be sorted by path            */
+  loaded.push_back(fi);
+  }
+
+files.swap(loaded);
+BuildIndex();
+return true;
+}
+
+/*****************************************************************************/
+/* SaveIndex : save the library index                                        */
+/*****************************************************************************/
+
+bool KbdLibrary::SaveIndex(wxString const &filename) const
+{
+wxMemoryBuffer mb;
+KliHeader hdr;
+memcpy(hdr.magic, KLI_MAGIC, sizeof(hdr.magic));
+hdr.byteOrder = wxUINT32_SWAP_ON_BE((wxUint32)KLI_BYTEORDER);
+hdr.nFiles = wxUINT32_SWAP_ON_BE((wxUint32)files.size());
+mb.AppendData(&hdr, sizeof(hdr));
+for (size_t i = 0; i < files.size(); i++)
+  {
+  FileInfo const &fi = files[i];
+  wxScopedCharBuffer path(fi.path.utf8_str());
+  wxScopedCharBuffer name(fi.name.utf8_str());
+  KliFile kf;
+  kf.mtime[0] = (wxUint32)fi.mtime;
+  kf.mtime[1] = (wxUint32)((wxUint64)fi.mtime >> 32);
+  kf.size[0] = (wxUint32)fi.size;
+  kf.size[1] = (wxUint32)((wxUint64)fi.size >> 32);
+  kf.type = fi.type;
+  kf.layers = fi.layers;
+  kf.rows = fi.rows;
+  kf.cols = fi.cols;
+  kf.macros = fi.macros;
+  kf.keys = fi.keys;
+  kf.pathLen = (wxUint32)path.length();
+  kf.nameLen = (wxUint32)name.length();
+  kf.nCodes = (wxUint32)fi.codes.size();
+  SwapKliFile(kf);
+  mb.AppendData(&kf, sizeof(kf));
+  mb.AppendData(path.data(), path.length());
+  mb.AppendData(name.data(), name.length());
+  for (size_t j = 0; j < fi.codes.size(); j++)
+    {
+    wxUint32 code = wxUINT32_SWAP_ON_BE(fi.codes[j]);
+    mb.AppendData(&code, sizeof(code));
+    }
+  }
+
+wxFile f;
+if (!f.Create(filename, true))
+  return false;
+bool bOK = f.Write(mb.GetData(), mb.GetDataLen()) == mb.GetDataLen();
+if (!f.Close())
+  bOK = false;
+if (!bOK)
+  wxRemoveFile(filename);
+return bOK;
+}
@@ -0,0 +1,117 @@
+/*****************************************************************************/
+/* LayoutLibrary.h : indexed library of layout files                         */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LayoutLibrary_h__included_
+#define _LayoutLibrary_h__included_
+
+#include "KbdGuiLayout.h"
+
+/*****************************************************************************/
+/* KbdLibrary : searchable index over directories of layout files            */
+/*****************************************************************************/
+
+/*
+The library knows layout files (.blu), GUI keyboard layouts (.kbl) and
+profiles (.bpf). Each file is read once with the normal readers; its
+metadata and the keys it defines are kept, and an inverted index maps
+each key code to the (file, layer, row, column) positions it's used at.
+GUI keyboard layouts define one key per matrix position; they are
+indexed under the pseudo-layer guiLayer.
+Rescanning only reads files that are new or have changed since the last
+scan (modification time or size); the file reading is spread over
+several threads. The library can be saved and loaded, so this works
+across program runs as well.
+*/
+
+class KbdLibrary
+  {
+  public:
+    enum FileType
+      {
+      ftLayout  = 0x01,                 /* layout file                       */
+      ftGui     = 0x02,                 /* GUI keyboard layout               */
+      ftProfile = 0x04,                 /* profile                           */
+      ftAny     = 0x07
+      };
+    enum
+      {
+      guiLayer = NUMLAYERS_MAX          /* pseudo-layer for GUI layouts      */
+      };
+
+    struct FileInfo
+      {
+      wxString path;
+      wxString name;                    /* layout / profile name             */
+      int type;                         /* FileType, or 0 if unreadable      */
+      wxLongLong_t mtime, size;         /* file state when read              */
+      int layers, rows, cols, macros;
+      int keys;                         /* number of GUI keys                */
+      wxVector<wxUint32> codes;         /* (key << 16) | position, sorted    */
+      };
+
+    struct Query
+      {
+      int types;                        /* FileType combination              */
+      wxString name;                    /* part of name or path, or empty    */
+      int rows, cols;                   /* matrix size, or -1                */
+      int key;                          /* key code, or -1                   */
+      int layer, row, col;              /* where the key is, or -1           */
+      Query()
+        : types(ftAny), rows(-1), cols(-1), key(-1), layer(-1), row(-1), col(-1)
+        { }
+      };
+
+    KbdLibrary() { }
+
+    void Clear() { files.clear(); index.clear(); }
+    // scan directories (incl. subdirectories); entries outside them are kept.
+    // returns number of files read
+    int Scan(wxArrayString const &dirs, int nThreads = 0);
+    int Scan(wxString const &dir, int nThreads = 0)
+      { wxArrayString dirs; dirs.Add(dir); return Scan(dirs, nThreads); }
+    bool LoadIndex(wxString const &filename);
+    bool SaveIndex(wxString const &filename) const;
+
+    int GetFiles() const { return (int)files.size(); }
+    FileInfo const &GetFile(int n) const { return files[n]; }
+    // find matching files; returns the number found
+    int Find(Query const &q, wxArrayInt &found) const;
+
+    static void ReadFileInfo(FileInfo &fi);
+
+  protected:
+    struct IndexEntry
+      {
+      wxUint32 code;                    /* (key << 16) | position            */
+      int file;
+      bool operator<(IndexEntry const &o) const
+        { return code < o.code || (code == o.code && file < o.file); }
+      };
+    static wxUint32 MakeCode(int key, int layer, int row, int col)
+      { return ((wxUint32)key << 16) | ((layer * MAXROWS + row) * MAXCOLS + col); }
+    static void AddGuiCodes(KbdGui const &gui, wxVector<wxUint32> &codes);
+    void BuildIndex();
+    bool MatchesInfo(Query const &q, FileInfo const &fi) const;
+
+  protected:
+    wxVector<FileInfo> files;           /* sorted by path                    */
+    wxVector<IndexEntry> index;         /* sorted by code                    */
+  };
+
+#endif // !defined(_LayoutLibrary_h__included_)
@@ -0,0 +1,346 @@
+/*****************************************************************************/
+/* LayoutPreview.cpp : offscreen rendering of layout previews                */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "wxStd.h"
+#include "layout.h"
+#include "MatrixWnd.h"
+#include "LayoutPreview.h"
+
+#include "wx/thread.h"
+
+/*****************************************************************************/
+/* CPreviewJob : one file to render                                          */
+/*****************************************************************************/
+
+struct CPreviewJob
+  {
+  wxString srcFile, tgtBase;
+  KbdLayout layout;
+  bool bRead;
+  wxVector<wxImage> images;             /* rendered layers                   */
+  wxVector<int> imageLayers;            /* layer number of each image        */
+  int nWritten;
+  };
+
+/*****************************************************************************/
+/* CPreviewWorker : worker thread that reads or writes files                 */
+/*****************************************************************************/
+
+class CPreviewWorker : public wxThread
+  {
+  public:
+    enum Task
+      {
+      taskRead,                         /* read the layout files             */
+      taskWrite                         /* write the rendered images         */
+      };
+
+    CPreviewWorker
+        (
+        int task,
+        wxVector<CPreviewJob> &jobs,
+        size_t &next,
+        size_t end,
+        wxCriticalSection &cs
+        )
+      : wxThread(wxTHREAD_JOINABLE), task(task), jobs(jobs), next(next),
+        end(end), cs(cs)
+      { }
+
+    static void ProcessFiles
+        (
+        int task,
+        wxVector<CPreviewJob> &jobs,
+        size_t &next,
+        size_t end,
+        wxCriticalSection &cs
+        )
+      {
+      wxLogNull noLog;                  /* failures are collected instead    */
+      for (;;)
+        {
+        size_t n;
+          {
+          wxCriticalSectionLocker lock(cs);
+          n = next++;
+          }
+        if (n >= end)
+          break;
+        CPreviewJob &job = jobs[n];
+        if (task == taskRead)
+          job.bRead = job.layout.ReadFile(job.srcFile);
+        else
+          {
+          for (size_t i = 0; i < job.images.size(); i++)
+            if (job.images[i].SaveFile(job.tgtBase +
+                                           wxString::Format(wxT("_layer%d.png"),
+                                                            job.imageLayers[i]),
+                                       wxBITMAP_TYPE_PNG))
+              job.nWritten++;
+          job.images.clear();           /* not needed any more               */
+          job.imageLayers.clear();
+          }
+        }
+      }
+
+    static void RunTask
+        (
+        int task,
+        wxVector<CPreviewJob> &jobs,
+        size_t begin,
+        size_t end,
+        int nThreads
+        )
+      {
+      nThreads = max(1, min(nThreads, (int)(end - begin)));
+      size_t next = begin;
+      wxCriticalSection cs;
+      wxVector<CPreviewWorker *> workers;
+      for (int i = 1; i < nThreads; i++)  /* this thread is the first worker   */
+        {
+        CPreviewWorker *pWorker = new CPreviewWorker(task, jobs, next, end, cs);
+        if (pWorker->Run() != wxTHREAD_NO_ERROR)
+          {
+          delete pWorker;
+          break;
+          }
+        workers.push_back(pWorker);
+        }
+      ProcessFiles(task, jobs, next, end, cs);
+      for (size_t i = 0; i < workers.size(); i++)
+        {
+        workers[i]->Wait();
+        delete workers[i];
+        }
+      }
+
+  protected:
+    virtual ExitCode Entry()
+      {
+      ProcessFiles(task, jobs, next, end, cs);
+      return 0;
+      }
+
+  protected:
+    int task;
+    wxVector<CPreviewJob> &jobs;
+    size_t &next;
+    size_t end;
+    wxCriticalSection &cs;
+  };
+
+/*===========================================================================*/
+/* KbdPreview class members                                                  */
+/*===========================================================================*/
+
+/*****************************************************************************/
+/* KbdPreview : constructor                                                  */
+/*****************************************************************************/
+
+KbdPreview::KbdPreview(KbdGui const &gui, int zoom)
+  : gui(gui)
+{
+// same geometry as the on-screen keyboard
+size = CKbdWnd::CalcSize(this->gui, zoom);
+font = CKbdWnd::CreateKeyFont(zoom);
+CKbdWnd::KeyLayout kl;
+kl.state = CKbdWnd::ksUnpressed;
+kl.bDirty = false;
+for (size_t i = 0; i < this->gui.size(); i++)
+  {
+  kl.def = &this->gui.GetKey(i);
+  if (!CKbdWnd::IsKeyShown(*kl.def))
+    continue;
+  kl.rects = CKbdWnd::GetKeyRects(*kl.def);
+  CKbdWnd::KeyGeometry kg = CKbdWnd::KeyGeometry();
+  CKbdWnd::CalcKeyGeometry(*kl.def, kl.rects, zoom, kg);
+  kl.rect[0] = kg.rect[0];
+  kl.rect[1] = kg.rect[1];
+  kl.bounds = kg.bounds;
+  kl.sprite = NULL;
+  keys.push_back(kl);
+  }
+
+// fixed colours, so the previews look the same everywhere and print well
+brBack = wxBrush(*wxWHITE);
+brKey = wxBrush(wxColour(240, 240, 240));
+penKeyBound = wxPen(wxColour(128, 128, 128));
+penKey = wxPen(wxColour(240, 240, 240));
+Reset();
+}
+
+/*****************************************************************************/
+/* Reset : reset the statistics                                              */
+/*****************************************************************************/
+
+void KbdPreview::Reset()
+{
+nWritten = 0;
+failed.Clear();
+msTime = 0;
+}
+
+/*****************************************************************************/
+/* GetKeyLabel : returns the label for a key in a layout layer               */
+/*****************************************************************************/
+
+wxString KbdPreview::GetKeyLabel
+    (
+    KbdLayout &layout,
+    int layer,
+    GuiKey const &def
+    )
+{
+int row = def.matrixrow, col = def.matrixcol;
+if (row < 0 || row >= layout.GetRows() ||
+    col < 0 || col >= layout.GetCols())
+  return def.label[0];                  /* not on the matrix, like LEDs      */
+int key = layout[layer].GetKey(row, col);
+if (key == KB_UNUSED)
+  return wxEmptyString;
+wxString s(HID2Text((wxUint16)key));
+if (s.empty())                          /* unknown code - show it as is      */
+  s.Printf(wxT("%04X"), key);
+return s;
+}
+
+/*****************************************************************************/
+/* Render : render one layer of a layout                                     */
+/*****************************************************************************/
+
+bool KbdPreview::Render(KbdLayout &layout, int layer, wxImage &img)
+{
+if (layer < 0 || layer >= layout.GetLayers() || keys.empty())
+  return false;
+
+wxBitmap bmp(size.x, size.y, 24);
+wxMemoryDC dc(bmp);
+dc.SetBackground(brBack);
+dc.Clear();
+dc.SetFont(font);
+dc.SetTextForeground(*wxBLACK);
+CKbdWnd::KeyClrs clrs = { brKey, brKey, penKeyBound, penKey };
+for (size_t i = 0; i < keys.size(); i++)
+  CKbdWnd::DrawKey(dc, keys[i], clrs,
+                   GetKeyLabel(layout, layer, *keys[i].def),
+                   labels);
+dc.SelectObject(wxNullBitmap);
+img = bmp.ConvertToImage();
+return img.IsOk();
+}
+
+/*****************************************************************************/
+/* RenderDir : render all matching files in a directory tree                 */
+/*****************************************************************************/
+
+int KbdPreview::RenderDir
+    (
+    wxString const &srcDir,
+    wxString const &tgtDir,
+    wxString const &filespec,
+    int nThreads
+    )
+{
+Reset();
+wxStopWatch sw;
+wxString srcBase = wxFileName::DirName(srcDir).GetFullPath();
+wxString tgtBase = wxFileName::DirName(tgtDir).GetFullPath();
+wxArrayString found;
+if (wxDir::Exists(srcBase))
+  wxDir::GetAllFiles(srcBase, &found, filespec);
+found.Sort();
+
+// target directories are created up front, so the workers only have
+// to deal with their files
+wxVector<CPreviewJob> jobs;
+jobs.reserve(found.size());
+wxString lastDir;
+for (size_t i = 0; i < found.size(); i++)
+  {
+  CPreviewJob job;
+  job.srcFile = found[i];
+  wxFileName fn(tgtBase + found[i].Mid(srcBase.size()));
+  job.tgtBase = fn.GetPathWithSep() + fn.GetName();
+  job.bRead = false;
+  job.nWritten = 0;
+  wxString dir = fn.GetPath();
+  if (dir != lastDir &&
+      !wxFileName::Mkdir(dir, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL))
+    {
+    failed.Add(job.srcFile);
+    continue;
+    }
+  lastDir = dir;
+  jobs.push_back(job);
+  }
+
+if (nThreads <= 0)
+  nThreads = wxThread::GetCPUCount();
+// done in batches, so that not all images have to be kept in memory
+size_t const batchSize = 16;
+for (size_t begin = 0; begin < jobs.size(); begin += batchSize)
+  {
+  size_t end = min(begin + batchSize, jobs.size());
+  CPreviewWorker::RunTask(CPreviewWorker::taskRead, jobs, begin, end, nThreads);
+  for (size_t i = begin; i < end; i++)
+    if (jobs[i].bRead)
+      {
+      for (int l = 0; l < jobs[i].layout.GetLayers(); l++)
+        {
+        wxImage img;
+        if (Render(jobs[i].layout, l, img))
+          {
+          jobs[i].images.push_back(img);
+          jobs[i].imageLayers.push_back(l);
+          }
+        }
+      }
+  CPreviewWorker::RunTask(CPreviewWorker::taskWrite, jobs, begin, end, nThreads);
+  }
+
+for (size_t i = 0; i < jobs.size(); i++)
+  {
+  nWritten += jobs[i].nWritten;
+  if (!jobs[i].bRead ||
+      jobs[i].nWritten != jobs[i].layout.GetLayers())
+    failed.Add(jobs[i].srcFile);
+  }
+msTime = sw.Time();
+return nWritten;
+}
+
+/*****************************************************************************/
+/* GetReport : get a summary of the last rendering                           */
+/*****************************************************************************/
+
+wxString KbdPreview::GetReport() const
+{
+double secs = max(msTime, 1L) / 1000.;
+wxString s = wxString::Format(wxT("%d previews written in %.3f seconds")
+                              wxT(" (%.0f previews/s)"),
+                              nWritten, msTime / 1000., nWritten / secs);
+if (failed.size())
+  {
+  s += wxString::Format(wxT("\n%d files could not be rendered:"),
+                        (int)failed.size());
+  for (size_t i = 0; i < failed.size(); i++)
+    s += wxT("\n  ") + failed[i];
+  }
+return s;
+}
@@ -0,0 +1,72 @@
+/*****************************************************************************/
+/* LayoutPreview.h : offscreen rendering of layout previews                  */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LayoutPreview_h__included_
+#define _LayoutPreview_h__included_
+
+#include "KbdGuiLayout.h"
+#include "KbdWnd.h"
+
+/*****************************************************************************/
+/* KbdPreview : renders layout layers on a GUI keyboard layout               */
+/*****************************************************************************/
+
+/*
+Each layer of a layout is drawn like the on-screen keyboard draws it,
+using the same key geometry and drawing code, but with the names of the
+keys assigned in that layer as labels, and in fixed, printable colours.
+Drawing uses wxDC, which is only safe in the main thread; reading the
+layout files and writing the PNGs are spread over several threads.
+*/
+
+class KbdPreview
+  {
+  public:
+    KbdPreview(KbdGui const &gui, int zoom = 100);
+
+    void Reset();
+    // render one layer of a layout
+    bool Render(KbdLayout &layout, int layer, wxImage &img);
+    // render all layers of all matching files in a directory tree to
+    // <target>/<relative path>_layer<n>.png; returns the number of PNGs
+    int RenderDir(wxString const &srcDir, wxString const &tgtDir,
+                  wxString const &filespec = wxT("*.blu"), int nThreads = 0);
+
+    int GetWritten() const { return nWritten; }
+    wxArrayString const &GetFailed() const { return failed; }
+    long GetTime() const { return msTime; }    /* in milliseconds            */
+    wxString GetReport() const;
+
+  protected:
+    wxString GetKeyLabel(KbdLayout &layout, int layer, GuiKey const &def);
+
+  protected:
+    KbdGui gui;
+    wxSize size;
+    wxVector<CKbdWnd::KeyLayout> keys;
+    CKbdWnd::KbdLabels labels;
+    wxFont font;
+    wxBrush brBack, brKey;
+    wxPen penKeyBound, penKey;
+    int nWritten;
+    wxArrayString failed;
+    long msTime;
+  };
+
+#endif // !defined(_LayoutPreview_h__included_)
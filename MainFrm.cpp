@@ -25,6 +25,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "blusb_gui.h"
 
 #include "MainFrm.h"
+#include "Profile.h"
 
 #ifndef wxHAS_IMAGES_IN_RESOURCES
   #include "res/Application.xpm"
@@ -41,6 +42,8 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 bool CMatrixPanel::Layout()
 {
+if (!pMatrix)                           /* not realized yet                  */
+  return wxPanel::Layout();
 wxSize szNew = pMatrix->GetMinSize();
 if (szMatrix != szNew)
   {
@@ -67,6 +70,43 @@ if (szMatrix != szNew)
 return wxPanel::Layout();
 }
 
+/*****************************************************************************/
+/* Realize : creates the matrix window                                       */
+/*****************************************************************************/
+
+void CMatrixPanel::Realize()
+{
+if (pMatrix)
+  return;
+pMatrix = new CMatrixWnd(this, numRows, numCols);
+szMatrix = pMatrix->GetMinSize();
+pMatrix->SetLayer(layer);
+pMatrix->SetCtlMatrix(ctlRows, ctlCols);
+pMatrix->SetKbdMatrix(kbm);
+pMatrix->SetKbdWnd(pKbdWnd);
+wxSizer *sizerPage = new wxBoxSizer(wxHORIZONTAL);
+sizerPage->Add(pMatrix, wxSizerFlags(1).Expand());
+SetSizer(sizerPage);
+if (IsShownOnScreen())                  /* already sized by the notebook     */
+  Layout();
+else
+  Fit();
+}
+
+/*****************************************************************************/
+/* Release : destroys the matrix window                                      */
+/*****************************************************************************/
+
+void CMatrixPanel::Release()
+{
+if (!pMatrix)
+  return;
+kbm = pMatrix->GetKbdMatrix();          /* keep the edited contents          */
+SetSizer(NULL);
+pMatrix->Destroy();
+pMatrix = NULL;
+}
+
 
 /*===========================================================================*/
 /* CKbdPanel class members                                                   */
@@ -150,88 +190,33 @@ return wxPanel::Layout();
 CMainPanel::CMainPanel(wxWindow *parent)
        : wxPanel(parent, wxID_ANY)
 {
-wxStaticText *pStatic = new wxStaticText(this, wxID_ANY, wxT("Layers: "));
-wxPoint pos = pStatic->GetPosition();
+pStLayers = new wxStaticText(this, wxID_ANY, wxT("Layers: "));
+wxPoint pos = pStLayers->GetPosition();
 pos.x += 3;
-pStatic->Move(pos);
-pos.x += pStatic->GetSize().GetX();
+pStLayers->Move(pos);
+pos.x += pStLayers->GetSize().GetX();
+devCaps = GetApp()->GetDevCaps();
 wxArrayString a_1_maxLayer;
-int nLayersMax = (!GetApp()->IsDevOpen() ||
-                  GetApp()->GetFwVersion() >= 0x0105) ?
-                     NUMLAYERS_MAX :
-                     NUMLAYERS_MAX_OLD;
+int nLayersMax = devCaps.maxLayers;
 for (int i = 1; i <= nLayersMax; i++)
   a_1_maxLayer.Add(wxString::Format(wxT("%d"), i));
 wxSize sz(wxDefaultSize);
 pLayers = new wxChoice(this, Blusb_LayerCount, pos, sz, a_1_maxLayer);
 sz = pLayers->GetSize();
 pLayers->Select(0);
-pos = pStatic->GetPosition();
-pos.y += (pLayers->GetSize().GetY() - pStatic->GetSize().GetY()) / 2;
-pStatic->Move(pos);
-sz = pLayers->GetSize();  // combobox scaled for 1 digit;
-sz.Scale(1.3, 1.0);       // scale up to ~3 digits
+pos = pStLayers->GetPosition();
+pos.y += (pLayers->GetSize().GetY() - pStLayers->GetSize().GetY()) / 2;
+pStLayers->Move(pos);
 
 pKbd = NULL;                            /* keyboard panel not set up yet     */
 
+pDebounce = pPwmUsb = pPwmBt = NULL;
 #ifdef _DEBUG
 if (true)
 #else
 if (GetApp()->IsDevOpen())
 #endif
-  {
-  pos.x = pLayers->GetPosition().x + pLayers->GetSize().GetWidth() + 20;
-  pos.y = pStatic->GetPosition().y;
-  wxStaticText *pStDebounce = new wxStaticText(this, wxID_ANY,
-                                               wxT("Debounce time (ms): "),
-                                               pos);
-  pos.x += pStDebounce->GetSize().GetX();
-  pos.y = pLayers->GetPosition().y;
-  wxArrayString a_1_20;
-  for (int i = 1; i <= 20; i++)
-      a_1_20.Add(wxString::Format(wxT("%d"), i));
-  pDebounce = new wxChoice(this, Blusb_Debounce, pos, sz, a_1_20);
-  int nDebounce = GetApp()->ReadDebounce();
-  if (nDebounce < 1 || nDebounce > 20)
-    nDebounce = 7;
-  pDebounce->Select(nDebounce - 1);
-
-  wxUint8 pwmUsb, pwmBt;
-#ifdef _DEBUG
-  GetApp()->ReadPWM(pwmUsb, pwmBt);
-  if (1)
-#else
-  if (GetApp()->ReadPWM(pwmUsb, pwmBt) > BLUSB_SUCCESS)
-#endif
-    {
-    wxArrayString a_0_255;
-    for (int i = 0; i <= 255; i++)
-      a_0_255.Add(wxString::Format(wxT("%d"), i));
-    pos.x += pDebounce->GetSize().GetX() + 10;
-    pos.y = pStatic->GetPosition().y;
-    wxStaticText *pStPwmUsb = new wxStaticText(this, wxID_ANY,
-                                               wxT("PWM USB: "),
-                                               pos);
-    pos.x += pStPwmUsb->GetSize().GetX();
-    pos.y = pLayers->GetPosition().y;
-    pPwmUsb = new wxChoice(this, Blusb_PwmUsb, pos, sz, a_0_255);
-    pos.x += pPwmUsb->GetSize().GetX() + 5;
-    pos.y = pStatic->GetPosition().y;
-    wxStaticText *pStPwmBt = new wxStaticText(this, wxID_ANY,
-                                              wxT("BT: "),
-                                              pos);
-    pos.x += pStPwmBt->GetSize().GetX();
-    pos.y = pLayers->GetPosition().y;
-    pPwmBt = new wxChoice(this, Blusb_PwmBt, pos, sz, a_0_255);
-    pPwmUsb->Select(pwmUsb);
-    pPwmBt->Select(pwmBt);
-    }
-  else
-    pPwmUsb = pPwmBt = NULL;
-  }
-else
-  pDebounce = pPwmUsb = pPwmBt = NULL;
-
+  CreateDevControls();
 
 wxSizer *sizerV = new wxBoxSizer(wxVERTICAL);
 sizerV->AddSpacer(pLayers->GetSize().GetY() + 5);
@@ -248,7 +233,8 @@ if (sLayout.CmpNoCase("ISO") &&
     sLayout.CmpNoCase("ANSI") &&
     sLayout.CmpNoCase("ISO122") &&
     sLayout.CmpNoCase("ANSI121"))
-  bLayoutOK = kbdGui.ReadLayoutFile(sLayout);
+  bLayoutOK = kbdGui.ReadLayoutFile(sLayout, NULL,
+                                    GetApp()->GetGuiCacheFile(sLayout));
 if (bLayoutOK)
   {
   GetApp()->SetDefaultLayout(kbdGui);
@@ -257,7 +243,13 @@ if (bLayoutOK)
   kbdGuiLayout = kbdGui;
   }
 
-pMatrixNotebook = new wxNotebook(this, wxID_ANY);
+// overview of all layers; needs to be there before the layers are set up
+pStrip = new CLayerStrip(this, Blusb_LayerStrip);
+if (bLayoutOK)
+  pStrip->SetLayout(kbdGui);
+sizerV->Add(pStrip, wxSizerFlags(0));
+
+pMatrixNotebook = new wxNotebook(this, Blusb_LayerNotebook);
 SetLayers(1, true);
 // TODO: add keyboard layout page(s?)
 sizerV->Add(pMatrixNotebook, wxSizerFlags(1).Expand());
@@ -265,6 +257,13 @@ sizerV->Add(pMatrixNotebook, wxSizerFlags(1).Expand());
 wxSize szMatrix = matrices[0]->GetSize();
 szMatrix.y = 10;
 pKbd = new CKbdPanel(this, wxID_ANY, wxDefaultPosition, szMatrix);
+long kbdZoom;
+GetApp()->ReadConfig("/Settings/KbdZoom", &kbdZoom, CKbdWnd::GetDefaultZoom());
+pKbd->SetKbdZoom((int)kbdZoom);
+long bHeatmap;
+GetApp()->ReadConfig("/Settings/KbdHeatmap", &bHeatmap, 0);
+pKbd->GetKbdWnd()->ShowHeatmap(!!bHeatmap);
+pKbd->GetKbdWnd()->LoadPressCounts(GetApp()->GetHeatmapFile());
 if (bLayoutOK)
   pKbd->SetKbdLayout(kbdGui);
 sizerV->Add(pKbd, wxSizerFlags(0).Expand());
@@ -272,6 +271,68 @@ sizerV->Add(pKbd, wxSizerFlags(0).Expand());
 SetSizerAndFit(sizerV);
 }
 
+/*****************************************************************************/
+/* CreateDevControls : create the controls for the device settings           */
+/*****************************************************************************/
+
+void CMainPanel::CreateDevControls()
+{
+if (pDebounce)                          /* only once                         */
+  return;
+
+wxSize sz = pLayers->GetSize();         /* combobox scaled for 1 digit;      */
+sz.Scale(1.3, 1.0);                     /* scale up to ~3 digits             */
+wxPoint pos(pLayers->GetPosition().x + pLayers->GetSize().GetWidth() + 20,
+            pStLayers->GetPosition().y);
+
+wxStaticText *pStDebounce = new wxStaticText(this, wxID_ANY,
+                                             wxT("Debounce time (ms): "),
+                                             pos);
+pos.x += pStDebounce->GetSize().GetX();
+pos.y = pLayers->GetPosition().y;
+wxArrayString a_1_20;
+for (int i = 1; i <= 20; i++)
+    a_1_20.Add(wxString::Format(wxT("%d"), i));
+pDebounce = new wxChoice(this, Blusb_Debounce, pos, sz, a_1_20);
+int nDebounce = GetApp()->ReadDebounce();
+if (nDebounce < 1 || nDebounce > 20)
+  nDebounce = 7;
+pDebounce->Select(nDebounce - 1);
+
+wxUint8 pwmUsb, pwmBt;
+#ifdef _DEBUG
+GetApp()->ReadPWM(pwmUsb, pwmBt);
+if (1)
+#else
+if (GetApp()->ReadPWM(pwmUsb, pwmBt) > BLUSB_SUCCESS)
+#endif
+  {
+  wxArrayString a_0_255;
+  for (int i = 0; i <= 255; i++)
+    a_0_255.Add(wxString::Format(wxT("%d"), i));
+  pos.x += pDebounce->GetSize().GetX() + 10;
+  pos.y = pStLayers->GetPosition().y;
+  wxStaticText *pStPwmUsb = new wxStaticText(this, wxID_ANY,
+                                             wxT("PWM USB: "),
+                                             pos);
+  pos.x += pStPwmUsb->GetSize().GetX();
+  pos.y = pLayers->GetPosition().y;
+  pPwmUsb = new wxChoice(this, Blusb_PwmUsb, pos, sz, a_0_255);
+  pos.x += pPwmUsb->GetSize().GetX() + 5;
+  pos.y = pStLayers->GetPosition().y;
+  wxStaticText *pStPwmBt = new wxStaticText(this, wxID_ANY,
+                                            wxT("BT: "),
+                                            pos);
+  pos.x += pStPwmBt->GetSize().GetX();
+  pos.y = pLayers->GetPosition().y;
+  pPwmBt = new wxChoice(this, Blusb_PwmBt, pos, sz, a_0_255);
+  pPwmUsb->Select(pwmUsb);
+  pPwmBt->Select(pwmBt);
+  }
+else
+  pPwmUsb = pPwmBt = NULL;
+}
+
 /*****************************************************************************/
 /* SetLayers : sets up the number of layers                                  */
 /*****************************************************************************/
@@ -288,6 +349,9 @@ for (i = (int)matrices.size(); i > nLayers; i--)
   matrices.erase(matrices.begin() + i - 1);
   kbdLayout.RemoveLayer(i - 1);
   }
+for (i = (int)recentPages.size() - 1; i >= 0; i--)
+  if (recentPages[i] >= nLayers)
+    recentPages.erase(recentPages.begin() + i);
 
 if (resetExisting)
   {
@@ -306,6 +370,7 @@ for (i = (int)matrices.size(); i < nLayers; i++)
   pMatrixNotebook->InsertPage(i, pNew,
                               wxString::Format(wxT("Matrix Layer %d"), i));
   pNew->SetLayer(i);
+  pNew->SetCtlMatrix(devCaps.matrixRows, devCaps.matrixCols);
   matrices.push_back(pNew);
   if (i >= kbdLayout.GetLayers())
     {
@@ -317,6 +382,9 @@ for (i = (int)matrices.size(); i < nLayers; i++)
   }
 
 pLayers->SetSelection(nLayers - 1);
+pStrip->SetLayers(nLayers);             /* redraws the changed keys          */
+// the shown page might have changed without notification
+RealizePage(pMatrixNotebook->GetSelection());
 return true;
 }
 
@@ -333,12 +401,45 @@ CMatrixPanel *CMainPanel::CreateMatrixPage
 {
 wxSizerFlags flagsBorder = wxSizerFlags().Border().Centre();
 
-CMatrixPanel *page = new CMatrixPanel(parent, numRows, numCols);
-wxSizer *sizerPage = new wxBoxSizer(wxHORIZONTAL);
-sizerPage->Add(page->GetMatrix(), wxSizerFlags(1).Expand());
-page->SetSizerAndFit(sizerPage);
+// the matrix window is created when the page is shown (see RealizePage())
+return new CMatrixPanel(parent, numRows, numCols);
+}
+
+/*****************************************************************************/
+/* RealizePage : makes sure that a matrix page has its matrix window         */
+/*****************************************************************************/
 
-return page;
+void CMainPanel::RealizePage(int page)
+{
+if (page < 0 || page >= (int)matrices.size())
+  return;
+matrices[page]->Realize();
+for (size_t i = 0; i < recentPages.size(); i++)
+  if (recentPages[i] == page)
+    {
+    recentPages.erase(recentPages.begin() + i);
+    break;
+    }
+recentPages.insert(recentPages.begin(), page);
+// only the most recently shown pages keep their matrix windows
+while (recentPages.size() > (size_t)matrixPagesKept)
+  {
+  matrices[recentPages.back()]->Release();
+  recentPages.pop_back();
+  }
+}
+
+/*****************************************************************************/
+/* ReleasePages : drops all matrix windows, except for the current page's    */
+/*****************************************************************************/
+
+void CMainPanel::ReleasePages()
+{
+// the current page gets a new matrix window with fresh editors
+for (size_t i = 0; i < recentPages.size(); i++)
+  matrices[recentPages[i]]->Release();
+recentPages.clear();
+RealizePage(pMatrixNotebook->GetSelection());
 }
 
 /*****************************************************************************/
@@ -357,6 +458,41 @@ for (int i = 0; i < layout.GetLayers(); i++)
   }
 }
 
+/*****************************************************************************/
+/* UpdateLayers : shows changed contents of the layers in layerMask          */
+/*****************************************************************************/
+
+void CMainPanel::UpdateLayers(wxUint32 layerMask)
+{
+KbdLayout &layout = GetApp()->GetLayout();
+for (int i = 0; i < layout.GetLayers() && i < (int)matrices.size(); i++)
+  if (layerMask & (1 << i))
+    {
+    matrices[i]->UpdateKbdMatrix(layout[i]);
+    pStrip->InvalidateLayer(i);
+    }
+}
+
+/*****************************************************************************/
+/* SetDevCaps : passes new device capabilities on to the views               */
+/*****************************************************************************/
+
+void CMainPanel::SetDevCaps(BlUsbDevCaps const &caps)
+{
+devCaps = caps;
+if (devCaps.maxLayers > 0 &&            /* offer the device's layer count    */
+    devCaps.maxLayers != (int)pLayers->GetCount())
+  {
+  int sel = min(pLayers->GetSelection(), devCaps.maxLayers - 1);
+  pLayers->Clear();
+  for (int i = 1; i <= devCaps.maxLayers; i++)
+    pLayers->Append(wxString::Format(wxT("%d"), i));
+  pLayers->Select(max(sel, 0));
+  }
+for (size_t i = 0; i < matrices.size(); i++)
+  matrices[i]->SetCtlMatrix(devCaps.matrixRows, devCaps.matrixCols);
+}
+
 /*****************************************************************************/
 /* SelectMatrix : select a matrix position in the current layer              */
 /*****************************************************************************/
@@ -368,6 +504,29 @@ if (pPanel)
   pPanel->SelectMatrix(row, col);
 }
 
+/*****************************************************************************/
+/* GetSelectedMatrix : get the selected matrix position in the current layer */
+/*****************************************************************************/
+
+bool CMainPanel::GetSelectedMatrix(int &row, int &col)
+{
+CMatrixPanel *pPanel = (CMatrixPanel *)pMatrixNotebook->GetCurrentPage();
+return pPanel && pPanel->GetSelectedMatrix(row, col);
+}
+
+/*****************************************************************************/
+/* SelectLayer : select a layer's matrix page                                */
+/*****************************************************************************/
+
+void CMainPanel::SelectLayer(int layer)
+{
+if (layer < 0 || layer >= (int)pMatrixNotebook->GetPageCount())
+  return;
+// the pages are all there, so this is just a page switch
+pMatrixNotebook->SetSelection(layer);
+pStrip->SetSelection(layer);
+}
+
 
 /*===========================================================================*/
 /* CMainFrame class members                                                  */
@@ -382,6 +541,8 @@ wxBEGIN_EVENT_TABLE(CMainFrame, wxFrame)
     EVT_MENU(Blusb_About, CMainFrame::OnAbout)
 
     EVT_CLOSE(CMainFrame::OnClose)
+    EVT_MOVE(CMainFrame::OnMove)
+    EVT_DISPLAY_CHANGED(CMainFrame::OnDisplayChanged)
     EVT_KEY_DOWN(CMainFrame::OnKeyDown)
     EVT_CHAR(CMainFrame::OnChar)
     EVT_KEY_UP(CMainFrame::OnKeyUp)
@@ -391,7 +552,18 @@ wxBEGIN_EVENT_TABLE(CMainFrame, wxFrame)
     EVT_CHOICE(Blusb_Debounce, CMainFrame::OnDebounce)
     EVT_CHOICE(Blusb_PwmUsb, CMainFrame::OnPwmUsb)
     EVT_CHOICE(Blusb_PwmBt, CMainFrame::OnPwmBt)
-
+    EVT_NOTEBOOK_PAGE_CHANGED(Blusb_LayerNotebook, CMainFrame::OnLayerPage)
+    EVT_CHOICE(Blusb_LayerStrip, CMainFrame::OnLayerStrip)
+
+    EVT_MENU(Blusb_Edit_Undo, CMainFrame::OnEditUndo)
+    EVT_UPDATE_UI(Blusb_Edit_Undo, CMainFrame::OnUpdateEditUndo)
+    EVT_MENU(Blusb_Edit_Redo, CMainFrame::OnEditRedo)
+    EVT_UPDATE_UI(Blusb_Edit_Redo, CMainFrame::OnUpdateEditRedo)
+    EVT_MENU(Blusb_Edit_MapKey, CMainFrame::OnEditMapKey)
+    EVT_MENU(Blusb_Edit_SwapKeys, CMainFrame::OnEditSwapKeys)
+    EVT_MENU(Blusb_Edit_ClearRow, CMainFrame::OnEditClearRow)
+    EVT_UPDATE_UI(Blusb_Edit_ClearRow, CMainFrame::OnUpdateEditClearRow)
+    EVT_MENU(Blusb_Edit_CopyLayer, CMainFrame::OnEditCopyLayer)
     EVT_MENU(Blusb_ResetLayout, CMainFrame::OnReset)
     EVT_MENU(Blusb_ReadLayout, CMainFrame::OnReadLayout)
     EVT_UPDATE_UI(Blusb_ReadLayout, CMainFrame::OnUpdateReadLayout)
@@ -401,6 +573,9 @@ wxBEGIN_EVENT_TABLE(CMainFrame, wxFrame)
     EVT_UPDATE_UI(Blusb_ServiceMode, CMainFrame::OnUpdateServiceMode)
     EVT_MENU(Blusb_ReadFile, CMainFrame::OnReadFile)
     EVT_MENU(Blusb_WriteFile, CMainFrame::OnWriteFile)
+    EVT_MENU(Blusb_ReadProfile, CMainFrame::OnReadProfile)
+    EVT_MENU(Blusb_WriteProfile, CMainFrame::OnWriteProfile)
+    EVT_MENU(Blusb_SearchLibrary, CMainFrame::OnSearchLibrary)
     EVT_MENU(Blusb_Kbd_ANSI, CMainFrame::OnKbdANSI)
     EVT_UPDATE_UI(Blusb_Kbd_ANSI, CMainFrame::OnUpdateKbdANSI)
     EVT_MENU(Blusb_Kbd_ISO, CMainFrame::OnKbdISO)
@@ -412,6 +587,12 @@ wxBEGIN_EVENT_TABLE(CMainFrame, wxFrame)
     EVT_MENU(Blusb_Kbd_Reset, CMainFrame::OnKbdReset)
     EVT_MENU(Blusb_Kbd_Load, CMainFrame::OnKbdLoad)
     EVT_MENU(Blusb_Kbd_Save, CMainFrame::OnKbdSave)
+    EVT_MENU(Blusb_Kbd_ZoomIn, CMainFrame::OnKbdZoomIn)
+    EVT_MENU(Blusb_Kbd_ZoomOut, CMainFrame::OnKbdZoomOut)
+    EVT_MENU(Blusb_Kbd_ZoomDefault, CMainFrame::OnKbdZoomDefault)
+    EVT_MENU(Blusb_Kbd_Heatmap, CMainFrame::OnKbdHeatmap)
+    EVT_UPDATE_UI(Blusb_Kbd_Heatmap, CMainFrame::OnUpdateKbdHeatmap)
+    EVT_MENU(Blusb_Kbd_HeatmapReset, CMainFrame::OnKbdHeatmapReset)
 wxEND_EVENT_TABLE()
 
 
@@ -425,7 +606,7 @@ CMainFrame::CMainFrame
     const wxPoint& pos,
     const wxSize& size
     )
-  : wxFrame(NULL, wxID_ANY, title, pos, size)
+  : wxFrame(NULL, wxID_ANY, title, pos, size), m_panel(NULL)
 {
 SetIcon(wxICON(Application));
 wxMenu *menuFile = new wxMenu;
@@ -433,6 +614,21 @@ menuFile->Append(wxID_EXIT);
 
 memset(bufferLast, 0xff, sizeof(bufferLast));
 
+wxMenu *menuEdit = new wxMenu;
+menuEdit->Append(Blusb_Edit_Undo, wxT("&Undo\tCtrl+Z"),
+                 wxT("Undo the last layout change"));
+menuEdit->Append(Blusb_Edit_Redo, wxT("&Redo\tCtrl+Y"),
+                 wxT("Redo the last undone layout change"));
+menuEdit->AppendSeparator();
+menuEdit->Append(Blusb_Edit_MapKey, wxT("Replace Key in All Layers..."),
+                 wxT("Replace a key code by another one in all layers"));
+menuEdit->Append(Blusb_Edit_SwapKeys, wxT("Swap Matrix Positions..."),
+                 wxT("Swap the keys on two matrix positions in all layers"));
+menuEdit->Append(Blusb_Edit_ClearRow, wxT("Clear Matrix Row"),
+                 wxT("Remove all keys from the selected matrix row"));
+menuEdit->Append(Blusb_Edit_CopyLayer, wxT("Copy Layer to..."),
+                 wxT("Copy the current layer's keys to other layers"));
+
 wxMenu *menuLayout = new wxMenu;
 menuLayout->Append(Blusb_ResetLayout, wxT("Reset Layout"),
                  wxT("Reset layout to default values"));
@@ -440,6 +636,12 @@ menuLayout->Append(Blusb_ReadFile, wxT("Load from File..."),
                  wxT("Read layout from file"));
 menuLayout->Append(Blusb_WriteFile, wxT("Save to File..."),
                  wxT("Write layout to file"));
+menuLayout->Append(Blusb_ReadProfile, wxT("Load Profile..."),
+                 wxT("Read complete keyboard setup from profile"));
+menuLayout->Append(Blusb_WriteProfile, wxT("Save Profile..."),
+                 wxT("Write complete keyboard setup to profile"));
+menuLayout->Append(Blusb_SearchLibrary, wxT("Search Layout Library..."),
+                 wxT("Find layouts, keyboard layouts and profiles by contents"));
 //if (GetApp()->IsDevOpen())
   {
   menuLayout->AppendSeparator();
@@ -469,6 +671,17 @@ menuLayout->Append(Blusb_Kbd_Load, wxT("Load Keyboard Layout..."),
                  wxT("Load Keyboard Layout from file"));
 menuLayout->Append(Blusb_Kbd_Save, wxT("Save Keyboard Layout..."),
                  wxT("Save Keyboard Layout to file"));
+menuLayout->AppendSeparator();
+menuLayout->Append(Blusb_Kbd_ZoomIn, wxT("Zoom In Keyboard"),
+                 wxT("Show the keyboard larger (also Ctrl+Mouse Wheel)"));
+menuLayout->Append(Blusb_Kbd_ZoomOut, wxT("Zoom Out Keyboard"),
+                 wxT("Show the keyboard smaller (also Ctrl+Mouse Wheel)"));
+menuLayout->Append(Blusb_Kbd_ZoomDefault, wxT("Default Keyboard Zoom"),
+                 wxT("Show the keyboard in its default size for this screen"));
+menuLayout->AppendCheckItem(Blusb_Kbd_Heatmap, wxT("Show Key Heatmap"),
+                 wxT("Show how often each key has been pressed"));
+menuLayout->Append(Blusb_Kbd_HeatmapReset, wxT("Reset Key Heatmap"),
+                 wxT("Clear the key press counters"));
 #if 0
 // not necessary here, since blusb_gui doesn't discriminate between
 // "unpressed" (i.e., never pressed) and "released" keys
@@ -481,6 +694,7 @@ menuHelp->Append(wxID_ABOUT);
 wxMenuBar *menuBar = new wxMenuBar;
 
 menuBar->Append( menuFile, wxT("&File"));
+menuBar->Append( menuEdit, wxT("&Edit"));
 menuBar->Append( menuLayout, wxT("&Layout"));
 menuBar->Append( menuHelp, wxT("&Help"));
 SetMenuBar( menuBar );
@@ -490,9 +704,10 @@ SetMenuBar( menuBar );
 // and one for the keyboard display
 // below that, a control area that shows the USB connection
 // to the keyboard
-m_panel = new CMainPanel(this);
+m_panel = NULL;                         /* panel events may come before ...  */
+m_panel = new CMainPanel(this);         /* ... this returns                  */
 
-CreateStatusBar();
+CreateStatusBar(2);                     /* 2nd field shows layout check      */
 SelectMatrix(0, 0);
 
 // set up 10ms timer
@@ -531,6 +746,34 @@ if (event.CanVeto() && GetApp()->IsLayoutModified())
     return;
     }
   }
+CKbdWnd *pKbdWnd = m_panel ? m_panel->GetKbdWnd() : NULL;
+if (pKbdWnd)                            /* keep the key press counters       */
+  pKbdWnd->SavePressCounts(GetApp()->GetHeatmapFile());
+GetApp()->MainClosed();                 /* a late device probe can't use it  */
+event.Skip();
+}
+
+/*****************************************************************************/
+/* OnMove : called when the window has been moved                            */
+/*****************************************************************************/
+
+void CMainFrame::OnMove(wxMoveEvent &event)
+{
+CKbdWnd *pKbdWnd = m_panel ? m_panel->GetKbdWnd() : NULL;
+if (pKbdWnd)                            /* might be on another display now   */
+  pKbdWnd->InvalidateFrameTime();
+event.Skip();
+}
+
+/*****************************************************************************/
+/* OnDisplayChanged : called when the display resolution has changed         */
+/*****************************************************************************/
+
+void CMainFrame::OnDisplayChanged(wxDisplayChangedEvent &event)
+{
+CKbdWnd *pKbdWnd = m_panel ? m_panel->GetKbdWnd() : NULL;
+if (pKbdWnd)                            /* refresh rate might have changed   */
+  pKbdWnd->InvalidateFrameTime();
 event.Skip();
 }
 
@@ -601,7 +844,9 @@ if (GetApp()->IsDevOpen() && GetApp()->InServiceMode())
 
 void CMainFrame::OnLayerCount(wxCommandEvent& event)
 {
+history.Clear();                        /* edits may refer to lost layers    */
 m_panel->SetLayers(m_panel->GetLayerChoice());
+CheckLayout();
 }
 
 /*****************************************************************************/
@@ -672,6 +917,26 @@ if (GetApp()->WritePWM(pwmUsb, pwmBt) < BLUSB_SUCCESS)
   }
 }
 
+/*****************************************************************************/
+/* OnLayerPage : another layer page has been selected                        */
+/*****************************************************************************/
+
+void CMainFrame::OnLayerPage(wxBookCtrlEvent& event)
+{
+if (m_panel)                            /* not while the panel is set up     */
+  m_panel->LayerSelected();
+event.Skip();
+}
+
+/*****************************************************************************/
+/* OnLayerStrip : a layer thumbnail has been clicked                         */
+/*****************************************************************************/
+
+void CMainFrame::OnLayerStrip(wxCommandEvent& event)
+{
+m_panel->SelectLayer(event.GetInt());
+}
+
 /*****************************************************************************/
 /* OnReadLayout : read layout from attached keyboard                         */
 /*****************************************************************************/
@@ -714,6 +979,20 @@ event.Enable(GetApp()->IsDevOpen());
 
 void CMainFrame::OnWriteLayout(wxCommandEvent& event)
 {
+if (layoutCheck.GetProblems())
+  {
+  CNoServiceMode nosm;                  /* no service mode in here!          */
+  wxString msg(wxT("The layout has problems:\n"));
+  for (int i = 0; i < layoutCheck.GetProblems() && i < 10; i++)
+    msg += wxT("\n") + layoutCheck.GetProblemText(i);
+  if (layoutCheck.GetProblems() > 10)
+    msg += wxT("\n...");
+  msg += wxT("\n\nDo you really want to write it to the keyboard?");
+  if (wxMessageBox(msg, wxT("Please confirm"),
+                   wxICON_QUESTION | wxYES_NO) != wxYES)
+    return;
+  }
+
 wxBusyCursor wait;
 if (GetApp()->WriteLayout() < BLUSB_SUCCESS)
   {
@@ -822,18 +1101,367 @@ void CMainFrame::OnWriteFile(wxCommandEvent& event)
 CNoServiceMode nosm;                    /* no service mode in here!          */
 
 wxFileDialog of(this, wxT("Save to BlUSB File"), wxT("."), wxEmptyString,
-                wxT("BlUSB Files (*.blu)|*.blu|All Files (*)|*.*"),
+                wxT("BlUSB Files (*.blu)|*.blu|All Files (*)|*.*|")
+                wxT("All Files, sparse upper layers (*)|*.*"),
                 wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
 int rc = of.ShowModal();
 if (rc != wxID_OK)
   return;
 
-if (GetApp()->WriteLayout(of.GetPath(), !of.GetFilterIndex()) < BLUSB_SUCCESS)
+int nFilter = of.GetFilterIndex();
+if (GetApp()->WriteLayout(of.GetPath(), !nFilter, NULL, nFilter == 2) < BLUSB_SUCCESS)
   wxMessageBox(wxT("Error writing layout to ") + of.GetPath(),
                wxT("Model M Error"),
                wxOK | wxCENTRE);
 }
 
+/*****************************************************************************/
+/* OnReadProfile : called to read a profile                                  */
+/*****************************************************************************/
+
+void CMainFrame::OnReadProfile(wxCommandEvent& event)
+{
+CNoServiceMode nosm;                    /* no service mode in here!          */
+
+if (GetApp()->IsLayoutModified() &&
+    wxMessageBox("The current layout has not been saved; "
+                     "do you really want to load another?",
+                   "Please confirm",
+                   wxICON_QUESTION | wxYES_NO) != wxYES)
+  return;
+
+wxFileDialog of(this, wxT("Open BlUSB Profile"), wxT("."), wxEmptyString,
+                wxT("BlUSB Profiles (*.bpf)|*.bpf|All Files (*)|*.*"),
+                wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+int rc = of.ShowModal();
+if (rc != wxID_OK)
+  return;
+LoadProfile(of.GetPath());
+}
+
+/*****************************************************************************/
+/* LoadProfile : load a profile into the GUI (and the keyboard, if wanted)   */
+/*****************************************************************************/
+
+bool CMainFrame::LoadProfile(wxString const &filename)
+{
+KbdProfile prof;
+wxString err;
+if (!prof.ReadFile(filename, KbdProfile::secAll, &err))
+  {
+  wxMessageBox(err, wxT("Load ") + filename);
+  return false;
+  }
+if (GetApp()->IsDevOpen() &&
+    prof.GetFwVersion() > GetApp()->GetFwVersion() &&
+    wxMessageBox(wxString::Format(wxT("The profile has been made for firmware ")
+                                  wxT("V%d.%02x; the keyboard has V%d.%02x.\n")
+                                  wxT("Do you really want to load it?"),
+                                  prof.GetFwVersion() >> 8,
+                                  prof.GetFwVersion() & 0xff,
+                                  GetApp()->GetFwMajorVersion(),
+                                  GetApp()->GetFwMinorVersion()),
+                 "Please confirm",
+                 wxICON_QUESTION | wxYES_NO) != wxYES)
+  return false;
+
+// the GUI layout comes first, as it might reset the matrix
+if (prof.HasSection(KbdProfile::secGui))
+  {
+  KbdGui kg(prof.GetGui());
+  SetKbdGuiLayout(kg);
+  }
+if (prof.HasSection(KbdProfile::secLayers))
+  {
+  GetApp()->SetLayout(prof.GetLayout());
+  SetKbdLayout(GetApp()->GetLayout());
+  }
+bool bDebounce = m_panel->SetDebounce(prof.GetDebounce());
+wxUint8 pwmUsb, pwmBt;
+prof.GetPWM(pwmUsb, pwmBt);
+bool bPwm = prof.HasPWM() && m_panel->SetPwm(pwmUsb, pwmBt);
+
+// the keyboard gets the complete profile or nothing at all
+if (!GetApp()->IsDevOpen() ||
+    wxMessageBox(wxT("The profile has been loaded into the editor.\n")
+                 wxT("Do you want to write its layout, debounce and PWM ")
+                 wxT("values to the keyboard, too?"),
+                 "Please confirm",
+                 wxICON_QUESTION | wxYES_NO) != wxYES)
+  return true;
+
+wxBusyCursor wait;
+if (prof.HasSection(KbdProfile::secLayers))
+  {
+  if (GetApp()->WriteLayout() < BLUSB_SUCCESS)
+    wxMessageBox(wxT("Error writing layout to keyboard"),
+                 wxT("Model M Error"),
+                 wxOK | wxCENTRE);
+  else                                  /* saved to keyboard = unmodified    */
+    GetApp()->SetLayoutModified(false);
+  }
+if (bDebounce &&
+    GetApp()->WriteDebounce(prof.GetDebounce()) < BLUSB_SUCCESS)
+  wxMessageBox(wxT("Error writing new debounce value to keyboard"),
+               wxT("Model M Error"),
+               wxCANCEL | wxCENTRE);
+if (bPwm &&
+    GetApp()->WritePWM(pwmUsb, pwmBt) < BLUSB_SUCCESS)
+  wxMessageBox(wxT("Error writing new PWM values to keyboard"),
+               wxT("Model M Error"),
+               wxCANCEL | wxCENTRE);
+return true;
+}
+
+/*****************************************************************************/
+/* OnWriteProfile : called to write a profile                                */
+/*****************************************************************************/
+
+void CMainFrame::OnWriteProfile(wxCommandEvent& event)
+{
+CNoServiceMode nosm;                    /* no service mode in here!          */
+
+wxFileDialog of(this, wxT("Save to BlUSB Profile"), wxT("."), wxEmptyString,
+                wxT("BlUSB Profiles (*.bpf)|*.bpf|All Files (*)|*.*"),
+                wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+int rc = of.ShowModal();
+if (rc != wxID_OK)
+  return;
+
+KbdProfile prof;
+prof.SetName(wxFileName(of.GetPath()).GetName());
+if (GetApp()->IsDevOpen())
+  prof.SetFwVersion(GetApp()->GetFwVersion());
+prof.SetLayout(GetApp()->GetLayout());
+prof.SetGui(m_panel->GetKbdGuiLayout());
+prof.SetDebounce(m_panel->GetDebounce());
+if (m_panel->HasPwm())
+  prof.SetPWM((wxUint8)m_panel->GetPwmUsb(), (wxUint8)m_panel->GetPwmBt());
+if (!prof.WriteFile(of.GetPath()))
+  wxMessageBox(wxT("Error writing profile to ") + of.GetPath(),
+               wxT("Model M Error"),
+               wxOK | wxCENTRE);
+}
+
+/*****************************************************************************/
+/* ParseLibraryQuery : convert search text into a library query              */
+/*****************************************************************************/
+
+// "layer:<n>", "row:<n>" and "col:<n>" restrict the key position; the rest
+// is either a key name (as shown in the matrix) or a part of the layout /
+// file name, so names like "C64" or "R2" are searched as they are.
+
+static void ParseLibraryQuery(wxString const &text, KbdLibrary::Query &q)
+{
+wxString rest;
+wxArrayString toks = wxSplit(text, wxT(' '));
+for (size_t i = 0; i < toks.size(); i++)
+  {
+  wxString const &tok = toks[i];
+  if (tok.empty())
+    continue;
+  wxString lower = tok.Lower(), sVal;
+  int *field = NULL;
+  if (lower.StartsWith(wxT("layer:"), &sVal))
+    field = &q.layer;
+  else if (lower.StartsWith(wxT("row:"), &sVal))
+    field = &q.row;
+  else if (lower.StartsWith(wxT("col:"), &sVal))
+    field = &q.col;
+  long val;
+  if (field && sVal.ToLong(&val) && val >= 0)
+    {
+    *field = (int)val;
+    continue;
+    }
+  if (!rest.empty())
+    rest += wxT(' ');
+  rest += tok;
+  }
+if (rest.empty())
+  return;
+wxUint16 hid = Text2HID(rest);
+if (hid != KB_NONE)
+  q.key = hid;
+else
+  q.name = rest;
+}
+
+/*****************************************************************************/
+/* OnSearchLibrary : called to search a directory of layout files            */
+/*****************************************************************************/
+
+void CMainFrame::OnSearchLibrary(wxCommandEvent& event)
+{
+CNoServiceMode nosm;                    /* no service mode in here!          */
+
+wxString sDir;
+GetApp()->ReadConfig("/Settings/LibraryDir", &sDir, wxT("."));
+wxDirDialog dd(this, wxT("Select Layout Library Directory"), sDir,
+               wxDD_DEFAULT_STYLE | wxDD_DIR_MUST_EXIST);
+if (dd.ShowModal() != wxID_OK)
+  return;
+sDir = dd.GetPath();
+GetApp()->WriteConfig("/Settings/LibraryDir", sDir);
+
+wxString sQuery;
+GetApp()->ReadConfig("/Settings/LibraryQuery", &sQuery);
+sQuery = wxGetTextFromUser(wxT("Key to search for, optionally with its position\n")
+                           wxT("(e.g., \"layer:1 Media Play\" or \"layer:0 row:2 col:5 A\"),\n")
+                           wxT("or a part of the layout name (e.g., \"122 Key ISO\"):"),
+                           wxT("Search Layout Library"), sQuery, this);
+if (sQuery.empty())
+  return;
+GetApp()->WriteConfig("/Settings/LibraryQuery", sQuery);
+KbdLibrary::Query q;
+ParseLibraryQuery(sQuery, q);
+
+wxArrayInt found;
+  {
+  wxBusyCursor wait;
+  // the index survives program runs, so only new or changed files are read
+  wxString sIndex = GetApp()->GetLibraryIndexFile();
+  if (!library.GetFiles() && !sIndex.empty())
+    library.LoadIndex(sIndex);
+  library.Scan(sDir);
+  if (!sIndex.empty())
+    library.SaveIndex(sIndex);
+  library.Find(q, found);
+  }
+
+wxString sPrefix = wxFileName::DirName(sDir).GetFullPath();
+wxArrayString choices;
+for (size_t i = 0; i < found.size(); i++)
+  {
+  KbdLibrary::FileInfo const &fi = library.GetFile(found[i]);
+  choices.Add(wxString::Format(wxT("%s (%s)"),
+                               fi.name,
+                               fi.path.StartsWith(sPrefix) ?
+                                   fi.path.Mid(sPrefix.size()) : fi.path));
+  }
+if (choices.empty())
+  {
+  wxMessageBox(wxT("No matching files found in ") + sDir,
+               wxT("Search Layout Library"));
+  return;
+  }
+
+wxSingleChoiceDialog sd(this,
+                        wxString::Format(wxT("%d matching files; select one to load it:"),
+                                         (int)choices.size()),
+                        wxT("Search Layout Library"), choices);
+if (sd.ShowModal() != wxID_OK)
+  return;
+wxString sFile = library.GetFile(found[sd.GetSelection()]).path;
+wxString ext = sFile.AfterLast(wxT('.')).Lower();
+if (ext == wxT("kbl"))
+  {
+  KbdGui kg;
+  wxString err;
+  if (!kg.ReadLayoutFile(sFile, &err, GetApp()->GetGuiCacheFile(sFile)))
+    wxMessageBox(err, wxT("Load ") + sFile);
+  else if (SetKbdGuiLayout(kg))
+    GetApp()->WriteConfig("/Settings/KbdLayout", sFile);
+  return;
+  }
+
+if (GetApp()->IsLayoutModified() &&
+    wxMessageBox("The current layout has not been saved; "
+                     "do you really want to load another?",
+                   "Please confirm",
+                   wxICON_QUESTION | wxYES_NO) != wxYES)
+  return;
+if (ext == wxT("bpf"))
+  LoadProfile(sFile);
+else if (GetApp()->ReadLayout(sFile) < BLUSB_SUCCESS)
+  wxMessageBox(wxT("Error reading layout from ") + sFile,
+               wxT("Model M Error"),
+               wxCANCEL | wxCENTRE);
+else
+  SetKbdLayout(GetApp()->GetLayout());
+}
+
+/*****************************************************************************/
+/* CheckLayout : check the complete layout                                   */
+/*****************************************************************************/
+
+void CMainFrame::CheckLayout()
+{
+layoutCheck.Reset(GetApp()->GetLayout());
+SetStatusText(layoutCheck.GetSummary(), 1);
+}
+
+/*****************************************************************************/
+/* CheckLayoutKey : check the layout after a key change                      */
+/*****************************************************************************/
+
+void CMainFrame::CheckLayoutKey(int layer, int row, int col)
+{
+layoutCheck.Update(GetApp()->GetLayout(), layer, row, col);
+SetStatusText(layoutCheck.GetSummary(), 1);
+}
+
+/*****************************************************************************/
+/* LayoutKeyChanged : called when a single key has been changed in the grid  */
+/*****************************************************************************/
+
+void CMainFrame::LayoutKeyChanged
+    (
+    int layer,
+    int row,
+    int col,
+    MatrixKey oldKey,
+    MatrixKey newKey
+    )
+{
+KbdLayoutEdit edit(wxT("Key Change"));
+edit.Add(layer, row, col, oldKey, newKey);
+history.Add(edit);
+CheckLayoutKey(layer, row, col);        /* re-check the affected edges       */
+if (m_panel)
+  m_panel->UpdateLayerKey(layer, row, col);
+}
+
+/*****************************************************************************/
+/* ApplyLayoutEdit : record a bulk edit and show its results                 */
+/*****************************************************************************/
+
+void CMainFrame::ApplyLayoutEdit(KbdLayoutEdit const &edit)
+{
+if (edit.IsEmpty())
+  return;
+history.Add(edit);
+if (m_panel)
+  m_panel->UpdateLayers(edit.GetLayerMask());
+CheckLayout();
+}
+
+/*****************************************************************************/
+/* DevProbed : called when the device probe is done                          */
+/*****************************************************************************/
+
+void CMainFrame::DevProbed(bool bLayoutRead)
+{
+if (!m_panel)
+  return;
+
+// Enable / Disable Service Mode is not available in V1.5 and later
+wxMenu *pMenu = NULL;
+wxMenuItem *pItem = GetMenuBar()->FindItem(Blusb_ServiceMode, &pMenu);
+if (pItem && pMenu && GetApp()->GetFwVersion() >= 0x0105)
+  pMenu->Destroy(pItem);
+
+if (GetApp()->IsDevOpen())
+  {
+  m_panel->CreateDevControls();
+  m_panel->ReleasePages();              /* editors need the firmware's keys  */
+  }
+SetDevCaps(GetApp()->GetDevCaps());
+if (bLayoutRead)
+  SetKbdLayout(GetApp()->GetLayout());
+SetStatusText(wxT("Ready"));
+}
+
 /*****************************************************************************/
 /* SetKbdGuiLayout : setup new Keyboard GUI layout                           */
 /*****************************************************************************/
@@ -845,8 +1473,9 @@ if (!m_panel)
 
 int currows, curcols;
 m_panel->GetKbdGuiLayout().GetMatrixLayout(currows, curcols);
-int kbdrows = NUMROWS, kbdcols = curcols;
-GetApp()->ReadMatrixLayout(kbdrows, kbdcols);
+BlUsbDevCaps const &caps = GetApp()->GetDevCaps();
+int kbdrows = (caps.matrixRows > 0) ? caps.matrixRows : NUMROWS;
+int kbdcols = (caps.matrixCols > 0) ? caps.matrixCols : curcols;
 int newrows, newcols;
 layout.GetMatrixLayout(newrows, newcols);
 
@@ -873,6 +1502,7 @@ if (newrows > 1 && newcols > 1 &&  // <= 1 indicates "no matrix definitions"
                    wxICON_QUESTION | wxYES_NO | wxCENTRE) == wxYES)
     {
     GetApp()->SetDefaultLayout(layout);
+    history.Clear();
     m_panel->SetLayers(1, true);
     }
   }
@@ -1038,7 +1668,8 @@ if (rc != wxID_OK)
   return;
 KbdGui kg;
 wxString err;
-if (kg.ReadLayoutFile(of.GetPath(), &err))
+if (kg.ReadLayoutFile(of.GetPath(), &err,
+                     GetApp()->GetGuiCacheFile(of.GetPath())))
   {
   if (SetKbdGuiLayout(kg))
     GetApp()->WriteConfig("/Settings/KbdLayout", of.GetPath());
@@ -1073,3 +1704,274 @@ else
   wxMessageBox(err + of.GetPath(), wxT("Save Keyboard Layout"));
   }
 }
+
+/*****************************************************************************/
+/* SetKbdZoom : sets the on-screen keyboard's zoom factor                    */
+/*****************************************************************************/
+
+void CMainFrame::SetKbdZoom(int zoom)
+{
+if (!m_panel)
+  return;
+m_panel->SetKbdZoom(zoom);
+GetApp()->WriteConfig("/Settings/KbdZoom", (long)m_panel->GetKbdZoom());
+}
+
+/*****************************************************************************/
+/* OnKbdZoomIn : shows the on-screen keyboard larger                         */
+/*****************************************************************************/
+
+void CMainFrame::OnKbdZoomIn(wxCommandEvent& event)
+{
+if (m_panel)
+  SetKbdZoom(m_panel->GetKbdZoom() + CKbdWnd::zoomStep);
+}
+
+/*****************************************************************************/
+/* OnKbdZoomOut : shows the on-screen keyboard smaller                       */
+/*****************************************************************************/
+
+void CMainFrame::OnKbdZoomOut(wxCommandEvent& event)
+{
+if (m_panel)
+  SetKbdZoom(m_panel->GetKbdZoom() - CKbdWnd::zoomStep);
+}
+
+/*****************************************************************************/
+/* OnKbdZoomDefault : shows the on-screen keyboard in its default size       */
+/*****************************************************************************/
+
+void CMainFrame::OnKbdZoomDefault(wxCommandEvent& event)
+{
+SetKbdZoom(CKbdWnd::GetDefaultZoom());
+}
+
+/*****************************************************************************/
+/* OnKbdHeatmap : switches the key press heatmap on or off                   */
+/*****************************************************************************/
+
+void CMainFrame::OnKbdHeatmap(wxCommandEvent& event)
+{
+CKbdWnd *pKbdWnd = m_panel ? m_panel->GetKbdWnd() : NULL;
+if (!pKbdWnd)
+  return;
+pKbdWnd->ShowHeatmap(!pKbdWnd->IsHeatmapShown());
+GetApp()->WriteConfig("/Settings/KbdHeatmap", (long)pKbdWnd->IsHeatmapShown());
+}
+
+/*****************************************************************************/
+/* OnUpdateKbdHeatmap : update the visual appearance                         */
+/*****************************************************************************/
+
+void CMainFrame::OnUpdateKbdHeatmap(wxUpdateUIEvent& event)
+{
+CKbdWnd *pKbdWnd = m_panel ? m_panel->GetKbdWnd() : NULL;
+event.Check(pKbdWnd && pKbdWnd->IsHeatmapShown());
+}
+
+/*****************************************************************************/
+/* OnKbdHeatmapReset : clears the key press counters                         */
+/*****************************************************************************/
+
+void CMainFrame::OnKbdHeatmapReset(wxCommandEvent& event)
+{
+CKbdWnd *pKbdWnd = m_panel ? m_panel->GetKbdWnd() : NULL;
+if (!pKbdWnd ||
+    wxMessageBox(wxT("Do you really want to clear the key press counters?"),
+                 wxT("Reset Key Heatmap"),
+                 wxICON_QUESTION | wxYES_NO) != wxYES)
+  return;
+pKbdWnd->ResetPressCounts();
+pKbdWnd->SavePressCounts(GetApp()->GetHeatmapFile());
+}
+
+/*****************************************************************************/
+/* OnEditUndo : undo the last layout change                                  */
+/*****************************************************************************/
+
+void CMainFrame::OnEditUndo(wxCommandEvent& event)
+{
+KbdLayoutEdit const *edit = history.Undo(GetApp()->GetLayout());
+if (edit && m_panel)
+  {
+  m_panel->UpdateLayers(edit->GetLayerMask());
+  CheckLayout();
+  }
+}
+
+/*****************************************************************************/
+/* OnUpdateEditUndo : update the visual appearance                           */
+/*****************************************************************************/
+
+void CMainFrame::OnUpdateEditUndo(wxUpdateUIEvent& event)
+{
+event.Enable(history.CanUndo());
+wxString name = history.GetUndoName();
+event.SetText(name.size() ? wxT("&Undo ") + name + wxT("\tCtrl+Z") :
+                            wxString(wxT("&Undo\tCtrl+Z")));
+}
+
+/*****************************************************************************/
+/* OnEditRedo : redo the last undone layout change                           */
+/*****************************************************************************/
+
+void CMainFrame::OnEditRedo(wxCommandEvent& event)
+{
+KbdLayoutEdit const *edit = history.Redo(GetApp()->GetLayout());
+if (edit && m_panel)
+  {
+  m_panel->UpdateLayers(edit->GetLayerMask());
+  CheckLayout();
+  }
+}
+
+/*****************************************************************************/
+/* OnUpdateEditRedo : update the visual appearance                           */
+/*****************************************************************************/
+
+void CMainFrame::OnUpdateEditRedo(wxUpdateUIEvent& event)
+{
+event.Enable(history.CanRedo());
+wxString name = history.GetRedoName();
+event.SetText(name.size() ? wxT("&Redo ") + name + wxT("\tCtrl+Y") :
+                            wxString(wxT("&Redo\tCtrl+Y")));
+}
+
+/*****************************************************************************/
+/* OnEditMapKey : replace a key code by another one in all layers            */
+/*****************************************************************************/
+
+void CMainFrame::OnEditMapKey(wxCommandEvent& event)
+{
+wxSortedArrayString const &hidTexts = GetHIDTexts();
+wxArrayString texts;
+for (size_t i = 0; i < hidTexts.size(); i++)
+  texts.Add(hidTexts[i]);
+int from = wxGetSingleChoiceIndex(wxT("Key to replace:"),
+                                  wxT("Replace Key"), texts, this);
+if (from < 0)
+  return;
+int to = wxGetSingleChoiceIndex(wxT("Replace ") + texts[from] + wxT(" by:"),
+                                wxT("Replace Key"), texts, this);
+if (to < 0)
+  return;
+
+KbdLayoutEdit edit(wxT("Replace Key"));
+if (!GetApp()->GetLayout().MapKeys(0xffffffff,
+                                   (MatrixKey)Text2HID(texts[from]),
+                                   (MatrixKey)Text2HID(texts[to]),
+                                   &edit))
+  {
+  wxMessageBox(texts[from] + wxT(" is not used in this layout."),
+               wxT("Replace Key"), wxOK | wxCENTRE);
+  return;
+  }
+ApplyLayoutEdit(edit);
+}
+
+/*****************************************************************************/
+/* OnEditSwapKeys : swap the keys on two matrix positions in all layers      */
+/*****************************************************************************/
+
+void CMainFrame::OnEditSwapKeys(wxCommandEvent& event)
+{
+int row1 = 0, col1 = 0;
+if (m_panel)
+  m_panel->GetSelectedMatrix(row1, col1);
+wxString s = wxGetTextFromUser(wxT("Enter the matrix positions to swap ")
+                               wxT("as \"row,col row,col\":"),
+                               wxT("Swap Matrix Positions"),
+                               wxString::Format(wxT("%d,%d "), row1, col1),
+                               this);
+if (s.empty())
+  return;
+int row2, col2;
+if (wxSscanf(s, wxT("%d,%d %d,%d"), &row1, &col1, &row2, &col2) != 4)
+  {
+  wxMessageBox(wxT("Invalid matrix positions"),
+               wxT("Swap Matrix Positions"), wxOK | wxCENTRE);
+  return;
+  }
+KbdLayout &layout = GetApp()->GetLayout();
+if (row1 < 0 || row1 >= layout.GetRows() ||
+    col1 < 0 || col1 >= layout.GetCols() ||
+    row2 < 0 || row2 >= layout.GetRows() ||
+    col2 < 0 || col2 >= layout.GetCols())
+  {
+  wxMessageBox(wxString::Format(wxT("Matrix positions have to be between ")
+                                wxT("0,0 and %d,%d"),
+                                layout.GetRows() - 1, layout.GetCols() - 1),
+               wxT("Swap Matrix Positions"), wxOK | wxCENTRE);
+  return;
+  }
+if (row1 == row2 && col1 == col2)
+  {
+  wxMessageBox(wxT("Please enter two different matrix positions"),
+               wxT("Swap Matrix Positions"), wxOK | wxCENTRE);
+  return;
+  }
+
+KbdLayoutEdit edit(wxT("Swap Positions"));
+if (!layout.SwapKeys(0xffffffff, row1, col1, row2, col2, &edit))
+  {
+  wxMessageBox(wxT("Both positions have the same keys on all layers"),
+               wxT("Swap Matrix Positions"), wxOK | wxCENTRE);
+  return;
+  }
+ApplyLayoutEdit(edit);
+}
+
+/*****************************************************************************/
+/* OnEditClearRow : remove all keys from the selected matrix row             */
+/*****************************************************************************/
+
+void CMainFrame::OnEditClearRow(wxCommandEvent& event)
+{
+int row, col;
+if (!m_panel || !m_panel->GetSelectedMatrix(row, col))
+  return;
+KbdLayout &layout = GetApp()->GetLayout();
+KbdLayoutEdit edit(wxT("Clear Row"));
+layout.FillKeys(1 << m_panel->GetCurrentLayer(),
+                row, 0, 1, layout.GetCols(), KB_NONE, &edit);
+ApplyLayoutEdit(edit);
+}
+
+/*****************************************************************************/
+/* OnUpdateEditClearRow : update the visual appearance                       */
+/*****************************************************************************/
+
+void CMainFrame::OnUpdateEditClearRow(wxUpdateUIEvent& event)
+{
+int row, col;
+event.Enable(m_panel && m_panel->GetSelectedMatrix(row, col));
+}
+
+/*****************************************************************************/
+/* OnEditCopyLayer : copy the current layer's keys to other layers           */
+/*****************************************************************************/
+
+void CMainFrame::OnEditCopyLayer(wxCommandEvent& event)
+{
+if (!m_panel)
+  return;
+KbdLayout &layout = GetApp()->GetLayout();
+int srcLayer = m_panel->GetCurrentLayer();
+wxArrayString names;
+for (int i = 0; i < layout.GetLayers(); i++)
+  names.Add(wxString::Format(wxT("Layer %d"), i + 1));
+wxArrayInt selections;
+if (wxGetSelectedChoices(selections,
+                         wxString::Format(wxT("Copy layer %d to:"),
+                                          srcLayer + 1),
+                         wxT("Copy Layer"), names, this) <= 0)
+  return;
+wxUint32 layerMask = 0;
+for (size_t i = 0; i < selections.size(); i++)
+  layerMask |= 1 << selections[i];
+
+KbdLayoutEdit edit(wxT("Copy Layer"));
+layout.CopyKeys(srcLayer, layerMask,
+                0, 0, layout.GetRows(), layout.GetCols(), &edit);
+ApplyLayoutEdit(edit);
+}
@@ -20,10 +20,14 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #ifndef _MainFrm_h__included_
 #define _MainFrm_h__included_
 
+#include "BlUsbDev.h"
 #include "KbdGuiLayout.h"
+#include "LayoutCheck.h"
+#include "LayoutLibrary.h"
 
 #include "MatrixWnd.h"
 #include "KbdWnd.h"
+#include "LayerStrip.h"
 
 /*===========================================================================*/
 /* Constants                                                                 */
@@ -39,6 +43,9 @@ enum
   // Timers
   Blusb_Timer1 = 1,
 
+  // background threads
+  Blusb_DevProbe = 100,
+
   // navigation menu
   Blusb_TabForward = 200,
   Blusb_TabBackward,
@@ -47,12 +54,24 @@ enum
   Blusb_Debounce,
   Blusb_PwmUsb,
   Blusb_PwmBt,
+  Blusb_LayerNotebook,
+  Blusb_LayerStrip,
+
+  Blusb_Edit_Undo,
+  Blusb_Edit_Redo,
+  Blusb_Edit_MapKey,
+  Blusb_Edit_SwapKeys,
+  Blusb_Edit_ClearRow,
+  Blusb_Edit_CopyLayer,
 
   Blusb_ResetLayout,
   Blusb_ReadLayout,
   Blusb_WriteLayout,
   Blusb_ReadFile,
   Blusb_WriteFile,
+  Blusb_ReadProfile,
+  Blusb_WriteProfile,
+  Blusb_SearchLibrary,
   Blusb_ServiceMode,
 
   Blusb_Kbd_ANSI,
@@ -62,6 +81,11 @@ enum
   Blusb_Kbd_Reset,
   Blusb_Kbd_Load,
   Blusb_Kbd_Save,
+  Blusb_Kbd_ZoomIn,
+  Blusb_Kbd_ZoomOut,
+  Blusb_Kbd_ZoomDefault,
+  Blusb_Kbd_Heatmap,
+  Blusb_Kbd_HeatmapReset,
 
   Blusb_Max
   };
@@ -82,25 +106,59 @@ public:
             const wxSize& size = wxDefaultSize,
             long style = wxTAB_TRAVERSAL | wxNO_BORDER,
             const wxString& name = wxPanelNameStr)
-            : wxPanel(parent, winid, pos, size, style, name)
-      {
-      pMatrix = new CMatrixWnd(this, numRows, numCols);
-      szMatrix = pMatrix->GetMinSize();
-      }
+            : wxPanel(parent, winid, pos, size, style, name),
+              numRows(numRows), numCols(numCols), layer(0),
+              ctlRows(-1), ctlCols(-1), pKbdWnd(NULL), pMatrix(NULL)
+      { }
+
+    // the matrix window is only created when the page is shown, and can be
+    // released again while the page is hidden
+    bool IsRealized() { return !!pMatrix; }
+    void Realize();
+    void Release();
 
     CMatrixWnd *GetMatrix() { return pMatrix; }
-    void SetLayer(int layer) { pMatrix->SetLayer(layer); }
-    int GetLayer() { return pMatrix->GetLayer(); }
+    void SetLayer(int layer)
+      {
+      this->layer = layer;
+      if (pMatrix) pMatrix->SetLayer(layer);
+      }
+    int GetLayer() { return layer; }
     void SetKbdMatrix(KbdMatrix const &kbm)
-      { pMatrix->SetKbdMatrix(kbm); }
+      {
+      this->kbm = kbm;
+      if (pMatrix) pMatrix->SetKbdMatrix(kbm);
+      }
+    // same as SetKbdMatrix(), for changed contents of the same matrix
+    void UpdateKbdMatrix(KbdMatrix const &kbm)
+      {
+      this->kbm = kbm;
+      if (pMatrix) pMatrix->UpdateKbdMatrix(kbm);
+      }
+    void SetCtlMatrix(int rows, int cols)
+      {
+      ctlRows = rows;
+      ctlCols = cols;
+      if (pMatrix) pMatrix->SetCtlMatrix(rows, cols);
+      }
     void SelectMatrix(int row, int col)
-      { pMatrix->SelectMatrix(row, col); }
+      { Realize(); pMatrix->SelectMatrix(row, col); }
+    bool GetSelectedMatrix(int &row, int &col)
+      { return pMatrix && pMatrix->GetSelectedMatrix(row, col); }
     void SetKbdWnd(CKbdWnd *pKbdWnd = NULL)
-      { pMatrix->SetKbdWnd(pKbdWnd); }
+      {
+      this->pKbdWnd = pKbdWnd;
+      if (pMatrix) pMatrix->SetKbdWnd(pKbdWnd);
+      }
 
     bool Layout();
 
 protected:
+    int numRows, numCols;
+    int layer;
+    KbdMatrix kbm;                      /* contents while not realized       */
+    int ctlRows, ctlCols;               /* controller's matrix size          */
+    CKbdWnd *pKbdWnd;
     CMatrixWnd *pMatrix;
     wxSize szMatrix;
 };
@@ -138,6 +196,10 @@ public:
       { return pKbd->GetColour(ks); }
     void SetKbdColour(int ks, wxColour const &newClr)
       { pKbd->SetColour(ks, newClr); }
+    int GetKbdZoom()
+      { return pKbd->GetZoom(); }
+    void SetKbdZoom(int zoom)
+      { pKbd->SetZoom(zoom); }
 
     bool Layout();
 
@@ -152,6 +214,12 @@ protected:
 
 class CMainPanel : public wxPanel
 {
+public:
+    enum
+      {
+      matrixPagesKept = 3               /* realized matrix pages             */
+      };
+
 public:
     CMainPanel(wxWindow *parent);
 
@@ -162,16 +230,54 @@ public:
     int GetDebounce() { return pDebounce ? (pDebounce->GetSelection() + 1) : 0; }
     int GetPwmUsb()   { return pPwmUsb ? pPwmUsb->GetSelection() : 0; }
     int GetPwmBt()    { return pPwmBt ? pPwmBt->GetSelection() : 0; }
+    bool HasPwm()     { return pPwmUsb && pPwmBt; }
+    bool SetDebounce(int nDebounce)
+      {
+      if (!pDebounce || nDebounce < 1 || nDebounce > (int)pDebounce->GetCount())
+        return false;
+      pDebounce->Select(nDebounce - 1);
+      return true;
+      }
+    bool SetPwm(int pwmUsb, int pwmBt)
+      {
+      if (!HasPwm() ||
+          pwmUsb < 0 || pwmUsb >= (int)pPwmUsb->GetCount() ||
+          pwmBt < 0 || pwmBt >= (int)pPwmBt->GetCount())
+        return false;
+      pPwmUsb->Select(pwmUsb);
+      pPwmBt->Select(pwmBt);
+      return true;
+      }
 
     void SetKbdLayout(KbdLayout &layout);
+    void SetDevCaps(BlUsbDevCaps const &caps);
+    void CreateDevControls();
+    void ReleasePages();
     void SetKbdGuiLayout(KbdGui &layout)
       {
       pKbd->SetKbdLayout(layout);
+      pStrip->SetLayout(layout);
       kbdGuiLayout = layout;
       }
     KbdGui &GetKbdGuiLayout() { return kbdGuiLayout; }
+    CKbdWnd *GetKbdWnd() { return pKbd ? pKbd->GetKbdWnd() : NULL; }
+    int GetKbdZoom()
+      { return pKbd ? pKbd->GetKbdZoom() : 100; }
+    void SetKbdZoom(int zoom)
+      { if (pKbd) pKbd->SetKbdZoom(zoom); }
 
     void SelectMatrix(int row, int col);
+    void SelectLayer(int layer);
+    void LayerSelected()
+      {
+      RealizePage(pMatrixNotebook->GetSelection());
+      pStrip->SetSelection(pMatrixNotebook->GetSelection());
+      }
+    void UpdateLayerKey(int layer, int row, int col)
+      { pStrip->InvalidateKey(layer, row, col); }
+    void UpdateLayers(wxUint32 layerMask);
+    int GetCurrentLayer() { return pMatrixNotebook->GetSelection(); }
+    bool GetSelectedMatrix(int &row, int &col);
 
     void SetKeyState(int hidcode, int newstate)
       { if (pKbd) pKbd->SetKeyState(hidcode, newstate); }
@@ -183,12 +289,17 @@ public:
 protected:
     CMatrixPanel *CreateMatrixPage(wxWindow *parent,
                                    int numRows = NUMROWS, int numCols = NUMCOLS);
+    void RealizePage(int page);
 
+    wxStaticText *pStLayers;
     wxChoice *pLayers;
     wxChoice *pDebounce;
     wxChoice *pPwmUsb, *pPwmBt;
     wxNotebook *pMatrixNotebook;
     wxVector<CMatrixPanel *> matrices;
+    wxVector<int> recentPages;          /* realized pages, most recent first */
+    CLayerStrip *pStrip;
+    BlUsbDevCaps devCaps;               /* last pushed device capabilities   */
     CKbdPanel *pKbd;
     KbdGui kbdGuiLayout;
 };
@@ -212,6 +323,8 @@ private:
     void OnExit(wxCommandEvent& event);
     void OnAbout(wxCommandEvent& event);
     void OnClose(wxCloseEvent &event);
+    void OnMove(wxMoveEvent &event);
+    void OnDisplayChanged(wxDisplayChangedEvent &event);
 
     void OnReadMatrixTimer(wxTimerEvent& event);
 
@@ -219,6 +332,8 @@ private:
     void OnDebounce(wxCommandEvent& event);
     void OnPwmUsb(wxCommandEvent& event);
     void OnPwmBt(wxCommandEvent& event);
+    void OnLayerPage(wxBookCtrlEvent& event);
+    void OnLayerStrip(wxCommandEvent& event);
     void OnReset(wxCommandEvent& event);
     void OnReadLayout(wxCommandEvent& event);
     void OnUpdateReadLayout(wxUpdateUIEvent& event);
@@ -228,6 +343,9 @@ private:
     void OnUpdateServiceMode(wxUpdateUIEvent& event);
     void OnReadFile(wxCommandEvent& event);
     void OnWriteFile(wxCommandEvent& event);
+    void OnReadProfile(wxCommandEvent& event);
+    void OnWriteProfile(wxCommandEvent& event);
+    void OnSearchLibrary(wxCommandEvent& event);
     void OnKbdANSI(wxCommandEvent& event);
     void OnUpdateKbdANSI(wxUpdateUIEvent& event);
     void OnKbdISO(wxCommandEvent& event);
@@ -239,11 +357,40 @@ private:
     void OnKbdReset(wxCommandEvent& event);
     void OnKbdLoad(wxCommandEvent& event);
     void OnKbdSave(wxCommandEvent& event);
+    void OnKbdZoomIn(wxCommandEvent& event);
+    void OnKbdZoomOut(wxCommandEvent& event);
+    void OnKbdZoomDefault(wxCommandEvent& event);
+    void OnKbdHeatmap(wxCommandEvent& event);
+    void OnUpdateKbdHeatmap(wxUpdateUIEvent& event);
+    void OnKbdHeatmapReset(wxCommandEvent& event);
+    void OnEditUndo(wxCommandEvent& event);
+    void OnUpdateEditUndo(wxUpdateUIEvent& event);
+    void OnEditRedo(wxCommandEvent& event);
+    void OnUpdateEditRedo(wxUpdateUIEvent& event);
+    void OnEditMapKey(wxCommandEvent& event);
+    void OnEditSwapKeys(wxCommandEvent& event);
+    void OnEditClearRow(wxCommandEvent& event);
+    void OnUpdateEditClearRow(wxUpdateUIEvent& event);
+    void OnEditCopyLayer(wxCommandEvent& event);
 
 public:
     void SetKbdLayout(KbdLayout &layout)
-      { if (m_panel) m_panel->SetKbdLayout(layout); }
+      {
+      history.Clear();
+      if (m_panel) m_panel->SetKbdLayout(layout);
+      CheckLayout();
+      }
     bool SetKbdGuiLayout(KbdGui &layout);
+    void DevProbed(bool bLayoutRead);
+    void SetDevCaps(BlUsbDevCaps const &caps)
+      { if (m_panel) m_panel->SetDevCaps(caps); }
+    void SetKbdZoom(int zoom);
+    bool LoadProfile(wxString const &filename);
+    void CheckLayout();
+    void CheckLayoutKey(int layer, int row, int col);
+    void LayoutKeyChanged(int layer, int row, int col,
+                          MatrixKey oldKey, MatrixKey newKey);
+    void ApplyLayoutEdit(KbdLayoutEdit const &edit);
     void SelectMatrix(int row, int col)
       { if (m_panel) m_panel->SelectMatrix(row, col); }
     void SetKeyState(int hidcode, int newstate)
@@ -257,6 +404,9 @@ private:
     CMainPanel *m_panel;
     wxTimer t;
     wxUint8 bufferLast[8];
+    KbdLayoutCheck layoutCheck;
+    KbdLibrary library;
+    KbdLayoutHistory history;           /* undo / redo for layout edits      */
 
 };
 
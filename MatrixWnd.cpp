@@ -29,10 +29,6 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 //#include "res/Application.xpm"
 #endif
 
-#ifndef ONE_CHOICE_EDITOR
-// would be much more efficient, but doesn't work satisfactorily
-#define ONE_CHOICE_EDITOR 0
-#endif
 #ifndef WITH_MATRIX_COMBOBOX
 #define WITH_MATRIX_COMBOBOX 1
 #endif
@@ -510,48 +506,224 @@ public:
 
 
 /*===========================================================================*/
-/* Text <-> HID hash maps / text array                                       */
+/* CMatrixTable class : grid table working directly on a keyboard matrix     */
+/*===========================================================================*/
+
+// The grid doesn't keep the cell values itself; they're taken from the
+// matrix when a cell is drawn, so setting a new matrix costs nearly nothing.
+// All cells have the same type, so the grid uses the one editor registered
+// for that type for all of them.
+
+#define MATRIXKEY_TYPE wxT("matrixkey")
+
+class CMatrixTable : public wxGridTableBase
+{
+public:
+    CMatrixTable()
+      : numRows(0), numCols(0), bSwitched(true),
+        ctlRows(MAXROWS), ctlCols(MAXCOLS)
+      {
+      pAttrUnusable = new wxGridCellAttr;
+      pAttrUnusable->SetBackgroundColour(
+          wxSystemSettings::GetColour(wxSYS_COLOUR_FRAMEBK));
+      }
+    virtual ~CMatrixTable()
+      { pAttrUnusable->DecRef(); }
+
+    void SetOrientation(bool switched) { bSwitched = switched; }
+    void SetKbdMatrix(KbdMatrix const &kbm) { this->kbm = kbm; }
+    void SetCtlMatrix(int ctlrows, int ctlcols)
+      {
+      // unknown controller matrix size - assume it's all usable
+      ctlRows = (ctlrows > 0) ? ctlrows : MAXROWS;
+      ctlCols = (ctlcols > 0) ? ctlcols : MAXCOLS;
+      }
+    KbdMatrix const &GetKbdMatrix() { return kbm; }
+
+    virtual int GetNumberRows() wxOVERRIDE { return numRows; }
+    virtual int GetNumberCols() wxOVERRIDE { return numCols; }
+    virtual bool IsEmptyCell(int row, int col) wxOVERRIDE { return false; }
+    virtual wxString GetValue(int row, int col) wxOVERRIDE
+      {
+      Cell2Matrix(row, col);
+      if (row >= kbm.GetRows() || col >= kbm.GetCols())
+        return HID2Text(KB_NONE);
+      return HID2Text((wxUint16)kbm.GetKey(row, col));
+      }
+    virtual void SetValue(int row, int col, const wxString& value) wxOVERRIDE
+      {
+      Cell2Matrix(row, col);
+      kbm.SetKey(row, col, Text2HID(value));
+      }
+    virtual wxString GetTypeName(int row, int col) wxOVERRIDE
+      { return MATRIXKEY_TYPE; }
+    virtual wxString GetRowLabelValue(int row) wxOVERRIDE
+      { return wxString::Format(bSwitched ? "C%d" : "R%d", row); }
+    virtual wxString GetColLabelValue(int col) wxOVERRIDE
+      { return wxString::Format(bSwitched ? "R%d" : "C%d", col); }
+    virtual wxGridCellAttr *GetAttr(int row, int col,
+                                    wxGridCellAttr::wxAttrKind kind) wxOVERRIDE
+      {
+      // if controller doesn't have that many columns, mark unusable ones
+      int mrow(row), mcol(col);
+      Cell2Matrix(mrow, mcol);
+      if (mrow < ctlRows && mcol < ctlCols)
+        return wxGridTableBase::GetAttr(row, col, kind);
+      pAttrUnusable->IncRef();
+      return pAttrUnusable;
+      }
+
+    virtual bool AppendRows(size_t n = 1) wxOVERRIDE
+      {
+      numRows += (int)n;
+      return Notify(wxGRIDTABLE_NOTIFY_ROWS_APPENDED, (int)n);
+      }
+    virtual bool DeleteRows(size_t pos = 0, size_t n = 1) wxOVERRIDE
+      {
+      n = min(n, (size_t)(numRows - (int)pos));
+      numRows -= (int)n;
+      return Notify(wxGRIDTABLE_NOTIFY_ROWS_DELETED, (int)pos, (int)n);
+      }
+    virtual bool AppendCols(size_t n = 1) wxOVERRIDE
+      {
+      numCols += (int)n;
+      return Notify(wxGRIDTABLE_NOTIFY_COLS_APPENDED, (int)n);
+      }
+    virtual bool DeleteCols(size_t pos = 0, size_t n = 1) wxOVERRIDE
+      {
+      n = min(n, (size_t)(numCols - (int)pos));
+      numCols -= (int)n;
+      return Notify(wxGRIDTABLE_NOTIFY_COLS_DELETED, (int)pos, (int)n);
+      }
+
+protected:
+    void Cell2Matrix(int &row, int &col)
+      {
+      if (bSwitched)
+        {
+        int i = col;
+        col = row;
+        row = i;
+        }
+      }
+    bool Notify(int id, int comInt1 = -1, int comInt2 = -1)
+      {
+      if (GetView())
+        {
+        wxGridTableMessage msg(this, id, comInt1, comInt2);
+        GetView()->ProcessTableMessage(msg);
+        }
+      return true;
+      }
+
+protected:
+    int numRows, numCols;               /* grid size                         */
+    bool bSwitched;                     /* grid rows are matrix columns      */
+    KbdMatrix kbm;
+    int ctlRows, ctlCols;               /* matrix size of the controller     */
+    wxGridCellAttr *pAttrUnusable;
+};
+
+
+/*===========================================================================*/
+/* Text <-> HID lookup tables / text array                                   */
 /*===========================================================================*/
 
-WX_DECLARE_STRING_HASH_MAP(wxUint16, Text2HID);
-WX_DECLARE_HASH_MAP(wxUint16, wxString, wxIntegerHash, wxIntegerEqual, HID2Text);
+// The lookup tables are plain static arrays of hidtxts[] indices, so
+// setting them up doesn't need any heap allocation, and lookups don't
+// need to construct temporary wxStrings.
+// HID -> Text: direct index, split by the type in the HID's high byte.
+// Text -> HID: open-addressing hash table over the texts.
+// Both only contain the entries available for the firmware version.
 
-static Text2HID text2HID;               /* Text -> HID map                   */
-static HID2Text hid2Text;               /* HID -> Text map                   */
+#define HIDTYPES      10                /* TYPE_KEY .. TYPE_MACRO, LED, MISC */
+#define TEXTHASHSIZE  1024              /* must be a power of 2, > 2*entries */
+
+static wxInt16 hidIndex[HIDTYPES][256]; /* HID -> hidtxts[] index + 1        */
+static wxInt16 textIndex[TEXTHASHSIZE]; /* Text hash -> hidtxts[] index + 1  */
+static wxUint16 curFwVer = 0;           /* firmware version of the tables    */
+static bool bTablesSet = false;
 static wxSortedArrayString hidTexts;    /* array of all the texts            */
-#if ONE_CHOICE_EDITOR
-static  CMatrixChoiceEditor *choices = NULL;
-#endif
+
+static inline int HIDTypeSlot(wxUint16 hid)
+{
+int type = hid >> 8;
+if (type <= TYPE_MACRO)
+  return type;
+if (type == TYPE_LED)
+  return TYPE_MACRO + 1;
+if (type == TYPE_MISC)
+  return TYPE_MACRO + 2;
+return -1;
+}
+
+static wxUint32 TextHash(const wxChar *txt)
+{
+wxUint32 h = 2166136261u;               /* FNV-1a                            */
+for (; *txt; txt++)
+  h = (h ^ (wxUint32)*txt) * 16777619u;
+return h;
+}
 
 void SetupText2HIDMapping(wxUint16 fwVer)
 {
-if (text2HID.size())
+if (bTablesSet && fwVer == curFwVer)
   return;
 
+wxCOMPILE_TIME_ASSERT(_countof(hidtxts) * 2 < TEXTHASHSIZE, TextHashTooSmall);
+memset(hidIndex, 0, sizeof(hidIndex));
+memset(textIndex, 0, sizeof(textIndex));
+hidTexts.clear();
 for (int i = 0; i < _countof(hidtxts); i++)
   {
-  if (fwVer >= hidtxts[i].minver)
-    {
-    hid2Text[hidtxts[i].hid] = hidtxts[i].txt;
-    text2HID[hidtxts[i].txt] = hidtxts[i].hid;
-    hidTexts.push_back(hidtxts[i].txt);
-    }
+  if (fwVer < hidtxts[i].minver)        /* not available in this firmware    */
+    continue;
+  int slot = HIDTypeSlot((wxUint16)hidtxts[i].hid);
+  if (slot >= 0)                        /* later entries win, as before      */
+    hidIndex[slot][hidtxts[i].hid & 0xff] = (wxInt16)(i + 1);
+  wxUint32 h = TextHash(hidtxts[i].txt) & (TEXTHASHSIZE - 1);
+  while (textIndex[h] &&
+         wxStrcmp(hidtxts[textIndex[h] - 1].txt, hidtxts[i].txt))
+    h = (h + 1) & (TEXTHASHSIZE - 1);
+  textIndex[h] = (wxInt16)(i + 1);
   }
-hidTexts.Sort();
-
-#if ONE_CHOICE_EDITOR
-choices = new CMatrixChoiceEditor(hidTexts.size(), &hidTexts[0]);
-#endif
+curFwVer = fwVer;
+bTablesSet = true;
 }
 
 void RemoveText2HIDMapping()
 {
-hid2Text.clear();
-text2HID.clear();
+memset(hidIndex, 0, sizeof(hidIndex));
+memset(textIndex, 0, sizeof(textIndex));
+bTablesSet = false;
 hidTexts.clear();
-#if ONE_CHOICE_EDITOR
-int nRefCnt = choices->GetRefCount();
-#endif
+}
+
+const wxChar *HID2Text(wxUint16 hid)
+{
+int slot = HIDTypeSlot(hid);
+int idx = (slot >= 0) ? hidIndex[slot][hid & 0xff] : 0;
+return idx ? hidtxts[idx - 1].txt : wxT("");
+}
+
+wxUint16 Text2HID(const wxChar *txt)
+{
+wxUint32 h = TextHash(txt) & (TEXTHASHSIZE - 1);
+for (int idx; (idx = textIndex[h]) != 0; h = (h + 1) & (TEXTHASHSIZE - 1))
+  if (!wxStrcmp(hidtxts[idx - 1].txt, txt))
+    return (wxUint16)hidtxts[idx - 1].hid;
+return KB_NONE;
+}
+
+wxSortedArrayString const &GetHIDTexts()
+{
+if (hidTexts.IsEmpty() && bTablesSet)   /* built on first use only           */
+  {
+  for (int i = 0; i < _countof(hidtxts); i++)
+    if (curFwVer >= hidtxts[i].minver)
+      hidTexts.Add(hidtxts[i].txt);
+  }
+return hidTexts;
 }
 
 /*===========================================================================*/
@@ -585,7 +757,11 @@ CMatrixWnd::CMatrixWnd
     )
 : wxGrid(parent, wxID_ANY, wxPoint(0,0), wxSize(700, 300))
 {
-CreateGrid(0, 0);
+pTable = new CMatrixTable;
+SetTable(pTable, true);
+// one editor for all cells
+RegisterDataType(MATRIXKEY_TYPE, new wxGridCellStringRenderer,
+                 new CMatrixChoiceEditor(GetHIDTexts().size(), &GetHIDTexts()[0]));
 SetOrientation(switched);
 SetLayout(numRows, numCols);
 SetKbdWnd();
@@ -607,12 +783,6 @@ SetMinSize(szNew);
 CMatrixWnd::~CMatrixWnd(void)
 {
 HideCellEditControl();  // make sure no editor is in use
-
-#if ONE_CHOICE_EDITOR
-for (int i = 0; i < GetNumberRows(); i++)
-  for (int j = 0; j < GetNumberCols(); j++)
-    SetCellEditor(i, j, NULL);
-#endif
 }
 
 /*****************************************************************************/
@@ -626,6 +796,7 @@ int oldCols = GetNumberCols();
 RC2Internal(oldRows, oldCols);
 SetLayout(0, 0);
 bColsRowsSwitched = switched;
+pTable->SetOrientation(switched);
 SetLayout(oldRows, oldCols);
 }
 
@@ -635,23 +806,12 @@ SetLayout(oldRows, oldCols);
 
 void CMatrixWnd::SetLayout(int numRows, int numCols)
 {
-int i, j;
-wxString sNone = hid2Text[KB_NONE];
-
 RC2Internal(numRows, numCols);
 
-#if 1
 int oldRows = GetNumberRows();
 int oldCols = GetNumberCols();
 
-#if ONE_CHOICE_EDITOR
-// unlink all superfluous choice editors
-for (i = numRows; i < oldRows; i++)
-  for (j = numCols; j < oldCols; j++)
-    SetCellEditor(i, j, NULL);
-#endif
-
-// reduce if necessary
+// reduce if necessary; the cell contents come from the table
 if (numRows < oldRows)
   DeleteRows(numRows, oldRows - numRows);
 if (numCols < oldCols)
@@ -660,55 +820,9 @@ if (numCols > oldCols)
   AppendCols(numCols - oldCols);
 if (numRows > oldRows)
   AppendRows(numRows - oldRows);
-#else
-int oldRows = 0;
-int oldCols = 0;
-CreateGrid(numRows, numCols);
-#endif
-
-if (numCols > oldCols)
-  {
-  for (i = oldCols; i < numCols; i++)
-    {
-    SetColSize(i, GetColSize(i) * 13 / 8);
-    SetColLabelValue(i,
-                     wxString::Format(bColsRowsSwitched ? "R%d" : "C%d", i));
-    }
-  }
-if (numRows > oldRows)
-  {
-  for (i = oldRows; i < numRows; i++)
-    SetRowLabelValue(i,
-                     wxString::Format(bColsRowsSwitched ? "C%d" : "R%d", i));
-  }
 
-// Needs to be done in two loops as row AND column count may have changed
-int minCols = min(oldCols, numCols);
-for (i = oldRows; i < numRows; i++)
-  for (j = 0; j < minCols; j++)
-    {
-    SetCellValue(i, j, sNone);
-#if ONE_CHOICE_EDITOR
-    SetCellEditor(i, j, choices);
-    choices->IncRef();  // necessary, as SetCellEditor() doesn't do it.
-#else
-    SetCellEditor(i, j,
-                  new CMatrixChoiceEditor(hidTexts.size(), &hidTexts[0]));
-#endif
-    }
-if (numCols > oldCols)
-  for (i = 0; i < numRows; i++)
-    for (j = oldCols; j < numCols; j++)
-      {
-      SetCellValue(i, j, sNone);
-#if ONE_CHOICE_EDITOR
-      SetCellEditor(i, j, choices);
-      choices->IncRef();  // necessary, as SetCellEditor() doesn't do it.
-#else
-      SetCellEditor(i, j,
-                    new CMatrixChoiceEditor(hidTexts.size(), &hidTexts[0]));
-#endif
-      }
+for (int i = oldCols; i < numCols; i++)
+  SetColSize(i, GetColSize(i) * 13 / 8);
 }
 
 /*****************************************************************************/
@@ -724,20 +838,8 @@ SetLayout(NUMROWS, NUMCOLS);
 // matrix layour determined by keyboard definition
 SetLayout(kbm.GetRows(), kbm.GetCols());
 #endif
-// if controller doesn't have that many columns, mark unusable ones
-int ctlrows = NUMROWS, ctlcols = NUMCOLS;
-GetApp()->ReadMatrixLayout(ctlrows, ctlcols);
-wxColour clrUnusable = wxSystemSettings::GetColour(wxSYS_COLOUR_FRAMEBK);
-for (int i = 0; i < GetNumberCols(); i++)
-  for (int j = 0; j < GetNumberRows(); j++)
-    {
-    wxUint16 key = kbm.GetKey(i, j);
-    int r(i), c(j);
-    RC2Internal(r, c);
-    SetCellValue(r, c, hid2Text[key]);
-    if (r >= ctlcols || c >= ctlrows)
-      SetCellBackgroundColour(r, c, clrUnusable);
-    }
+pTable->SetKbdMatrix(kbm);
+ForceRefresh();
 wxSize szNew(GetMatrixSize());
 SetSize(szNew);
 SetMinSize(szNew);
@@ -747,6 +849,38 @@ if (GetParent())
 
 }
 
+/*****************************************************************************/
+/* UpdateKbdMatrix : shows changed contents of the keyboard matrix           */
+/*****************************************************************************/
+
+void CMatrixWnd::UpdateKbdMatrix(KbdMatrix const &kbm)
+{
+// size and attributes stay; just repaint once with the new contents
+BeginBatch();
+pTable->SetKbdMatrix(kbm);
+EndBatch();
+}
+
+/*****************************************************************************/
+/* SetCtlMatrix : sets the controller's matrix size                          */
+/*****************************************************************************/
+
+void CMatrixWnd::SetCtlMatrix(int rows, int cols)
+{
+// if controller doesn't have that many columns, mark unusable ones
+pTable->SetCtlMatrix(rows, cols);
+ForceRefresh();
+}
+
+/*****************************************************************************/
+/* GetKbdMatrix : returns the keyboard matrix, including the edits           */
+/*****************************************************************************/
+
+KbdMatrix const &CMatrixWnd::GetKbdMatrix()
+{
+return pTable->GetKbdMatrix();
+}
+
 // this is going to be a long, interesting journey
 // into the abyss of OS dependencies ...
 
@@ -789,8 +923,7 @@ else
   key = KbdGui::GetHIDFromScancode(scancode);
 
 #else
-int kc = ev.GetKeyCode();               /* get key code from event           */
-int key = KbdGui::GetHID(kc);           /* retrieve HID for that key         */
+int key = KbdGui::GetHID(ev);           /* retrieve HID for that key         */
 #endif
 
 if (key != KB_UNUSED)
@@ -798,8 +931,8 @@ if (key != KB_UNUSED)
   int r = GetGridCursorRow(), c = GetGridCursorCol();
   if (r >= 0 && c >= 0)
     {
-    SetCellValue(r, c, hid2Text[key]);
-    GetApp()->GetLayout().SetKey(GetLayer(), c, r, key);
+    SetCellValue(r, c, HID2Text(key));
+    OnMatrixChanged(c, r, key);
     }
   ev.Skip(false);
   }
@@ -853,8 +986,7 @@ else
 #else
 
 // not for release builds until it really works!
-int kc = ev.GetKeyCode();
-int key = KbdGui::GetHID(kc);           /* retrieve HID for that key         */
+int key = KbdGui::GetHID(ev);           /* retrieve HID for that key         */
 #endif
 
 if (key != KB_UNUSED)
@@ -910,8 +1042,7 @@ if (key != KB_PSCRN)
 
 #else
 // not for release builds until it really works!
-int kc = ev.GetKeyCode();
-int key = KbdGui::GetHID(kc);           /* retrieve HID for that key         */
+int key = KbdGui::GetHID(ev);           /* retrieve HID for that key         */
 #endif
 
 if (key != KB_UNUSED)
@@ -919,8 +1050,8 @@ if (key != KB_UNUSED)
   int r = GetGridCursorRow(), c = GetGridCursorCol();
   if (r >= 0 && c >= 0)
     {
-    SetCellValue(r, c, hid2Text[key]);
-    GetApp()->GetLayout().SetKey(GetLayer(), c, r, key);
+    SetCellValue(r, c, HID2Text(key));
+    OnMatrixChanged(c, r, key);
     }
   ev.Skip(false);
   }
@@ -939,7 +1070,7 @@ void CMatrixWnd::OnCellValueChanged( wxGridEvent& ev )
 {
 int mrow = ev.GetRow(),
     mcol = ev.GetCol();
-wxUint16 key = text2HID[GetCellValue(mrow, mcol)];
+wxUint16 key = Text2HID(GetCellValue(mrow, mcol));
 
 RC2Internal(mrow, mcol);
 OnMatrixChanged(mrow, mcol, key);
@@ -967,11 +1098,29 @@ RC2Internal(row, col);
 GoToCell(row, col);
 }
 
+/*****************************************************************************/
+/* GetSelectedMatrix : returns the matrix position of the grid cursor        */
+/*****************************************************************************/
+
+bool CMatrixWnd::GetSelectedMatrix(int &row, int &col)
+{
+row = GetGridCursorRow();
+col = GetGridCursorCol();
+if (row < 0 || col < 0)
+  return false;
+RC2Internal(row, col);
+return true;
+}
+
 /*****************************************************************************/
 /* OnMatrixChanged : called when a matrix value has changed                  */
 /*****************************************************************************/
 
 void CMatrixWnd::OnMatrixChanged(int row, int col, wxUint16 key)
 {
-GetApp()->GetLayout().SetKey(GetLayer(), row, col, key);
+KbdLayout &layout = GetApp()->GetLayout();
+MatrixKey oldKey = (MatrixKey)layout.GetKey(GetLayer(), row, col);
+layout.SetKey(GetLayer(), row, col, key);
+if (GetApp()->GetMain())
+  GetApp()->GetMain()->LayoutKeyChanged(GetLayer(), row, col, oldKey, key);
 }
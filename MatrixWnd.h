@@ -27,6 +27,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 /*****************************************************************************/
 
 class CKbdWnd;
+class CMatrixTable;
 class CMatrixWnd : public wxGrid
 {
 public:
@@ -40,7 +41,11 @@ public:
     void SetLayer(int layer) { layernum = layer; }
     int GetLayer() { return layernum; }
     void SetKbdMatrix(KbdMatrix const &kbm);
+    void SetCtlMatrix(int rows, int cols);
+    void UpdateKbdMatrix(KbdMatrix const &kbm);
+    KbdMatrix const &GetKbdMatrix();
     void SelectMatrix(int row, int col);
+    bool GetSelectedMatrix(int &row, int &col);
     void SetKbdWnd(CKbdWnd *pKbdWnd = NULL) { this->pKbdWnd = pKbdWnd; }
 
     wxSize GetMatrixSize()
@@ -72,11 +77,17 @@ protected:
     int layernum;
     bool bColsRowsSwitched;
     CKbdWnd *pKbdWnd;
+    CMatrixTable *pTable;               /* owned by the grid                 */
 
 };
 
 void SetupText2HIDMapping(wxUint16 fwVer = MAX_FW_VER);
 void RemoveText2HIDMapping();
+const wxChar *HID2Text(wxUint16 hid);   /* "" if unknown                     */
+wxUint16 Text2HID(const wxChar *txt);   /* KB_NONE if unknown                */
+inline wxUint16 Text2HID(wxString const &txt)
+  { return Text2HID((const wxChar *)txt.c_str()); }
+wxSortedArrayString const &GetHIDTexts();  /* sorted texts for editors   */
 
 
 #endif // defined(_MatrixWnd_h__included_)
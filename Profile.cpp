@@ -0,0 +1,409 @@
+/*****************************************************************************/
+/* Profile.cpp : complete keyboard profile container                         */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "wxStd.h"
+#include "layout.h"
+#include "Profile.h"
+
+/*===========================================================================*/
+/* Profile file format                                                       */
+/*===========================================================================*/
+
+#define PROFILE_MAGIC    "BLPF"
+#define PROFILE_VERSION  1
+#define PROFILE_HDRSIZE  12             /* magic, version, count, CRC        */
+#define PROFILE_DIRSIZE  16             /* ID, offset, size, CRC             */
+#define PROFILE_INFOSIZE 12             /* information section w/o name      */
+#define PROFILE_MAXSIZE  0x100000       /* profiles are a few KB at most     */
+
+static const struct
+  {
+  const char *id;
+  int section;
+  } sectionIds[] =
+  {                                     /* in processing order               */
+  { "INFO", KbdProfile::secInfo },
+  { "LAYR", KbdProfile::secLayers },
+  { "MACR", KbdProfile::secMacros },
+  { "GUI ", KbdProfile::secGui },
+  };
+
+/*****************************************************************************/
+/* CRC32 calculation                                                         */
+/*****************************************************************************/
+
+static wxUint32 crcTable[256];
+
+static struct CrcTableSetup
+  {
+  CrcTableSetup()
+    {
+    for (wxUint32 i = 0; i < 256; i++)
+      {
+      wxUint32 crc = i;
+      for (int j = 0; j < 8; j++)
+        crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320U : (crc >> 1);
+      crcTable[i] = crc;
+      }
+    }
+  } crcTableSetup;
+
+static wxUint32 Crc32(const void *data, size_t len)
+{
+const wxUint8 *p = (const wxUint8 *)data;
+wxUint32 crc = 0xffffffffU;
+for (size_t i = 0; i < len; i++)
+  crc = crcTable[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+return crc ^ 0xffffffffU;
+}
+
+/*****************************************************************************/
+/* Little-endian value access                                                */
+/*****************************************************************************/
+
+static inline wxUint16 GetU16(const wxUint8 *p)
+{
+return (wxUint16)(p[0] | (p[1] << 8));
+}
+
+static inline wxUint32 GetU32(const wxUint8 *p)
+{
+return (wxUint32)p[0] | ((wxUint32)p[1] << 8) |
+       ((wxUint32)p[2] << 16) | ((wxUint32)p[3] << 24);
+}
+
+static inline void PutU16(wxUint8 *p, wxUint16 v)
+{
+p[0] = (wxUint8)v;
+p[1] = (wxUint8)(v >> 8);
+}
+
+static inline void PutU32(wxUint8 *p, wxUint32 v)
+{
+p[0] = (wxUint8)v;
+p[1] = (wxUint8)(v >> 8);
+p[2] = (wxUint8)(v >> 16);
+p[3] = (wxUint8)(v >> 24);
+}
+
+/*****************************************************************************/
+/* GetBlock : get a part of the file                                         */
+/*****************************************************************************/
+
+// If the complete file has been read, data points to it, and the block is
+// used in place; otherwise, it's read into mb.
+
+static const wxUint8 *GetBlock
+    (
+    wxFile &f,
+    const wxUint8 *data,
+    wxUint32 ofs,
+    wxUint32 len,
+    wxMemoryBuffer &mb
+    )
+{
+if (data)
+  return data + ofs;
+mb.SetBufSize(len + 1);
+if (f.Seek(ofs) != (wxFileOffset)ofs ||
+    f.Read(mb.GetData(), len) != (ssize_t)len)
+  return NULL;
+mb.SetDataLen(len);
+return (const wxUint8 *)mb.GetData();
+}
+
+/*****************************************************************************/
+/* SetError : set error text and return false                                */
+/*****************************************************************************/
+
+static bool SetError(wxString *error, wxString const &text)
+{
+if (error)
+  *error = text;
+return false;
+}
+
+/*===========================================================================*/
+/* KbdProfile class members                                                  */
+/*===========================================================================*/
+
+/*****************************************************************************/
+/* Clear : reset to empty profile                                            */
+/*****************************************************************************/
+
+void KbdProfile::Clear()
+{
+sections = secInfo;
+name.clear();
+fwVersion = 0;
+debounce = 0;
+bHasPWM = false;
+pwmUSB = pwmBT = 0;
+layers = rows = cols = macros = 0;
+layout = KbdLayout();
+}
+
+/*****************************************************************************/
+/* SetLayout : set the profile's layers and macros                           */
+/*****************************************************************************/
+
+void KbdProfile::SetLayout(KbdLayout &newLayout)
+{
+layout = newLayout;
+layers = layout.GetLayers();
+rows = layout.GetRows();
+cols = layout.GetCols();
+macros = layout.GetMacros();
+sections |= secLayers;
+if (macros)
+  sections |= secMacros;
+else
+  sections &= ~secMacros;
+}
+
+/*****************************************************************************/
+/* SetInfo : set up from information section                                 */
+/*****************************************************************************/
+
+bool KbdProfile::SetInfo(const wxUint8 *data, size_t len)
+{
+if (len < PROFILE_INFOSIZE)
+  return false;
+size_t nameLen = GetU16(data + 10);
+if (PROFILE_INFOSIZE + nameLen > len ||
+    data[6] > NUMLAYERS_MAX ||
+    data[7] > MAXROWS ||
+    data[8] > MAXCOLS ||
+    data[9] > NUM_MACROKEYS)
+  return false;
+fwVersion = GetU16(data);
+debounce = data[2];
+bHasPWM = !!(data[3] & 0x01);
+pwmUSB = data[4];
+pwmBT = data[5];
+layers = data[6];
+rows = data[7];
+cols = data[8];
+macros = data[9];
+name = wxString::FromUTF8((const char *)data + PROFILE_INFOSIZE, nameLen);
+return true;
+}
+
+/*****************************************************************************/
+/* GetInfo : get information section                                         */
+/*****************************************************************************/
+
+void KbdProfile::GetInfo(wxMemoryBuffer &mb)
+{
+wxScopedCharBuffer utf8(name.utf8_str());
+wxUint16 nameLen = (wxUint16)min(utf8.length(), (size_t)0xffff);
+wxUint8 info[PROFILE_INFOSIZE];
+PutU16(info, (wxUint16)fwVersion);
+info[2] = (wxUint8)debounce;
+info[3] = bHasPWM ? 0x01 : 0x00;
+info[4] = pwmUSB;
+info[5] = pwmBT;
+info[6] = (wxUint8)layers;
+info[7] = (wxUint8)rows;
+info[8] = (wxUint8)cols;
+info[9] = (wxUint8)macros;
+PutU16(info + 10, nameLen);
+mb.Clear();
+mb.AppendData(info, sizeof(info));
+mb.AppendData(utf8.data(), nameLen);
+}
+
+/*****************************************************************************/
+/* ReadFile : read a profile file                                            */
+/*****************************************************************************/
+
+bool KbdProfile::ReadFile(wxString const &filename, int wanted, wxString *error)
+{
+Clear();
+wxFile f;
+if (!f.Open(filename))
+  return SetError(error, wxT("Error opening ") + filename);
+wxFileOffset flen = f.Length();
+if (flen < PROFILE_HDRSIZE || flen > PROFILE_MAXSIZE)
+  return SetError(error, filename + wxT(" is no BlUSB profile"));
+wanted |= secInfo;
+
+// if everything is needed, the file is read in one go; otherwise, only
+// the header, directory and the requested sections are read
+wxMemoryBuffer mbFile, mbHdr, mbDir, mbSec;
+const wxUint8 *data = NULL;
+if ((wanted & secAll) == secAll)
+  {
+  mbFile.SetBufSize((size_t)flen);
+  if (f.Read(mbFile.GetData(), (size_t)flen) != (ssize_t)flen)
+    return SetError(error, wxT("Error reading ") + filename);
+  mbFile.SetDataLen((size_t)flen);
+  data = (const wxUint8 *)mbFile.GetData();
+  }
+
+const wxUint8 *hdr = GetBlock(f, data, 0, PROFILE_HDRSIZE, mbHdr);
+if (!hdr || memcmp(hdr, PROFILE_MAGIC, 4))
+  return SetError(error, filename + wxT(" is no BlUSB profile"));
+if (GetU16(hdr + 4) > PROFILE_VERSION)
+  return SetError(error, filename + wxT(" has been written by a newer version"));
+wxUint32 nSections = GetU16(hdr + 6);
+wxUint32 dirSize = nSections * PROFILE_DIRSIZE;
+const wxUint8 *dir = NULL;
+if (PROFILE_HDRSIZE + dirSize <= (wxUint32)flen)
+  dir = GetBlock(f, data, PROFILE_HDRSIZE, dirSize, mbDir);
+if (!dir || Crc32(dir, dirSize) != GetU32(hdr + 8))
+  return SetError(error, filename + wxT(" is damaged"));
+
+// locate the known sections; the first of each kind is used
+const wxUint8 *entry[_countof(sectionIds)] = { NULL };
+wxUint32 i;
+size_t j;
+for (i = 0; i < nSections; i++, dir += PROFILE_DIRSIZE)
+  for (j = 0; j < _countof(sectionIds); j++)
+    if (!entry[j] && !memcmp(dir, sectionIds[j].id, 4))
+      entry[j] = dir;
+if (!entry[0])
+  return SetError(error, filename + wxT(" is damaged"));
+
+int found = 0;
+for (j = 0; j < _countof(sectionIds); j++)
+  {
+  int section = sectionIds[j].section;
+  if (!entry[j] || !(wanted & section))
+    continue;
+  wxUint32 ofs = GetU32(entry[j] + 4), len = GetU32(entry[j] + 8);
+  const wxUint8 *p = NULL;
+  if ((ofs & 3) == 0 &&                 /* sections are 4-byte aligned       */
+      ofs <= (wxUint32)flen && len <= (wxUint32)flen - ofs)
+    p = GetBlock(f, data, ofs, len, mbSec);
+  bool bOK = p && Crc32(p, len) == GetU32(entry[j] + 12);
+  if (bOK)
+    switch (section)
+      {
+      case secInfo :
+        bOK = SetInfo(p, len);
+        break;
+      case secLayers :
+        bOK = len == 1 + sizeof(wxUint16) * layers * rows * cols &&
+              p[0] == layers &&
+              layout.Import((wxUint8 *)p, -1, rows, cols, NULL, 0, 1);
+        break;
+      case secMacros :
+        bOK = len == (wxUint32)macros * LEN_MACRO &&
+              layout.ImportMacros(p, len);
+        break;
+      case secGui :
+        bOK = gui.SetCompiled(p, len);
+        break;
+      }
+  if (!bOK && section == secGui)        /* a bad GUI layout isn't fatal;     */
+    continue;                           /* the default one is used instead   */
+  if (!bOK)
+    return SetError(error, wxString::Format(wxT("Section %s in "),
+                                            sectionIds[j].id) +
+                           filename + wxT(" is damaged"));
+  found |= section;
+  }
+
+layout.SetModified(false);
+sections = found;
+return true;
+}
+
+/*****************************************************************************/
+/* WriteFile : write a profile file                                          */
+/*****************************************************************************/
+
+bool KbdProfile::WriteFile(wxString const &filename)
+{
+wxMemoryBuffer mbSec[_countof(sectionIds)];
+size_t j;
+for (j = 0; j < _countof(sectionIds); j++)
+  {
+  switch (sectionIds[j].section)
+    {
+    case secInfo :
+      GetInfo(mbSec[j]);
+      break;
+    case secLayers :
+      if (HasSection(secLayers))
+        {
+        int bufsize = 1 + sizeof(wxUint16) * layers * rows * cols;
+        mbSec[j].SetBufSize(bufsize);
+        if (!layout.Export((wxUint8 *)mbSec[j].GetData(), bufsize,
+                           rows, cols, 1))
+          return false;
+        mbSec[j].SetDataLen(bufsize);
+        }
+      break;
+    case secMacros :
+      if (HasSection(secMacros))
+        mbSec[j].AppendData(layout.GetMacroData(), macros * LEN_MACRO);
+      break;
+    case secGui :
+      if (HasSection(secGui))
+        gui.GetCompiled(mbSec[j]);
+      break;
+    }
+  }
+
+int nSections = 0;
+for (j = 0; j < _countof(sectionIds); j++)
+  if (mbSec[j].GetDataLen())
+    nSections++;
+wxUint32 ofs = PROFILE_HDRSIZE + nSections * PROFILE_DIRSIZE;
+wxMemoryBuffer mb;
+mb.SetBufSize(ofs);
+mb.SetDataLen(ofs);
+wxUint8 *hdr = (wxUint8 *)mb.GetData();
+memset(hdr, 0, ofs);
+memcpy(hdr, PROFILE_MAGIC, 4);
+PutU16(hdr + 4, PROFILE_VERSION);
+PutU16(hdr + 6, (wxUint16)nSections);
+wxUint8 *dir = hdr + PROFILE_HDRSIZE;
+for (j = 0; j < _countof(sectionIds); j++)
+  {
+  wxUint32 len = (wxUint32)mbSec[j].GetDataLen();
+  if (!len)
+    continue;
+  memcpy(dir, sectionIds[j].id, 4);
+  PutU32(dir + 4, ofs);
+  PutU32(dir + 8, len);
+  PutU32(dir + 12, Crc32(mbSec[j].GetData(), len));
+  dir += PROFILE_DIRSIZE;
+  ofs += (len + 3) & ~3;                /* keep sections 4-byte aligned      */
+  }
+PutU32(hdr + 8, Crc32(hdr + PROFILE_HDRSIZE, nSections * PROFILE_DIRSIZE));
+
+static const wxUint8 padding[4] = { 0 };
+for (j = 0; j < _countof(sectionIds); j++)
+  {
+  size_t len = mbSec[j].GetDataLen();
+  if (!len)
+    continue;
+  mb.AppendData(mbSec[j].GetData(), len);
+  if (len & 3)
+    mb.AppendData(padding, 4 - (len & 3));
+  }
+
+wxFile f;
+if (!f.Create(filename, true))
+  return false;
+return f.Write(mb.GetData(), mb.GetDataLen()) == mb.GetDataLen();
+}
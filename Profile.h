@@ -0,0 +1,112 @@
+/*****************************************************************************/
+/* Profile.h : complete keyboard profile container                           */
+/*****************************************************************************/
+/*
+Copyright (C) 2019  Hermann Seib
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, version 3.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _Profile_h__included_
+#define _Profile_h__included_
+
+#include "KbdGuiLayout.h"
+
+/*****************************************************************************/
+/* KbdProfile : everything needed to set up a keyboard in one file           */
+/*****************************************************************************/
+
+/*
+A profile file (.bpf) bundles the layers, macros, debounce and PWM
+settings, the firmware version it was made for and, optionally, the GUI
+keyboard layout. It consists of
+- a header: "BLPF", format version (16 bits), number of sections (16 bits),
+  CRC32 of the section directory
+- the section directory; per section: 4-character ID, offset, size, CRC32
+- the sections, each starting on a 4-byte boundary
+All values are little-endian; this includes the GUI section, which
+contains a compiled GUI layout (see KbdGui::GetCompiled()).
+Sections:
+- INFO: firmware version, debounce, PWM, layer/row/column/macro counts,
+  profile name; this is all that's needed to list profiles
+- LAYR: layers in Model M USB transfer format
+- MACR: macros in Model M USB transfer format
+- GUI : GUI keyboard layout
+Each section is verified on its own, and only the requested ones are
+read, so listing profiles doesn't have to read the layer data. Unknown
+sections are ignored.
+*/
+
+class KbdProfile
+  {
+  public:
+    enum Section
+      {
+      secInfo   = 0x01,                 /* general information               */
+      secLayers = 0x02,                 /* layer definitions                 */
+      secMacros = 0x04,                 /* macro definitions                 */
+      secGui    = 0x08,                 /* GUI keyboard layout               */
+      secAll    = 0x0f
+      };
+
+    KbdProfile() { Clear(); }
+
+    void Clear();
+    // reads the requested sections; the information section is always read
+    bool ReadFile(wxString const &filename, int sections = secAll,
+                  wxString *error = NULL);
+    bool WriteFile(wxString const &filename);
+    // sections available after ReadFile(), or set up for WriteFile()
+    bool HasSection(int section) const { return !!(sections & section); }
+
+    wxString const &GetName() const { return name; }
+    void SetName(wxString const &newName) { name = newName; }
+    int GetFwVersion() const { return fwVersion; }
+    void SetFwVersion(int newVersion) { fwVersion = newVersion; }
+    int GetDebounce() const { return debounce; }  /* 0 if not set            */
+    void SetDebounce(int newDebounce) { debounce = newDebounce; }
+    bool HasPWM() const { return bHasPWM; }
+    void GetPWM(wxUint8 &pwmUSB, wxUint8 &pwmBT) const
+      { pwmUSB = this->pwmUSB; pwmBT = this->pwmBT; }
+    void SetPWM(wxUint8 pwmUSB, wxUint8 pwmBT)
+      { this->pwmUSB = pwmUSB; this->pwmBT = pwmBT; bHasPWM = true; }
+    // layout dimensions are available without reading the layers
+    int GetLayers() const { return layers; }
+    int GetRows() const { return rows; }
+    int GetCols() const { return cols; }
+    int GetMacros() const { return macros; }
+
+    KbdLayout &GetLayout() { return layout; }
+    void SetLayout(KbdLayout &newLayout);
+    KbdGui const &GetGui() const { return gui; }
+    void SetGui(KbdGui const &newGui)
+      { gui = newGui; sections |= secGui; }
+    void RemoveGui() { sections &= ~secGui; }
+
+  protected:
+    bool SetInfo(const wxUint8 *data, size_t len);
+    void GetInfo(wxMemoryBuffer &mb);
+
+  protected:
+    int sections;                       /* available sections                */
+    wxString name;
+    int fwVersion;
+    int debounce;
+    bool bHasPWM;
+    wxUint8 pwmUSB, pwmBT;
+    int layers, rows, cols, macros;
+    KbdLayout layout;
+    KbdGui gui;
+  };
+
+#endif // !defined(_Profile_h__included_)
@@ -26,8 +26,12 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 #include "MainFrm.h"
 #include "MatrixWnd.h"
+#include "LayoutConvert.h"
+#include "LayoutPreview.h"
 #include "blusb_gui.h"
 
+#include "wx/thread.h"
+
 /*****************************************************************************/
 /* Default Matrix layer contents                                             */
 /*****************************************************************************/
@@ -78,6 +82,24 @@ static MatrixKey def122matrix[] =
 // 7/11 - left part of Right Shift   (/? on Brazilian - presumably KB_INTL3)
 
 
+/*****************************************************************************/
+/* CDevProbe : thread that probes the attached keyboard                      */
+/*****************************************************************************/
+
+class CDevProbe : public wxThread
+  {
+  public:
+    CDevProbe() : wxThread(wxTHREAD_JOINABLE) { }
+
+  protected:
+    virtual ExitCode Entry()
+      {
+      GetApp()->ProbeDevice();
+      wxQueueEvent(GetApp(), new wxThreadEvent(wxEVT_THREAD, Blusb_DevProbe));
+      return 0;
+      }
+  };
+
 /*===========================================================================*/
 /* CBlusbGuiApp class members                                                */
 /*===========================================================================*/
@@ -95,7 +117,17 @@ pMain = NULL;
 inServiceMode = false;
 bCtlLayoutRead = false;
 curDefaultLayout = 0;
-nDevMatrixRows = nDevMatrixCols = -1;
+convertFormat = KbdConverter::fmtBinary;
+convertCols = NUMCOLS;
+convertThreads = 0;
+bConvertSparse = false;
+bConvertForce = false;
+batchExitCode = -1;
+previewZoom = 100;
+pProbe = NULL;
+probeRc = BLUSB_ERROR_NO_DEVICE;
+probeChanges = 0;
+msProbeOpen = msProbeCaps = msProbeLayout = 0;
 }
 
 /*****************************************************************************/
@@ -104,6 +136,7 @@ nDevMatrixRows = nDevMatrixCols = -1;
 
 wxBEGIN_EVENT_TABLE(CBlusbGuiApp, wxApp)
   EVT_ACTIVATE_APP(CBlusbGuiApp::OnActivateApp)
+  EVT_THREAD(Blusb_DevProbe, CBlusbGuiApp::OnDevProbed)
 wxEND_EVENT_TABLE()
 
 /*****************************************************************************/
@@ -112,10 +145,47 @@ wxEND_EVENT_TABLE()
 
 bool CBlusbGuiApp::OnInit()
 {
+swStartup.Start();
 if (!wxApp::OnInit() )
   return false;
 // command line parameters are set up now
 
+if (!convertSrc.empty())                /* batch conversion doesn't need     */
+  {                                     /* the keyboard or the GUI           */
+  KbdConverter conv(convertFormat, convertCols, bConvertSparse, bConvertForce);
+  conv.Convert(convertSrc, convertTgt, wxT("*.blu"), convertThreads);
+  wxMessageOutput::Get()->Printf(wxT("%s\n"), conv.GetReport());
+  batchExitCode = (wxDir::Exists(convertSrc) && conv.IsComplete()) ?
+                      0 : 1;
+  return true;                          /* OnRun() just returns the result   */
+  }
+if (!previewSrc.empty())                /* neither does preview rendering    */
+  {
+  wxImage::AddHandler(new wxPNGHandler);
+  SetupText2HIDMapping(MAX_FW_VER);
+  KbdGui gui(!previewKbd.CmpNoCase("ISO122") ? KbdGui::KbdISO122 :
+             !previewKbd.CmpNoCase("ANSI121") ? KbdGui::KbdANSI121 :
+             !previewKbd.CmpNoCase("ISO") ? KbdGui::KbdISO :
+             KbdGui::KbdANSI);
+  wxString err;
+  if (previewKbd.CmpNoCase("ISO") &&
+      previewKbd.CmpNoCase("ANSI") &&
+      previewKbd.CmpNoCase("ISO122") &&
+      previewKbd.CmpNoCase("ANSI121") &&
+      !gui.ReadLayoutFile(previewKbd, &err))
+    {
+    wxMessageOutput::Get()->Printf(wxT("%s\n"), err);
+    batchExitCode = 1;
+    return true;
+    }
+  KbdPreview preview(gui, previewZoom);
+  preview.RenderDir(previewSrc, convertTgt, wxT("*.blu"), convertThreads);
+  wxMessageOutput::Get()->Printf(wxT("%s\n"), preview.GetReport());
+  batchExitCode = (wxDir::Exists(previewSrc) && preview.GetFailed().empty()) ?
+                      0 : 1;
+  return true;
+  }
+
 //KbdGui::SetDefault(true);
 #if 0
 // #ifdef _DEBUG
@@ -159,36 +229,10 @@ defaultLayout[0].Resize(1, 8, 16, 0, defIBMmatrix);
 defaultLayout[1].Resize(1, 8, 20, 0, def122matrix);
 layout = defaultLayout[0];              /* and init current to normal M      */
 
-int rc = dev.Open();                    /* try to open the device            */
-SetupText2HIDMapping(dev.IsOpen() ? dev.GetFwVersion() : MAX_FW_VER);
-if (rc == BLUSB_SUCCESS)                /* if done,                          */
-  rc = ReadLayout();                    /* fetch current layout from Model M */
-if (rc != BLUSB_SUCCESS)
-  {
-  // dev.Close();
-  if (wxMessageBox(wxT("Make sure the Model M is connected to a USB port and switched to USB mode.\n\n")
-				   wxT("If it is, and has never been initialized before, just continue. ")
-				   wxT("As soon as a layout has been sent to the keyboard, this message will disappear.\n")
-#ifdef WIN32
-                   wxT("If it is, and has been initialized, and its firmware is V1.04 or below: ")
-                   wxT("don't panic! This is a simple driver issue. ")
-                   wxT("If you have not already done so, download Zadig from\n")
-                   wxT("  http://zadig.akeo.ie")
-                   wxT("\nand install the WinUSB driver. ")
-                   wxT("If that doesn't work, you can also give the LibUSB-win32 driver a try, whatever is going to work for you.\n")
-                   wxT("Once you are done configuring and want to use the Model M as a USB-attached keyboard again, ")
-                   wxT("uninstall the Model M USB device in Device Manager including device driver removal ")
-                   wxT("and then do a device rescan.\n")
-                   wxT("Quirky Windows(c) likes a little tinkering!\n\n")
-#endif
-                   wxT("Continue without attached Model M?"),
-                   wxT("Model M Open Error"),
-                   wxYES_NO | wxCENTRE | wxICON_QUESTION) != wxYES)
-    return false;
-  }
-
-if (GetFwVersion() >= 0x0105)           /* V1.5 and above is always in       */
-  inServiceMode = true;                 /* "service mode".                   */
+// the keyboard is probed in the background once the main window is there;
+// until then, everything is set up as if there were no keyboard
+SetupText2HIDMapping(MAX_FW_VER);
+UpdateDevCaps();
 
 // install hook and disable GUI keys
 CKbdWnd::HookLLKeyboard(true);
@@ -206,20 +250,146 @@ pMain = new CMainFrame(wxT("Blusb GUI"),
                        szWin);
 pMain->Show();
 pMain->SetKbdLayout(layout);
+wxLogVerbose(wxT("Startup: main window shown after %ld ms"), swStartup.Time());
+
+probeLayout = layout;                   /* kept if the keyboard is empty     */
+probeChanges = layout.GetChangeCount();
+pProbe = new CDevProbe;
+if (pProbe->Run() != wxTHREAD_NO_ERROR)
+  {                                     /* can't do it in the background ?   */
+  delete pProbe;
+  pProbe = NULL;
+  ProbeDevice();
+  wxThreadEvent ev(wxEVT_THREAD, Blusb_DevProbe);
+  OnDevProbed(ev);
+  }
+else
+  pMain->SetStatusText(wxT("Looking for the Model M ..."));
 
 return true;
 }
 
+/*****************************************************************************/
+/* ProbeDevice : open the keyboard and read its capabilities and layout      */
+/*****************************************************************************/
+
+/*
+This runs in the probe thread; it only touches the device and the probe
+results (probeRc, probeLayout, probeCaps, probeState and the timings),
+which OnDevProbed() takes over in the main thread after joining it.
+*/
+
+void CBlusbGuiApp::ProbeDevice()
+{
+wxStopWatch sw;
+probeRc = dev.Open();                   /* try to open the device            */
+msProbeOpen = sw.Time();
+if (probeRc == BLUSB_SUCCESS)           /* if done, fetch current layout     */
+  probeRc = ReadLayout(&probeLayout, &probeState);
+msProbeLayout = sw.Time() - msProbeOpen;
+probeCaps = ReadDevCaps(&probeState);   /* once for this connection          */
+msProbeCaps = sw.Time() - msProbeOpen - msProbeLayout;
+}
+
+/*****************************************************************************/
+/* OnDevProbed : called in the main thread when the device probe is done     */
+/*****************************************************************************/
+
+void CBlusbGuiApp::OnDevProbed(wxThreadEvent& event)
+{
+if (pProbe)
+  {
+  pProbe->Wait();
+  delete pProbe;
+  pProbe = NULL;
+  }
+wxStopWatch sw;
+
+SetupText2HIDMapping(dev.IsOpen() ? dev.GetFwVersion() : MAX_FW_VER);
+if (GetFwVersion() >= 0x0105)           /* V1.5 and above is always in       */
+  inServiceMode = true;                 /* "service mode".                   */
+devCaps = probeCaps;
+devState = probeState;
+// the layout read from the keyboard only replaces the default layout,
+// not one that has been loaded or edited in the meantime
+bool bLayoutRead = (probeRc == BLUSB_SUCCESS) &&
+                   layout.GetChangeCount() == probeChanges;
+if (bLayoutRead)
+  {
+  layout = probeLayout;
+  bCtlLayoutRead = true;
+  }
+if (pMain)
+  pMain->DevProbed(bLayoutRead);
+
+wxLogVerbose(wxT("Startup: device open %ld ms, layout read %ld ms, ")
+             wxT("capabilities %ld ms, UI update %ld ms; ")
+             wxT("done after %ld ms"),
+             msProbeOpen, msProbeLayout, msProbeCaps, sw.Time(),
+             swStartup.Time());
+
+if (probeRc != BLUSB_SUCCESS && pMain)
+  ShowOpenError();
+}
+
+/*****************************************************************************/
+/* ShowOpenError : tell the user that the keyboard couldn't be used          */
+/*****************************************************************************/
+
+void CBlusbGuiApp::ShowOpenError()
+{
+if (wxMessageBox(wxT("Make sure the Model M is connected to a USB port and switched to USB mode.\n\n")
+				   wxT("If it is, and has never been initialized before, just continue. ")
+				   wxT("As soon as a layout has been sent to the keyboard, this message will disappear.\n")
+#ifdef WIN32
+                 wxT("If it is, and has been initialized, and its firmware is V1.04 or below: ")
+                 wxT("don't panic! This is a simple driver issue. ")
+                 wxT("If you have not already done so, download Zadig from\n")
+                 wxT("  http://zadig.akeo.ie")
+                 wxT("\nand install the WinUSB driver. ")
+                 wxT("If that doesn't work, you can also give the LibUSB-win32 driver a try, whatever is going to work for you.\n")
+                 wxT("Once you are done configuring and want to use the Model M as a USB-attached keyboard again, ")
+                 wxT("uninstall the Model M USB device in Device Manager including device driver removal ")
+                 wxT("and then do a device rescan.\n")
+                 wxT("Quirky Windows(c) likes a little tinkering!\n\n")
+#endif
+                 wxT("Continue without attached Model M?"),
+                 wxT("Model M Open Error"),
+                 wxYES_NO | wxCENTRE | wxICON_QUESTION,
+                 pMain) != wxYES)
+  pMain->Close(true);
+}
+
+/*****************************************************************************/
+/* OnRun : run the main loop, unless a batch run is already done             */
+/*****************************************************************************/
+
+int CBlusbGuiApp::OnRun()
+{
+if (batchExitCode >= 0)
+  return batchExitCode;
+return wxApp::OnRun();
+}
+
 /*****************************************************************************/
 /* OnExit : application termination                                          */
 /*****************************************************************************/
 
 int  CBlusbGuiApp::OnExit()
 {
+if (pProbe)                             /* can't leave it dangling           */
+  {
+  pProbe->Wait();
+  delete pProbe;
+  pProbe = NULL;
+  }
 RemoveText2HIDMapping();
-dev.DisableServiceMode();   // just in case the user didn't.
+if (batchExitCode < 0)                  /* batch runs never touch the device */
+  {                                     /* or the keyboard hook              */
+  dev.DisableServiceMode();   // just in case the user didn't.
 
-CKbdWnd::HookLLKeyboard(false);  // make sure the low-level hook is deinstalled
+  CKbdWnd::HookLLKeyboard(false);  // make sure the low-level hook is deinstalled
+  }
 
 return wxApp::OnExit();
 }
@@ -234,27 +404,117 @@ void CBlusbGuiApp::OnInitCmdLine(wxCmdLineParser& parser)
 // /h, --help, --verbose
 wxApp::OnInitCmdLine(parser);
 
-#if 0 // not yet!
 // then add our own parameters
 static wxCmdLineEntryDesc cmdParms[] =
   {
   // kind, shortname, longname, description, type, flags
+#if 0 // not yet!
   { wxCMD_LINE_SWITCH,
         wxT("l"), wxT("log"), wxT("enable logging"),
         wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL | wxCMD_LINE_SWITCH_NEGATABLE },
   { wxCMD_LINE_SWITCH,
         wxT("o"), wxT("nologo"), wxT("disable splash screen"),
         wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL | wxCMD_LINE_SWITCH_NEGATABLE },
+#endif
+  { wxCMD_LINE_OPTION,
+        NULL, wxT("convert"), wxT("convert all layout files (*.blu) in directory and exit"),
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+  { wxCMD_LINE_OPTION,
+        NULL, wxT("to"), wxT("target directory for --convert or --preview (default: in place)"),
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+  { wxCMD_LINE_OPTION,
+        NULL, wxT("format"), wxT("target format for --convert: bin, hex or dec (default: bin)"),
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+  { wxCMD_LINE_OPTION,
+        NULL, wxT("cols"), wxT("target matrix columns for --convert: 16 or 20 (default: 20)"),
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+  { wxCMD_LINE_SWITCH,
+        NULL, wxT("sparse"), wxT("write upper layers as sparse overlays in text formats"),
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL },
+  { wxCMD_LINE_SWITCH,
+        NULL, wxT("force"), wxT("convert to 16 columns even if keys in columns 16-19 get lost"),
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL },
+  { wxCMD_LINE_OPTION,
+        NULL, wxT("threads"), wxT("number of threads for --convert or --preview (default: 1 per CPU)"),
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+  { wxCMD_LINE_OPTION,
+        NULL, wxT("preview"), wxT("render all layers of all layout files (*.blu) in directory to PNGs and exit"),
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+  { wxCMD_LINE_OPTION,
+        NULL, wxT("kbd"), wxT("keyboard for --preview: ANSI, ISO, ANSI121, ISO122 or a .kbl file (default: ANSI)"),
+        wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+  { wxCMD_LINE_OPTION,
+        NULL, wxT("zoom"), wxT("zoom factor in percent for --preview (default: 100)"),
+        wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+#ifdef _DEBUG
+  { wxCMD_LINE_SWITCH,
+        NULL, wxT("benchlookup"), wxT("log the cost of key lookups once, when the first keyboard layout is set up"),
+        wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL },
+#endif
   { wxCMD_LINE_NONE }
   };
 parser.SetDesc(cmdParms);
-#endif
 }
 
 bool CBlusbGuiApp::OnCmdLineParsed(wxCmdLineParser& parser)
 {
-#if 0  // not yet!
 // fetch parsed command line parameters
+if (parser.Found(wxT("convert"), &convertSrc))
+  {
+  if (!parser.Found(wxT("to"), &convertTgt))
+    convertTgt = convertSrc;
+  wxString fmt;
+  if (parser.Found(wxT("format"), &fmt))
+    {
+    if (fmt == wxT("bin"))
+      convertFormat = KbdConverter::fmtBinary;
+    else if (fmt == wxT("hex"))
+      convertFormat = KbdConverter::fmtHex;
+    else if (fmt == wxT("dec"))
+      convertFormat = KbdConverter::fmtDecimal;
+    else
+      {
+      wxLogError(wxT("Unknown format \"%s\""), fmt);
+      return false;
+      }
+    }
+  long l;
+  if (parser.Found(wxT("cols"), &l))
+    {
+    if (l != 16 && l != 20)
+      {
+      wxLogError(wxT("Only 16 or 20 columns are possible"));
+      return false;
+      }
+    convertCols = (int)l;
+    }
+  if (parser.Found(wxT("threads"), &l))
+    convertThreads = (int)l;
+  bConvertSparse = parser.Found(wxT("sparse"));
+  bConvertForce = parser.Found(wxT("force"));
+  }
+else if (parser.Found(wxT("preview"), &previewSrc))
+  {
+  if (!parser.Found(wxT("to"), &convertTgt))
+    convertTgt = previewSrc;
+  parser.Found(wxT("kbd"), &previewKbd);
+  long l;
+  if (parser.Found(wxT("zoom"), &l))
+    {
+    if (l < CKbdWnd::zoomMin || l > CKbdWnd::zoomMax)
+      {
+      wxLogError(wxT("The zoom factor has to be between %d and %d"),
+                 (int)CKbdWnd::zoomMin, (int)CKbdWnd::zoomMax);
+      return false;
+      }
+    previewZoom = (int)l;
+    }
+  if (parser.Found(wxT("threads"), &l))
+    convertThreads = (int)l;
+  }
+#ifdef _DEBUG
+if (parser.Found(wxT("benchlookup")))
+  CKbdWnd::RequestLookupBenchmark();
 #endif
 return wxApp::OnCmdLineParsed(parser);
 }
@@ -291,19 +551,65 @@ for (int i = GetDefaultLayouts() - 1; i >= 0; i--)
 SetDefaultLayout(usedef);
 }
 
+/*****************************************************************************/
+/* GetGuiCacheFile : returns compiled GUI layout file name for a layout file */
+/*****************************************************************************/
+
+wxString CBlusbGuiApp::GetGuiCacheFile(wxString const &filename)
+{
+// compiled GUI layouts are kept in the user data directory; the name
+// contains a hash of the layout file's full path to keep them apart
+wxFileName fn(filename);
+fn.MakeAbsolute();
+wxString dir = wxStandardPaths::Get().GetUserDataDir() +
+               wxFILE_SEP_PATH + wxT("cache");
+if (!wxFileName::Mkdir(dir, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL))
+  return wxEmptyString;                 /* no cache if it can't be created   */
+return dir + wxFILE_SEP_PATH +
+       wxString::Format(wxT("%s_%08lx.kbc"),
+                        fn.GetName(),
+                        wxStringHash::stringHash(fn.GetFullPath().wc_str()) & 0xffffffffUL);
+}
+
+/*****************************************************************************/
+/* GetLibraryIndexFile : returns the layout library index file name          */
+/*****************************************************************************/
+
+wxString CBlusbGuiApp::GetLibraryIndexFile()
+{
+wxString dir = wxStandardPaths::Get().GetUserDataDir();
+if (!wxFileName::Mkdir(dir, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL))
+  return wxEmptyString;
+return dir + wxFILE_SEP_PATH + wxT("library.idx");
+}
+
+/*****************************************************************************/
+/* GetHeatmapFile : returns the key press counter file name                  */
+/*****************************************************************************/
+
+wxString CBlusbGuiApp::GetHeatmapFile()
+{
+wxString dir = wxStandardPaths::Get().GetUserDataDir();
+if (!wxFileName::Mkdir(dir, wxS_DIR_DEFAULT, wxPATH_MKDIR_FULL))
+  return wxEmptyString;
+return dir + wxFILE_SEP_PATH + wxT("heatmap.txt");
+}
+
 /*****************************************************************************/
 /* ReadMatrixLayout : read matrix layout from keyboard                       */
 /*****************************************************************************/
 
-int CBlusbGuiApp::ReadMatrixLayout(int &rows, int &cols)
+int CBlusbGuiApp::ReadMatrixLayout(int &rows, int &cols, DevState *ps)
 {
 if (!dev.IsOpen())
   return BLUSB_ERROR_NO_DEVICE;
+if (!ps)
+  ps = &devState;
 
-if (nDevMatrixRows > 0)
+if (ps->matrixRows > 0)
   {
-  rows = nDevMatrixRows;
-  cols = nDevMatrixCols;
+  rows = ps->matrixRows;
+  cols = ps->matrixCols;
   return BLUSB_SUCCESS;
   }
 
@@ -328,8 +634,8 @@ if (lbuf[0] > 0 &&                      /* did we receive meaningful data?   */
   {
   if (fwVer >= 0x0105)  // this is DEFINITELY 20.
     {
-    rows = nDevMatrixRows = NUMROWS;
-    cols = nDevMatrixCols = NUMCOLS;
+    rows = ps->matrixRows = NUMROWS;
+    cols = ps->matrixCols = NUMCOLS;
     return BLUSB_SUCCESS;
     }
   else
@@ -342,8 +648,8 @@ if (lbuf[0] > 0 &&                      /* did we receive meaningful data?   */
       if (layercols * (2 * NUMROWS) == layerbytes)
         numcols = layercols;
 
-      rows = nDevMatrixRows = NUMROWS;
-      cols = nDevMatrixCols = numcols;
+      rows = ps->matrixRows = NUMROWS;
+      cols = ps->matrixCols = numcols;
       return BLUSB_SUCCESS;
       }
     }
@@ -352,8 +658,8 @@ else if (lbuf[0] == 0)                  /* no layout yet?                    */
   {
   if (fwVer >= 0x0103)  // this is DEFINITELY 20.
     {
-    rows = nDevMatrixRows = NUMROWS;
-    cols = nDevMatrixCols = NUMCOLS;
+    rows = ps->matrixRows = NUMROWS;
+    cols = ps->matrixCols = NUMCOLS;
     }
   else                                  /* otherwise ... can't determine.    */
     return BLUSB_ERROR_OTHER;           /* so make sure this ends NOW.       */
@@ -362,14 +668,52 @@ else if (lbuf[0] == 0)                  /* no layout yet?                    */
 return BLUSB_ERROR_NO_LAYOUT;
 }
 
+/*****************************************************************************/
+/* ReadDevCaps : take a snapshot of the device capabilities                  */
+/*****************************************************************************/
+
+BlUsbDevCaps CBlusbGuiApp::ReadDevCaps(DevState *ps)
+{
+BlUsbDevCaps caps;
+caps.bOpen = dev.IsOpen();
+if (caps.bOpen)
+  {
+  caps.fwVersion = dev.GetFwVersion();
+  caps.maxLayers = (caps.fwVersion >= 0x0105) ?
+                       NUMLAYERS_MAX :
+                       NUMLAYERS_MAX_OLD;
+  int rows = -1, cols = -1;             /* normally known from ReadLayout()  */
+  if (ReadMatrixLayout(rows, cols, ps) >= BLUSB_SUCCESS &&
+      rows > 0 && cols > 0)
+    {
+    caps.matrixRows = rows;
+    caps.matrixCols = cols;
+    }
+  }
+else
+  caps.maxLayers = NUMLAYERS_MAX;
+return caps;
+}
+
+/*****************************************************************************/
+/* UpdateDevCaps : renew the device capabilities and pass them to the views  */
+/*****************************************************************************/
+
+void CBlusbGuiApp::UpdateDevCaps()
+{
+devCaps = ReadDevCaps();
+if (pMain)                              /* push it to the views              */
+  pMain->SetDevCaps(devCaps);
+}
+
 /*****************************************************************************/
 /* ReadLayout : read layout from Model M or file                             */
 /*****************************************************************************/
 
-int CBlusbGuiApp::ReadLayout(KbdLayout *p)
+int CBlusbGuiApp::ReadLayout(KbdLayout *p, DevState *ps)
 {
 int numrows = -1, numcols = -1;         /* get rows / columns in buffer      */
-int rc = ReadMatrixLayout(numrows, numcols);
+int rc = ReadMatrixLayout(numrows, numcols, ps);
 if (rc < BLUSB_SUCCESS)
   return rc;
 
@@ -413,7 +757,15 @@ if (fwVer >= 0x0104)                    /* known first macro container       */
 if (!p->Import(lbuf, mb.GetBufSize(), numrows, numcols,
 	macbuf, macsize, (fwVer >= 0x0105) ? 1 : 0))
   return -103;
-bCtlLayoutRead = true;
+if (!ps)                                /* probe results are taken over      */
+  ps = &devState;                       /* later by OnDevProbed()            */
+if (macsize)                            /* remember device's macro set       */
+  {
+  int devsize = sizeof(ps->macros);
+  ps->bMacrosRead = p->ExportMacros(ps->macros, devsize);
+  }
+if (ps == &devState)
+  bCtlLayoutRead = true;
 return BLUSB_SUCCESS;
 }
 
@@ -463,9 +815,20 @@ if (!p)
 if (!p->Export(lbuf, lbufsz, numrows, numcols, (fwVer >= 0x0105) ? 1 : 0))
   return BLUSB_ERROR_OVERFLOW;
 rc = dev.WriteLayout(lbuf, lbufsz);
-if (rc >= BLUSB_SUCCESS)
+if (rc >= BLUSB_SUCCESS &&              /* flash macros along with layout    */
+    fwVer >= 0x0104 &&                  /* if they differ from the device's  */
+    p->GetMacros() &&
+    (!devState.bMacrosRead || !p->HasSameMacros(devState.macros)))
   {
-  // Macros
+  wxUint8 macbuf[NUM_MACROKEYS * LEN_MACRO];
+  int macsize = sizeof(macbuf);
+  p->ExportMacros(macbuf, macsize);
+  rc = dev.WriteMacros(macbuf, macsize);
+  if (rc >= BLUSB_SUCCESS)
+    {
+    memcpy(devState.macros, macbuf, sizeof(devState.macros));
+    devState.bMacrosRead = true;
+    }
   }
 return rc;
 }
@@ -474,11 +837,13 @@ int CBlusbGuiApp::WriteLayout
     (
     wxString const &filename,
     bool bNative,
-    KbdLayout *p
+    KbdLayout *p,
+    bool bSparse
     )
 {
 if (!p)
   p = &layout;
 
-return p->WriteFile(filename, bNative) ? BLUSB_SUCCESS : -100;
+return p->WriteFile(filename, bNative, NUMROWS, NUMCOLS, bSparse) ?
+    BLUSB_SUCCESS : -100;
 }
\ No newline at end of file
@@ -28,19 +28,42 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 /* CBlusbGuiApp : main program class                                         */
 /*****************************************************************************/
 
+/*
+The attached keyboard is probed in a background thread after the main
+window has been shown, since opening a missing or slow device can take
+several timeouts. While the probe runs, the device counts as not open
+for the rest of the program; its results are taken over in
+OnDevProbed(), which runs in the main thread.
+*/
+
+class CDevProbe;
 class CBlusbGuiApp : public wxApp
 {
+public:
+    // what has been read from the attached device's contents
+    struct DevState
+      {
+      int matrixRows, matrixCols;       // attached device's matrix layout
+      wxUint8 macros[NUM_MACROKEYS * LEN_MACRO];  // last known device macros
+      bool bMacrosRead;                 // flag whether macros is valid
+      DevState() : matrixRows(-1), matrixCols(-1), bMacrosRead(false)
+        { memset(macros, KB_UNUSED, sizeof(macros)); }
+      };
+
 public:
 	CBlusbGuiApp();
 
     virtual bool OnInit() wxOVERRIDE;
+    virtual int  OnRun() wxOVERRIDE;
     virtual int  OnExit() wxOVERRIDE;
     virtual void OnInitCmdLine(wxCmdLineParser& parser) wxOVERRIDE;
     virtual bool OnCmdLineParsed(wxCmdLineParser& parser) wxOVERRIDE;
 
     CMainFrame *GetMain() { return pMain; }
+    void MainClosed() { pMain = NULL; }
 
-    bool IsDevOpen() { return dev.IsOpen(); }
+    bool IsDevProbing() { return !!pProbe; }
+    bool IsDevOpen() { return !pProbe && dev.IsOpen(); }
     int EnableServiceMode()
       {
       int rc = dev.EnableServiceMode();
@@ -63,7 +86,11 @@ public:
       { return dev.GetFwMinorVersion(); }
     int GetFwVersion()
       { return dev.GetFwVersion(); }
-    int ReadMatrixLayout(int &rows, int &cols);
+    int ReadMatrixLayout(int &rows, int &cols, DevState *ps = NULL);
+    BlUsbDevCaps const &GetDevCaps() { return devCaps; }
+    BlUsbDevCaps ReadDevCaps(DevState *ps = NULL);
+    void UpdateDevCaps();
+    void ProbeDevice();                 /* called in the probe thread        */
     int ReadMatrixPos(wxUint8 *buffer, int buflen)
       { return dev.ReadMatrix(buffer, buflen); }
     int ReadPWM(wxUint8 &pwmUSB, wxUint8 &pwmBT)
@@ -76,10 +103,13 @@ public:
     void SetDefaultLayout(int nNum = 0) { curDefaultLayout = nNum; }
     void SetDefaultLayout(KbdGui const &gui);
     int GetDefaultLayouts() { return _countof(defaultLayout); }
-    int ReadLayout(KbdLayout *p = NULL);
+    int ReadLayout(KbdLayout *p = NULL, DevState *ps = NULL);
     int ReadLayout(wxString const &filename, KbdLayout *p = NULL);
     int WriteLayout(KbdLayout *p = NULL);
-    int WriteLayout(wxString const &filename, bool bNative = true, KbdLayout *p = NULL);
+    int WriteLayout(wxString const &filename, bool bNative = true, KbdLayout *p = NULL, bool bSparse = false);
+    wxString GetGuiCacheFile(wxString const &filename);
+    wxString GetLibraryIndexFile();
+    wxString GetHeatmapFile();
     bool IsCtlLayoutRead() { return bCtlLayoutRead; }
     bool IsLayoutModified() { return layout.IsModified(); }
     void SetLayoutModified(bool bOn = true) { layout.SetModified(bOn); }
@@ -100,6 +130,8 @@ private:
     wxDECLARE_EVENT_TABLE();
 private:
     void OnActivateApp(wxActivateEvent& event);
+    void OnDevProbed(wxThreadEvent& event);
+    void ShowOpenError();
 
 private:
     BlUsbDev dev;
@@ -109,7 +141,22 @@ private:
     CMainFrame *pMain;
     wxConfigBase *pConfig;
     bool bCtlLayoutRead;  // flag whether current layout read from keyboard
-    int nDevMatrixRows, nDevMatrixCols;  // attached device's matrix layout
+    DevState devState;  // attached device's matrix layout and macros
+    BlUsbDevCaps devCaps;  // attached device's capabilities
+    wxString convertSrc, convertTgt;  // batch conversion parameters
+    int convertFormat, convertCols, convertThreads;
+    bool bConvertSparse, bConvertForce;
+    int batchExitCode;  // process exit code after a batch run, -1 if none
+    wxString previewSrc, previewKbd;  // preview rendering parameters
+    int previewZoom;
+    CDevProbe *pProbe;  // running device probe thread
+    wxStopWatch swStartup;  // time since OnInit() start
+    int probeRc;  // device probe results
+    KbdLayout probeLayout;
+    BlUsbDevCaps probeCaps;
+    DevState probeState;
+    wxUint32 probeChanges;  // layout change count when the probe started
+    long msProbeOpen, msProbeCaps, msProbeLayout;  // device probe phases
 
 };
 wxDECLARE_APP(CBlusbGuiApp);